@@ -44,12 +44,11 @@ struct traversestate
     float tmin, tmax;
 };
 
-inline bool BIH::traverse(const mesh &m, const vec &o, const vec &ray, const vec &invray, float maxdist, float &dist, int mode, node *curnode, float tmin, float tmax)
+inline bool BIH::traverse(const mesh &m, const vec &o, const vec &ray, const vec &invray, const vec &mo, const vec &mray, float maxdist, float &dist, int mode, node *curnode, float tmin, float tmax)
 {
     traversestate stack[128];
     int stacksize = 0;
     ivec order(ray.x>0 ? 0 : 1, ray.y>0 ? 0 : 1, ray.z>0 ? 0 : 1);
-    vec mo = m.invxform.transform(o), mray = m.invxformnorm.transform(ray);
     for(;;)
     {
         int axis = curnode->axis();
@@ -99,7 +98,7 @@ inline bool BIH::traverse(const mesh &m, const vec &o, const vec &ray, const vec
                     }
                     else
                     {
-                        if(traverse(m, o, ray, invray, maxdist, dist, mode, curnode + curnode->childindex(nearidx), tmin, min(tmax, nearsplit))) return true;
+                        if(traverse(m, o, ray, invray, mo, mray, maxdist, dist, mode, curnode + curnode->childindex(nearidx), tmin, min(tmax, nearsplit))) return true;
                         curnode += curnode->childindex(faridx);
                         tmin = max(tmin, farsplit);
                         continue;
@@ -137,34 +136,131 @@ inline bool BIH::traverse(const vec &o, const vec &ray, float maxdist, float &di
         t2 = (m.bbmax.z - o.z)*invray.z;
         if(invray.z > 0) { tmin = max(tmin, t1); tmax = min(tmax, t2); } else { tmin = max(tmin, t2); tmax = min(tmax, t1); }
         tmax = min(tmax, maxdist);
-        if(tmin < tmax && traverse(m, o, ray, invray, maxdist, dist, mode, m.nodes, tmin, tmax)) return true;
+        if(tmin >= tmax) continue;
+        vec mo = m.invxform.transform(o), mray = m.invxformnorm.transform(ray);
+        if(traverse(m, o, ray, invray, mo, mray, maxdist, dist, mode, m.nodes, tmin, tmax)) return true;
     }
     return false;
 }
 
-void BIH::build(mesh &m, ushort *indices, int numindices, const ivec &vmin, const ivec &vmax)
+/// builds trees with the surface area heuristic instead of splitting at the middle of the bounds.
+VAR(bihsah, 0, 1, 1);
+
+#define BIHBINS 16
+
+static inline float bihsurface(const ivec &bbmin, const ivec &bbmax)
+{
+    vec size = vec(bbmax).sub(vec(bbmin));
+    return size.x*size.y + size.y*size.z + size.z*size.x;
+}
+
+static inline int bihbin(int c, int cmin, int extent)
+{
+    return ((c - cmin)*BIHBINS)/(extent + 1);
+}
+
+struct bihbucket
 {
-    int axis = 2;
-    loopk(2) if(vmax[k] - vmin[k] > vmax[axis] - vmin[axis]) axis = k;
+    int count;
+    ivec bbmin, bbmax;
+
+    void reset()
+    {
+        count = 0;
+        bbmin = ivec(INT_MAX, INT_MAX, INT_MAX);
+        bbmax = ivec(INT_MIN, INT_MIN, INT_MIN);
+    }
+
+    void add(const ivec &tmin, const ivec &tmax)
+    {
+        count++;
+        bbmin.min(tmin);
+        bbmax.max(tmax);
+    }
+
+    void add(const bihbucket &b)
+    {
+        count += b.count;
+        bbmin.min(b.bbmin);
+        bbmax.max(b.bbmax);
+    }
 
+    float cost() const { return count ? count*bihsurface(bbmin, bbmax) : 0; }
+};
+
+/// bins the triangle centers into BIHBINS buckets per axis and picks the boundary with the smallest SAH cost.
+/// returns false if all centers coincide, in which case the caller falls back to splitting the index range.
+static bool sahsplit(const BIH::tribb *tribbs, const ushort *indices, int numindices, int &bestaxis, int &bestbin, ivec &cmin, ivec &cmax)
+{
+    cmin = ivec(INT_MAX, INT_MAX, INT_MAX);
+    cmax = ivec(INT_MIN, INT_MIN, INT_MIN);
+    loopi(numindices)
+    {
+        ivec c(tribbs[indices[i]].center);
+        cmin.min(c);
+        cmax.max(c);
+    }
+    float bestcost = 1e30f;
+    bestaxis = -1;
+    loopk(3)
+    {
+        int extent = cmax[k] - cmin[k];
+        if(extent <= 0) continue;
+        bihbucket bins[BIHBINS];
+        loopj(BIHBINS) bins[j].reset();
+        loopi(numindices)
+        {
+            const BIH::tribb &tri = tribbs[indices[i]];
+            ivec trimin = ivec(tri.center).sub(ivec(tri.radius)),
+                 trimax = ivec(tri.center).add(ivec(tri.radius));
+            bins[bihbin(tri.center[k], cmin[k], extent)].add(trimin, trimax);
+        }
+        float rightcost[BIHBINS];
+        bihbucket side;
+        side.reset();
+        for(int j = BIHBINS-1; j > 0; j--)
+        {
+            side.add(bins[j]);
+            rightcost[j] = side.cost();
+        }
+        side.reset();
+        loopj(BIHBINS-1)
+        {
+            side.add(bins[j]);
+            if(!side.count || side.count >= numindices) continue;
+            float cost = side.cost() + rightcost[j+1];
+            if(cost < bestcost)
+            {
+                bestcost = cost;
+                bestaxis = k;
+                bestbin = j;
+            }
+        }
+    }
+    return bestaxis >= 0;
+}
+
+void BIH::build(mesh &m, ushort *indices, int numindices, const ivec &vmin, const ivec &vmax)
+{
     ivec leftmin, leftmax, rightmin, rightmax;
     int splitleft, splitright;
     int left, right;
-    loopk(3)
+    int axis, bin;
+    ivec cmin, cmax;
+    if(bihsah && sahsplit(m.tribbs, indices, numindices, axis, bin, cmin, cmax))
     {
         leftmin = rightmin = ivec(INT_MAX, INT_MAX, INT_MAX);
         leftmax = rightmax = ivec(INT_MIN, INT_MIN, INT_MIN);
-        int split = (vmax[axis] + vmin[axis])/2;
+        int extent = cmax[axis] - cmin[axis];
         for(left = 0, right = numindices, splitleft = SHRT_MIN, splitright = SHRT_MAX; left < right;)
         {
             const tribb &tri = m.tribbs[indices[left]];
             ivec trimin = ivec(tri.center).sub(ivec(tri.radius)),
                  trimax = ivec(tri.center).add(ivec(tri.radius));
-            int amin = trimin[axis], amax = trimax[axis];
-            if(max(split - amin, 0) > max(amax - split, 0))
+            if(bihbin(tri.center[axis], cmin[axis], extent) <= bin)
             {
                 ++left;
-                splitleft = max(splitleft, amax);
+                splitleft = max(splitleft, trimax[axis]);
                 leftmin.min(trimin);
                 leftmax.max(trimax);
             }
@@ -172,13 +268,47 @@ void BIH::build(mesh &m, ushort *indices, int numindices, const ivec &vmin, cons
             {
                 --right;
                 swap(indices[left], indices[right]);
-                splitright = min(splitright, amin);
+                splitright = min(splitright, trimin[axis]);
                 rightmin.min(trimin);
                 rightmax.max(trimax);
             }
         }
-        if(left > 0 && right < numindices) break;
-        axis = (axis+1)%3;
+    }
+    else
+    {
+        axis = 2;
+        loopk(2) if(vmax[k] - vmin[k] > vmax[axis] - vmin[axis]) axis = k;
+
+        loopk(3)
+        {
+            leftmin = rightmin = ivec(INT_MAX, INT_MAX, INT_MAX);
+            leftmax = rightmax = ivec(INT_MIN, INT_MIN, INT_MIN);
+            int split = (vmax[axis] + vmin[axis])/2;
+            for(left = 0, right = numindices, splitleft = SHRT_MIN, splitright = SHRT_MAX; left < right;)
+            {
+                const tribb &tri = m.tribbs[indices[left]];
+                ivec trimin = ivec(tri.center).sub(ivec(tri.radius)),
+                     trimax = ivec(tri.center).add(ivec(tri.radius));
+                int amin = trimin[axis], amax = trimax[axis];
+                if(max(split - amin, 0) > max(amax - split, 0))
+                {
+                    ++left;
+                    splitleft = max(splitleft, amax);
+                    leftmin.min(trimin);
+                    leftmax.max(trimax);
+                }
+                else
+                {
+                    --right;
+                    swap(indices[left], indices[right]);
+                    splitright = min(splitright, amin);
+                    rightmin.min(trimin);
+                    rightmax.max(trimax);
+                }
+            }
+            if(left > 0 && right < numindices) break;
+            axis = (axis+1)%3;
+        }
     }
 
     if(!left || right==numindices)
@@ -322,3 +452,68 @@ bool mmintersect(const extentity &e, const vec &o, const vec &ray, float maxdist
     return m->bih->traverse(mo, mray, maxdist ? maxdist : 1e16f, dist, mode);
 }
 
+
+/// Rebuilds the trees of all mapmodels used by the current map serially and in parallel,
+/// then casts random rays at their entities to measure traversal speed.
+void bihbench(int *passes)
+{
+    if(lightmapping) return;
+    int n = *passes > 0 ? *passes : 100000;
+    const vector<extentity *> &ents = entities::getents();
+    vector<model *> models;
+    vector<extentity *> mapmodels;
+    loopv(ents)
+    {
+        extentity &e = *ents[i];
+        if(e.type != ET_MAPMODEL) continue;
+        model *m = loadmapmodel(e.attr2);
+        if(!m || !m->setBIH()) continue;
+        mapmodels.add(&e);
+        if(models.find(m) < 0) models.add(m);
+    }
+    if(models.empty()) { conoutf(CON_WARN, "no mapmodels to benchmark"); return; }
+
+    loopv(models) DELETEP(models[i]->bih);
+    benchclock::time_point start = benchclock::now();
+    loopv(models) models[i]->setBIH();
+    benchclock::time_point serial = benchclock::now();
+    int numnodes = 0, numtris = 0;
+    loopv(models)
+    {
+        numnodes += models[i]->bih->numnodes;
+        numtris += models[i]->bih->numtris;
+        DELETEP(models[i]->bih);
+    }
+    benchclock::time_point parallelstart = benchclock::now();
+    parallelfor(models.length(), [&](int i) { models[i]->setBIH(); });
+    benchclock::time_point parallel = benchclock::now();
+    conoutf("build: %d models %d tris %d nodes %d us serial %d us parallel (%s)", models.length(), numtris, numnodes,
+        benchmicros(start, serial), benchmicros(parallelstart, parallel), bihsah ? "sah" : "midpoint");
+
+    struct bihray { extentity *e; vec o, ray; float maxdist; };
+    vector<bihray> rays;
+    loopi(n)
+    {
+        extentity &e = *mapmodels[i%mapmodels.length()];
+        BIH *b = loadmapmodel(e.attr2)->bih;
+        vec center = vec(b->center).add(e.o),
+            dir = vec(detrnd(4*i, 360)*RAD, (detrnd(4*i+1, 180)-90)*RAD),
+            target = vec(detrnd(4*i+2, 360)*RAD, (detrnd(4*i+3, 180)-90)*RAD).mul(0.5f*b->radius).add(center);
+        bihray &r = rays.add();
+        r.e = &e;
+        r.o = dir.mul(2*b->radius).add(center);
+        r.ray = vec(target).sub(r.o);
+        r.maxdist = r.ray.magnitude()*2;
+        r.ray.normalize();
+    }
+    int hits = 0;
+    benchclock::time_point raystart = benchclock::now();
+    loopv(rays)
+    {
+        float dist;
+        if(mmintersect(*rays[i].e, rays[i].o, rays[i].ray, rays[i].maxdist, RAY_ENTS|RAY_POLY, dist)) hits++;
+    }
+    int rayus = max(benchmicros(raystart, benchclock::now()), 1);
+    conoutf("rays: %d rays %d us (%.0f rays/s, %d hits)", n, rayus, n*1e6f/rayus, hits);
+}
+COMMAND(bihbench, "i");
@@ -84,7 +84,7 @@ struct BIH
     void build(mesh &m, ushort *indices, int numindices, const ivec &vmin, const ivec &vmax);
 
     bool traverse(const vec &o, const vec &ray, float maxdist, float &dist, int mode);
-    bool traverse(const mesh &m, const vec &o, const vec &ray, const vec &invray, float maxdist, float &dist, int mode, node *curnode, float tmin, float tmax);
+    bool traverse(const mesh &m, const vec &o, const vec &ray, const vec &invray, const vec &mo, const vec &mray, float maxdist, float &dist, int mode, node *curnode, float tmin, float tmax);
     bool triintersect(const mesh &m, int tidx, const vec &mo, const vec &mray, float maxdist, float &dist, int mode);
     
     void preload();
@@ -4,7 +4,7 @@
 #include "inexor/engine/engine.h"
 #include "inexor/rpc/SharedVar.h"
 
-hashnameset<ident> idents; // contains ALL vars/commands/aliases
+openhashnameset<ident> idents; // contains ALL vars/commands/aliases
 vector<ident *> identmap;
 ident *dummyident = NULL;
 
@@ -3199,3 +3199,80 @@ void clearsleep_(int *clearoverrides)
 COMMANDN(clearsleep, clearsleep_, "i");
 #endif
 
+
+/// Compares the chained (hashbase) and the open addressing (openhashbase) hash tables
+/// by inserting and looking up the names of all registered idents, i.e. the most common key type in the engine.
+template<template<class, class, class, class> class B>
+static void benchhashtable(const char *desc, const vector<const char *> &hits, const vector<const char *> &misses, int passes)
+{
+    hashtable<const char *, int, B> ht;
+    int found = 0;
+    benchclock::time_point start = benchclock::now();
+    loopv(hits) ht[hits[i]] = i;
+    benchclock::time_point inserted = benchclock::now();
+    loopj(passes) loopv(hits) if(ht.access(hits[i])) found++;
+    benchclock::time_point hit = benchclock::now();
+    loopj(passes) loopv(misses) if(ht.access(misses[i])) found++;
+    benchclock::time_point missed = benchclock::now();
+    conoutf("%s: %d keys, insert %d us, %d hits %d us, %d misses %d us (%d found)", desc, hits.length(),
+        benchmicros(start, inserted), passes*hits.length(), benchmicros(inserted, hit), passes*misses.length(), benchmicros(hit, missed), found);
+}
+
+void hashbench(int *passes)
+{
+    vector<const char *> hits, misses;
+    enumerate(idents, ident, id,
+    {
+        hits.add(id.name);
+        defformatstring(miss, "%s_", id.name);
+        misses.add(newstring(miss));
+    });
+    hits.shuffle();
+    int n = *passes > 0 ? *passes : 100;
+    benchhashtable<hashbase>("chained", hits, misses, n);
+    benchhashtable<openhashbase>("open addressing", hits, misses, n);
+    misses.deletearrays();
+}
+COMMAND(hashbench, "i");
+
+/// Fills and drops a temporary vector of 1 to 16 elements per pass, the typical pattern of per frame scratch vectors.
+template<class V>
+static void benchvector(const char *desc, int passes)
+{
+    int sum = 0;
+    benchclock::time_point start = benchclock::now();
+    loopi(passes)
+    {
+        V v;
+        loopj(1 + (i&15)) v.add(i+j);
+        loopvj(v) sum += v[j];
+    }
+    benchclock::time_point end = benchclock::now();
+    conoutf("%s: %d temporaries %d us (%d)", desc, passes, benchmicros(start, end), sum);
+}
+
+/// Grows a vector of trivially relocatable elements to a given size, which exercises the realloc growth path.
+template<class V>
+static void benchvectorgrowth(const char *desc, int passes, int len)
+{
+    int sum = 0;
+    benchclock::time_point start = benchclock::now();
+    loopi(passes)
+    {
+        V v;
+        loopj(len) v.add(ivec(i, j, len));
+        sum += v.last().y;
+    }
+    benchclock::time_point end = benchclock::now();
+    conoutf("%s: %d vectors of %d elements %d us (%d)", desc, passes, len, benchmicros(start, end), sum);
+}
+
+void vectorbench(int *passes)
+{
+    int n = *passes > 0 ? *passes : 1000000;
+    benchvector<vector<int> >("vector", n);
+    benchvector<smallvector<int, 16> >("smallvector", n);
+    benchvectorgrowth<vector<ivec> >("vector growth", max(n/1000, 1), 4096);
+    benchvectorgrowth<smallvector<ivec, 16> >("smallvector growth", max(n/1000, 1), 4096);
+}
+COMMAND(vectorbench, "i");
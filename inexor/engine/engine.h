@@ -6,6 +6,16 @@
 
 #include "inexor/rpc/SharedVar.h"
 
+#include <chrono>
+
+/// clock used by the benchmark commands
+typedef std::chrono::high_resolution_clock benchclock;
+
+static inline int benchmicros(const benchclock::time_point &start, const benchclock::time_point &end)
+{
+    return int(std::chrono::duration_cast<std::chrono::microseconds>(end - start).count());
+}
+
 #ifndef STANDALONE
 
 #include "inexor/engine/octa.h"
@@ -110,6 +120,7 @@ extern void guessshadowdir();
 
 // pvs
 extern void clearpvs();
+extern void invalidatepvs(const ivec &bbmin, const ivec &bbmax);
 extern bool pvsoccluded(const ivec &bbmin, const ivec &bbmax);
 extern bool pvsoccludedsphere(const vec &center, float radius);
 extern bool waterpvsoccluded(int height);
@@ -198,8 +209,8 @@ extern bool isvalidcube(const cube &c);
 extern ivec lu;
 extern int lusize;
 extern cube &lookupcube(const ivec &to, int tsize = 0, ivec &ro = lu, int &rsize = lusize);
-extern const cube *neighbourstack[32];
-extern int neighbourdepth;
+extern thread_local const cube *neighbourstack[32];
+extern thread_local int neighbourdepth;
 extern const cube &neighbourcube(const cube &c, int orient, const ivec &co, int size, ivec &ro = lu, int &rsize = lusize);
 extern void resetclipplanes();
 extern int getmippedtexture(const cube &p, int orient);
@@ -248,6 +259,7 @@ extern void cancelsel();
 extern void rendertexturepanel(int w, int h);
 extern void addundo(undoblock *u);
 extern void commitchanges(bool force = false);
+extern void updatechanges();
 extern void rendereditcursor();
 extern void tryedit();
 
@@ -259,6 +271,7 @@ extern vec decodenormal(ushort norm);
 extern void reduceslope(ivec &n);
 extern void findtjoints();
 extern void octarender();
+extern bool octarenderregion(const ivec &bbmin, const ivec &bbmax, const benchclock::time_point &deadline);
 extern void allchanged(bool load = false);
 extern void clearvas(cube *c);
 extern void destroyva(vtxarray *va, bool reparent = true);
@@ -389,7 +402,7 @@ extern void abortconnect();
 extern void clientkeepalive();
 
 // command
-extern hashnameset<ident> idents;
+extern openhashnameset<ident> idents;
 extern int identflags;
 
 extern void clearoverrides();
@@ -483,6 +496,10 @@ extern bool pointinsel(const selinfo &sel, const vec &o);
 extern void resetmap();
 extern void startmap(const char *name);
 
+// worldio
+extern void finishmapsave();
+extern void checkmapsave();
+
 // rendermodel
 extern SharedVar<char*> modeldir;
 
@@ -448,7 +448,7 @@ static inline uint hthash(const lightmapinfo &k)
     return hash;  
 }
 
-static hashset<layoutinfo> compressed;
+static openhashset<layoutinfo> compressed;
 
 VAR(lightcompress, 0, 3, 6);
 
@@ -79,6 +79,7 @@ void quit()
     disconnect();
     localdisconnect();
     writecfg();
+    finishmapsave();
     cleanup();
     exit(EXIT_SUCCESS);
 }
@@ -1370,7 +1371,7 @@ int main(int argc, char **argv)
 
     identflags |= IDF_PERSIST;
 
-    if(execfile("once.cfg", false)) remove(findfile("once.cfg", "rb"));
+    if(execfile("once.cfg", false)) removefile("once.cfg");
 
     if(load)
     {
@@ -1421,6 +1422,7 @@ int main(int argc, char **argv)
         if(lastmillis) game::updateworld();
 
         checksleep(lastmillis);
+        checkmapsave();
 
         serverslice(false, 0);
 
@@ -1429,6 +1431,7 @@ int main(int argc, char **argv)
 
         // miscellaneous general game effects
         recomputecamera();
+        updatechanges();
         updateparticles();
         updatesounds();
 
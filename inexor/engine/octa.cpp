@@ -2,12 +2,113 @@
 
 #include "inexor/engine/engine.h"
 
-cube *worldroot = newcubes(F_SOLID);
+/// fixed size blocks carved from big slabs, used for cube families and cubeexts.
+/// allocating from them instead of the heap keeps siblings and their children close to each other in memory
+/// (which octree traversal profits from) and avoids hundreds of thousands of small allocations on big maps.
+/// @warning has to be a plain aggregate: worldroot is allocated during static initialization
+struct octapool
+{
+    enum { SLABSIZE = 64*1024, SLABHEADER = 16 };
+
+    int blocksize;
+    void *freeblocks;   ///< linked through the first word of each block
+    uchar *slabs;       ///< linked through the first word of each slab
+    int numslabs, numused;
+    SDL_SpinLock lock;  ///< blocks are allocated from the lightmap and map loading threads as well
+
+    int blocksperslab() const { return (SLABSIZE - SLABHEADER) / blocksize; }
+
+    void grow()
+    {
+        uchar *slab = new uchar[SLABSIZE];
+        *(uchar **)slab = slabs;
+        slabs = slab;
+        numslabs++;
+        // link in reverse, so consecutive allocations are next to each other
+        uchar *blocks = slab + SLABHEADER;
+        for(int i = blocksperslab()-1; i >= 0; i--)
+        {
+            *(void **)&blocks[i*blocksize] = freeblocks;
+            freeblocks = &blocks[i*blocksize];
+        }
+    }
+
+    /// @param counter additionally counted up while holding the lock
+    void *alloc(int *counter = NULL)
+    {
+        SDL_AtomicLock(&lock);
+        if(!freeblocks) grow();
+        void *b = freeblocks;
+        freeblocks = *(void **)b;
+        numused++;
+        if(counter) (*counter)++;
+        SDL_AtomicUnlock(&lock);
+        return b;
+    }
+
+    void free(void *b, int *counter = NULL)
+    {
+        SDL_AtomicLock(&lock);
+        *(void **)b = freeblocks;
+        freeblocks = b;
+        numused--;
+        if(counter) (*counter)--;
+        SDL_AtomicUnlock(&lock);
+    }
+};
+
+#define CUBEEXTSIZE(maxverts) ((sizeof(cubeext) + (maxverts)*sizeof(vertinfo) + 7)&~7)
+
+/// the cubeext pools, by the number of verts they have room for (cubeexts are grown to the next bigger class).
+static const uchar cubeextclasses[] = { 0, 4, 8, 12, 16, 24, 32, 48, 64, 96, 128, 192, 255 };
+static const int numcubeextclasses = sizeof(cubeextclasses)/sizeof(cubeextclasses[0]);
+
+static octapool cubepool = { 8*sizeof(cube), NULL, NULL, 0, 0, 0 };
+static octapool cubeextpools[numcubeextclasses] =
+{
+#define EXTPOOL(n) { int(CUBEEXTSIZE(n)), NULL, NULL, 0, 0, 0 }
+    EXTPOOL(0), EXTPOOL(4), EXTPOOL(8), EXTPOOL(12), EXTPOOL(16), EXTPOOL(24), EXTPOOL(32),
+    EXTPOOL(48), EXTPOOL(64), EXTPOOL(96), EXTPOOL(128), EXTPOOL(192), EXTPOOL(255)
+#undef EXTPOOL
+};
+
+static inline int cubeextclass(int maxverts)
+{
+    int i = 0;
+    while(cubeextclasses[i] < maxverts) i++;
+    return i;
+}
+
+static inline void freecubeextmem(cubeext *ext)
+{
+    cubeextpools[cubeextclass(ext->maxverts)].free(ext);
+}
+
+/// prints how much memory the octree pools use and how much of it is unused
+void octapoolstats()
+{
+    int total = 0, used = 0;
+    loopi(numcubeextclasses+1)
+    {
+        octapool &p = i ? cubeextpools[i-1] : cubepool;
+        if(!p.numslabs) continue;
+        int blocks = p.numslabs*p.blocksperslab();
+        if(i) conoutf("cubeext (%d verts): %d/%d used, %d slabs, %.1f%% free", cubeextclasses[i-1], p.numused, blocks, p.numslabs, 100.0f*(blocks - p.numused)/blocks);
+        else conoutf("cube families: %d/%d used, %d slabs, %.1f%% free", p.numused, blocks, p.numslabs, 100.0f*(blocks - p.numused)/blocks);
+        total += p.numslabs*octapool::SLABSIZE;
+        used += p.numused*p.blocksize;
+    }
+    if(total) conoutf("octree pools: %d KB used of %d KB (%.1f%% fragmented)", used>>10, total>>10, 100.0f*(total - used)/total);
+}
+COMMAND(octapoolstats, "");
+
 int allocnodes = 0;
+cube *worldroot = newcubes(F_SOLID);
 
 cubeext *growcubeext(cubeext *old, int maxverts)
 {
-    cubeext *ext = (cubeext *)new uchar[sizeof(cubeext) + maxverts*sizeof(vertinfo)];
+    int extclass = cubeextclass(maxverts);
+    cubeext *ext = (cubeext *)cubeextpools[extclass].alloc();
     if(old)
     {
         ext->va = old->va;
@@ -20,7 +121,7 @@ cubeext *growcubeext(cubeext *old, int maxverts)
         ext->ents = NULL;
         ext->tjoints = -1;
     }
-    ext->maxverts = maxverts;
+    ext->maxverts = cubeextclasses[extclass];
     return ext;
 }
 
@@ -29,7 +130,7 @@ void setcubeext(cube &c, cubeext *ext)
     cubeext *old = c.ext;
     if(old == ext) return;
     c.ext = ext;
-    if(old) delete[] (uchar *)old;
+    if(old) freecubeextmem(old);
 }
   
 cubeext *newcubeext(cube &c, int maxverts, bool init)
@@ -51,7 +152,7 @@ cubeext *newcubeext(cube &c, int maxverts, bool init)
 
 cube *newcubes(uint face, int mat)
 {
-    cube *c = new cube[8];
+    cube *c = (cube *)cubepool.alloc(&allocnodes);
     loopi(8)
     {
         c->children = NULL;
@@ -63,7 +164,6 @@ cube *newcubes(uint face, int mat)
         c->material = mat;
         c++;
     }
-    allocnodes++;
     return c-8;
 }
 
@@ -78,15 +178,14 @@ void freeocta(cube *c)
 {
     if(!c) return;
     loopi(8) discardchildren(c[i]);
-    delete[] c;
-    allocnodes--;
+    cubepool.free(c, &allocnodes);
 }
 
 void freecubeext(cube &c)
 {
     if(c.ext)
     {
-        delete[] (uchar *)c.ext;
+        freecubeextmem(c.ext);
         c.ext = NULL;
     }
 }
@@ -117,8 +216,8 @@ void discardchildren(cube &c, bool fixtex, int depth)
             loopi(6) c.texture[i] = getmippedtexture(c, i);
             if(depth > 0 && filled != F_EMPTY) c.faces[0] = F_SOLID;
         }
-        DELETEA(c.children);
-        allocnodes--;
+        cubepool.free(c.children, &allocnodes);
+        c.children = NULL;
     }
 }
 
@@ -262,8 +361,8 @@ int lookupmaterial(const vec &v)
     return c->material;
 }
 
-const cube *neighbourstack[32];
-int neighbourdepth = -1;
+thread_local const cube *neighbourstack[32];
+thread_local int neighbourdepth = -1;
 
 const cube &neighbourcube(const cube &c, int orient, const ivec &co, int size, ivec &ro, int &rsize)
 {
@@ -1595,7 +1694,9 @@ struct plink : pedge
     void clear() { polys[0] = polys[1] = -1; }
 };
 
-bool mergepolys(int orient, hashset<plink> &links, vector<plink *> &queue, int owner, poly &p, poly &q, const pedge &e)
+typedef smallvector<plink *, 32> plinkqueue;
+
+bool mergepolys(int orient, hashset<plink> &links, plinkqueue &queue, int owner, poly &p, poly &q, const pedge &e)
 {
     int pe = -1, qe = -1;
     loopi(p.numverts) if(p.verts[i] == e.from) { pe = i; break; }
@@ -1728,7 +1829,7 @@ void mergepolys(int orient, const ivec &co, const ivec &n, int offset, vector<po
 {
     if(polys.length() <= 1) { addmerges(orient, co, n, offset, polys); return; }
     hashset<plink> links(polys.length() <= 32 ? 128 : 1024);
-    vector<plink *> queue;
+    plinkqueue queue;
     loopv(polys)
     {
         poly &p = polys[i];
@@ -1744,7 +1845,7 @@ void mergepolys(int orient, const ivec &co, const ivec &n, int offset, vector<po
             prev = j;
         }
     }
-    vector<plink *> nextqueue;
+    plinkqueue nextqueue;
     while(queue.length())
     {
         loopv(queue)
@@ -229,17 +229,19 @@ struct editinfo
 };
 
 struct undoent   { int i; entity e; };
-struct undoblock // undo header, all data sits in payload
+enum { UNDO_RAW = 0, UNDO_COMPRESSED = 1<<0, UNDO_SPILLED = 1<<1 };
+
+struct undoblock // undo header, entity data sits in payload
 {
     undoblock *prev, *next;
     int size, timestamp, numents; // if numents is 0, is a cube undo record, otherwise an entity undo record
+    // cube records keep the selection in the payload and its cubes packed (see packblock) in data,
+    // which gets compressed in the background and may be spilled to disk at offset
+    int state, numcubes, rawlen, datalen;
+    uchar *data;
+    stream::offset offset;
 
     block3 *block() { return (block3 *)(this + 1); }
-    uchar *gridmap()
-    {
-        block3 *ub = block();
-        return (uchar *)(ub->c() + ub->size());
-    }
     undoent *ents() { return (undoent *)(this + 1); }
 };
 
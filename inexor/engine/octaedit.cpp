@@ -406,6 +406,8 @@ VAR(gridlookup, 0, 0, 1);
 /// ignore the first cube when view ray intersects it and select the second ("select through cubes")
 VAR(passthroughcube, 0, 1, 1);
 
+static void renderprefabpreview();
+
 /// render selection box to the cursor target
 /// also moves entities!
 void rendereditcursor()
@@ -593,6 +595,7 @@ void rendereditcursor()
         else
             gle::colorub(0,0,120);
         boxs3D(vec(sel.o), vec(sel.s), sel.grid);
+        renderprefabpreview();
     }
 
     disablepolygonoffset(GL_POLYGON_OFFSET_LINE);
@@ -615,6 +618,35 @@ void tryedit()
 
 static bool haschanged = false;
 
+/// milliseconds per frame spent on rebuilding the vertex arrays of edited areas, 0 rebuilds them right away.
+VARP(editbudget, 0, 4, 100);
+
+struct editregion
+{
+    ivec bbmin, bbmax;
+};
+
+/// areas whose vertex arrays still need to be rebuilt by updatechanges()
+static vector<editregion> editregions;
+
+static void addeditregion(const ivec &bbmin, const ivec &bbmax)
+{
+    loopv(editregions)
+    {
+        editregion &r = editregions[i];
+        if(bbmin.x <= r.bbmax.x && bbmin.y <= r.bbmax.y && bbmin.z <= r.bbmax.z &&
+           bbmax.x >= r.bbmin.x && bbmax.y >= r.bbmin.y && bbmax.z >= r.bbmin.z)
+        {
+            r.bbmin.min(bbmin);
+            r.bbmax.max(bbmax);
+            return;
+        }
+    }
+    editregion &r = editregions.add();
+    r.bbmin = bbmin;
+    r.bbmax = bbmax;
+}
+
 /// checks and validates changes in the octree system
 void readychanges(const ivec &bbmin, const ivec &bbmax, cube *c, const ivec &cor, int size)
 {
@@ -628,7 +660,11 @@ void readychanges(const ivec &bbmin, const ivec &bbmax, cube *c, const ivec &cor
                 int hasmerges = c[i].ext->va->hasmerges;
                 destroyva(c[i].ext->va);
                 c[i].ext->va = NULL;
-                if(hasmerges) invalidatemerges(c[i], o, size, true);
+                if(hasmerges)
+                {
+                    invalidatemerges(c[i], o, size, true);
+                    addeditregion(o, ivec(o).add(size));
+                }
             }
             freeoctaentities(c[i]);
             c[i].ext->tjoints = -1;
@@ -650,8 +686,9 @@ void readychanges(const ivec &bbmin, const ivec &bbmax, cube *c, const ivec &cor
 /// commits changes in geometry
 void commitchanges(bool force)
 {
-    if(!force && !haschanged) return;
+    if(!force && (!haschanged || editbudget)) return;
     haschanged = false;
+    editregions.setsize(0);
 
     extern vector<vtxarray *> valist;
     int oldlen = valist.length();
@@ -666,13 +703,61 @@ void commitchanges(bool force)
     resetblobs();
 }
 
+/// rebuilds the vertex arrays of the edited areas nearest to the camera, until editbudget milliseconds are used up.
+/// what is left is done in the next frames, so large edits don't stall the game.
+void updatechanges()
+{
+    if(!haschanged) return;
+    if(!editbudget) { commitchanges(); return; }
+
+    benchclock::time_point deadline = benchclock::now() + std::chrono::milliseconds(int(editbudget));
+    extern vector<vtxarray *> valist;
+    int oldlen = valist.length();
+    resetclipplanes();
+    entitiesinoctanodes();
+    inbetweenframes = false;
+    for(;;)
+    {
+        int best = -1;
+        float bestdist = 1e16f;
+        loopv(editregions)
+        {
+            const editregion &r = editregions[i];
+            vec closest = camera1->o;
+            closest.max(vec(r.bbmin)).min(vec(r.bbmax));
+            float dist = closest.squaredist(camera1->o);
+            if(dist < bestdist)
+            {
+                best = i;
+                bestdist = dist;
+            }
+        }
+        // once all edited areas are done, a last pass picks up any vertex arrays discarded elsewhere
+        if(best < 0)
+        {
+            if(octarenderregion(ivec(0, 0, 0), ivec(worldsize, worldsize, worldsize), deadline)) haschanged = false;
+            break;
+        }
+        if(!octarenderregion(editregions[best].bbmin, editregions[best].bbmax, deadline)) break;
+        editregions.remove(best);
+    }
+    inbetweenframes = true;
+    setupmaterials(oldlen);
+    invalidatepostfx();
+    updatevabbs();
+    resetblobs();
+}
+
 /// validates editing changes using readychanges() and calls commitchanges()
 /// @see readychanges
 /// @see commitchanges
 void changed(const block3 &sel, bool commit = true)
 {
     if(sel.s.iszero()) return;
-    readychanges(ivec(sel.o).sub(1), ivec(sel.s).mul(sel.grid).add(sel.o).add(1), worldroot, ivec(0, 0, 0), worldsize/2);
+    ivec bbmin = ivec(sel.o).sub(1), bbmax = ivec(sel.s).mul(sel.grid).add(sel.o).add(1);
+    readychanges(bbmin, bbmax, worldroot, ivec(0, 0, 0), worldsize/2);
+    addeditregion(bbmin, bbmax);
+    invalidatepvs(bbmin, bbmax);
     haschanged = true;
 
     if(commit) commitchanges();
@@ -727,9 +812,224 @@ void selgridmap(selinfo &sel, uchar *g)                           // generates a
     loopxyz(sel, -sel.grid, (*g++ = bitscan(lusize), (void)c));
 }
 
+template<class B> static void packcube(cube &c, B &buf);
+template<class B> static bool unpackblock(block3 *&b, B &buf, int maxgrid = 1<<12);
+
+/// cube undo records are packed when made and then compressed by a background thread.
+/// once they use more than undomegs, the oldest ones are spilled into a temp file (up to undodiskmegs) before being dropped.
+/// the space of dropped spilled records is reused for later ones.
+static SDL_Thread *undothread = NULL;
+static SDL_mutex *undomutex = NULL;
+static SDL_cond *undocond = NULL;
+static vector<undoblock *> undoqueue;
+static undoblock *compressingundo = NULL;
+static int undosaved = 0;
+static stream *undofile = NULL;
+static int spilledundos = 0;
+
+/// a free range of the temp file left behind by a dropped spilled record.
+struct undoextent { stream::offset offset, len; };
+static vector<undoextent> undoextents; ///< sorted by offset, never touching each other or the end of the file
+static stream::offset undofileend = 0;
+
+static int undocompressor(void *)
+{
+    SDL_LockMutex(undomutex);
+    for(;;)
+    {
+        while(undoqueue.empty()) SDL_CondWait(undocond, undomutex);
+        undoblock *u = compressingundo = undoqueue.remove(0);
+        SDL_UnlockMutex(undomutex);
+
+        uLongf len = compressBound(u->rawlen);
+        uchar *packed = new uchar[len];
+        if(compress2((Bytef *)packed, &len, (const Bytef *)u->data, u->rawlen, Z_DEFAULT_COMPRESSION) != Z_OK || int(len) >= u->rawlen)
+        {
+            delete[] packed;
+            packed = NULL;
+        }
+
+        SDL_LockMutex(undomutex);
+        if(packed)
+        {
+            delete[] u->data;
+            u->data = packed;
+            u->datalen = len;
+            u->state = UNDO_COMPRESSED;
+            undosaved += u->size - int(len);
+            u->size = len;
+        }
+        compressingundo = NULL;
+        SDL_CondBroadcast(undocond);
+    }
+    return 0;
+}
+
+/// hands a new cube undo record over to the compressor thread.
+static void queueundo(undoblock *u)
+{
+    if(u->numents || u->state != UNDO_RAW) return;
+    if(!undomutex)
+    {
+        undomutex = SDL_CreateMutex();
+        undocond = SDL_CreateCond();
+    }
+    if(!undothread && !(undothread = SDL_CreateThread(undocompressor, "undo compressor", NULL))) return;
+    SDL_LockMutex(undomutex);
+    undoqueue.add(u);
+    SDL_CondBroadcast(undocond);
+    SDL_UnlockMutex(undomutex);
+}
+
+/// takes a record back from the compressor thread, so its data may be used or changed.
+static void claimundo(undoblock *u)
+{
+    if(u->numents || !undomutex) return;
+    SDL_LockMutex(undomutex);
+    while(compressingundo == u) SDL_CondWait(undocond, undomutex);
+    undoqueue.removeobj(u);
+    SDL_UnlockMutex(undomutex);
+}
+
+/// gets the sizes of records the compressor shrunk into totalundos.
+static int syncundos(int total)
+{
+    if(!undomutex) return total;
+    SDL_LockMutex(undomutex);
+    total -= undosaved;
+    undosaved = 0;
+    SDL_UnlockMutex(undomutex);
+    return total;
+}
+
+VARP(undodiskmegs, 0, 0, 4096);                         // spill old undos up to n megs to disk instead of dropping them
+
+/// finds the first free range of the temp file fitting len bytes within the budget, or -1 to append them.
+static int findundoextent(int len)
+{
+    stream::offset budget = stream::offset(undodiskmegs)<<20;
+    loopv(undoextents) if(undoextents[i].len >= len && undoextents[i].offset + len <= budget) return i;
+    return -1;
+}
+
+/// whether len bytes still fit into the temp file.
+static bool hasundoroom(int len)
+{
+    return findundoextent(len) >= 0 || undofileend + len <= stream::offset(undodiskmegs)<<20;
+}
+
+/// finds len bytes in the temp file: the first free range fitting them, else behind its end. returns -1 if over budget.
+static stream::offset allocundoextent(int len)
+{
+    int i = findundoextent(len);
+    if(i >= 0)
+    {
+        undoextent &e = undoextents[i];
+        stream::offset offset = e.offset;
+        e.offset += len;
+        e.len -= len;
+        if(!e.len) undoextents.remove(i);
+        return offset;
+    }
+    if(undofileend + len > stream::offset(undodiskmegs)<<20) return -1;
+    stream::offset offset = undofileend;
+    undofileend += len;
+    return offset;
+}
+
+/// gives a range of the temp file back, merging it with its free neighbours.
+static void freeundoextent(stream::offset offset, int len)
+{
+    int i = 0;
+    while(i < undoextents.length() && undoextents[i].offset < offset) i++;
+    if(i > 0 && undoextents[i-1].offset + undoextents[i-1].len == offset) undoextents[--i].len += len;
+    else
+    {
+        undoextent e = { offset, len };
+        undoextents.insert(i, e);
+    }
+    if(i+1 < undoextents.length() && undoextents[i].offset + undoextents[i].len == undoextents[i+1].offset)
+    {
+        undoextents[i].len += undoextents[i+1].len;
+        undoextents.remove(i+1);
+    }
+    if(undoextents[i].offset + undoextents[i].len == undofileend)
+    {
+        undofileend = undoextents[i].offset;
+        undoextents.remove(i);
+    }
+}
+
+/// moves the data of a claimed record into the temp file, returns false if it has to be dropped instead.
+static bool spillundo(undoblock *u)
+{
+    if(u->numents || u->state&UNDO_SPILLED) return false;
+    if(!undofile && !(undofile = opentempfile("undo.tmp", "w+b"))) return false;
+    stream::offset offset = allocundoextent(u->datalen);
+    if(offset < 0) return false;
+    if(!undofile->seek(offset, SEEK_SET) || !undofile->write(u->data, u->datalen)) { freeundoextent(offset, u->datalen); return false; }
+    delete[] u->data;
+    u->data = NULL;
+    u->offset = offset;
+    u->state = u->datalen < u->rawlen ? UNDO_COMPRESSED|UNDO_SPILLED : UNDO_SPILLED;
+    spilledundos++;
+    return true;
+}
+
+/// releases the space of a spilled record in the temp file.
+static void unspillundo(undoblock *u)
+{
+    if(!(u->state&UNDO_SPILLED)) return;
+    u->state &= ~UNDO_SPILLED;
+    if(--spilledundos) freeundoextent(u->offset, u->datalen);
+    else
+    {
+        undoextents.setsize(0);
+        undofileend = 0;
+    }
+}
+
+/// gets the packed cubes of a claimed record.
+static bool getundodata(undoblock *u, vector<uchar> &buf)
+{
+    uchar *data = u->data;
+    vector<uchar> spilled;
+    if(u->state&UNDO_SPILLED)
+    {
+        if(!undofile || !undofile->seek(u->offset, SEEK_SET)) return false;
+        data = spilled.reserve(u->datalen).buf;
+        if(int(undofile->read(data, u->datalen)) != u->datalen) return false;
+    }
+    if(u->state&UNDO_COMPRESSED)
+    {
+        uLongf len = u->rawlen;
+        if(uncompress((Bytef *)buf.reserve(u->rawlen).buf, &len, (const Bytef *)data, u->datalen) != Z_OK || int(len) != u->rawlen) return false;
+        buf.advance(u->rawlen);
+    }
+    else buf.put(data, u->rawlen);
+    return true;
+}
+
+/// unpacks the cubes and grid map of a claimed record, buf keeps the grid map.
+static block3 *unpackundocubes(undoblock *u, vector<uchar> &buf, uchar *&g)
+{
+    if(!getundodata(u, buf)) return NULL;
+    ucharbuf p(buf.getbuf(), buf.length());
+    block3 *b = NULL;
+    if(!unpackblock(b, p, worldsize)) return NULL;
+    if(p.remaining() < b->size()) { freeblock(b); return NULL; }
+    g = p.pad(b->size());
+    return b;
+}
+
 void freeundo(undoblock *u)
 {
-    if(!u->numents) freeblock(u->block(), false);
+    if(!u->numents)
+    {
+        claimundo(u);
+        delete[] u->data;
+        unspillundo(u);
+    }
     delete[] (uchar *)u;
 }
 
@@ -742,20 +1042,22 @@ void pasteundoblock(block3 *b, uchar *g)
 void pasteundo(undoblock *u)
 {
     if(u->numents) pasteundoents(u);
-    else pasteundoblock(u->block(), u->gridmap());
+    else
+    {
+        claimundo(u);
+        vector<uchar> buf;
+        uchar *g = NULL;
+        block3 *b = unpackundocubes(u, buf, g);
+        if(!b) { conoutf(CON_ERROR, "could not restore undo"); return; }
+        pasteundoblock(b, g);
+        freeblock(b);
+    }
 }
 
 static inline int undosize(undoblock *u)
 {
     if(u->numents) return u->numents*sizeof(undoent);
-    else
-    {
-        block3 *b = u->block();
-        cube *q = b->c();
-        int size = b->size(), total = size;
-        loopj(size) total += familysize(*q++)*sizeof(cube);
-        return total;
-    }
+    else return u->state&UNDO_SPILLED ? 0 : u->datalen;
 }
 
 struct undolist
@@ -803,9 +1105,24 @@ int totalundos = 0;
 
 void pruneundos(int maxremain)                          // bound memory
 {
-    while(totalundos > maxremain && !undos.empty())
+    totalundos = syncundos(totalundos);
+    if(maxremain && undodiskmegs) for(undoblock *u = undos.first; u && totalundos > maxremain; u = u->next)
+    {
+        if(u->numents) continue;
+        claimundo(u);
+        if(u->state&UNDO_SPILLED) continue;
+        // a full temp file makes room by dropping the oldest spilled records, which frees no memory
+        if(u->datalen <= stream::offset(undodiskmegs)<<20)
+            while(!hasundoroom(u->datalen) && undos.first != u && !undos.first->numents && undos.first->state&UNDO_SPILLED)
+                freeundo(undos.popfirst());
+        if(!spillundo(u)) { queueundo(u); break; }
+        totalundos -= u->size;
+        u->size = 0;
+    }
+    while((totalundos > maxremain || !maxremain) && !undos.empty())
     {
         undoblock *u = undos.popfirst();
+        claimundo(u);
         totalundos -= u->size;
         freeundo(u);
     }
@@ -813,6 +1130,7 @@ void pruneundos(int maxremain)                          // bound memory
     while(!redos.empty())
     {
         undoblock *u = redos.popfirst();
+        claimundo(u);
         totalundos -= u->size;
         freeundo(u);
     }
@@ -825,15 +1143,27 @@ COMMAND(clearundos, "");
 undoblock *newundocube(selinfo &s)
 {
     int ssize = s.size(),
-        selgridsize = ssize,
         blocksize = sizeof(block3)+ssize*sizeof(cube);
-    if(blocksize <= 0 || blocksize > (undomegs<<20)) return NULL;
-    undoblock *u = (undoblock *)new uchar[sizeof(undoblock) + blocksize + selgridsize];
+    if(blocksize <= 0 || blocksize > (undomegs<<20) || ssize > (1<<20)) return NULL;
+    undoblock *u = (undoblock *)new uchar[sizeof(undoblock) + sizeof(block3)];
     u->numents = 0;
-    block3 *b = (block3 *)(u + 1);
-    blockcopy(s, -s.grid, b);
-    uchar *g = u->gridmap();
-    selgridmap(s, g);
+    u->state = UNDO_RAW;
+    u->numcubes = 0;
+    *u->block() = s;
+    vector<uchar> buf, g;
+    buf.reserve(sizeof(block3) + 32*ssize);
+    g.reserve(ssize);
+    block3 hdr = s;
+    lilswap(hdr.o.v, 3);
+    lilswap(hdr.s.v, 3);
+    lilswap(&hdr.grid, 1);
+    lilswap(&hdr.orient, 1);
+    buf.put((const uchar *)&hdr, sizeof(hdr));
+    loopxyz(s, -s.grid, { packcube(c, buf); g.add(bitscan(lusize)); u->numcubes += familysize(c); });
+    buf.put(g.getbuf(), g.length());
+    u->rawlen = u->datalen = buf.length();
+    u->data = new uchar[u->rawlen];
+    memcpy(u->data, buf.getbuf(), u->rawlen);
     return u;
 }
 
@@ -843,6 +1173,7 @@ void addundo(undoblock *u)
     u->timestamp = totalmillis;
     undos.add(u);
     totalundos += u->size;
+    queueundo(u);
     pruneundos(undomegs<<20);
 }
 
@@ -861,15 +1192,6 @@ void makeundo()                        // stores state of selected cubes before
     makeundo(sel);
 }
 
-static inline int countblock(cube *c, int n = 8)
-{
-    int r = n;
-    loopi(n) if(c[i].children) r += countblock(c[i].children);
-    return r;
-}
-
-static int countblock(block3 *b) { return countblock(b->c(), b->size()); }
-
 void swapundo(undolist &a, undolist &b, int op)
 {
     if(noedit()) return;
@@ -881,7 +1203,7 @@ void swapundo(undolist &a, undolist &b, int op)
         for(undoblock *u = a.last; u && ts==u->timestamp; u = u->prev)
         {
             ++ops;
-            n += u->numents ? u->numents : countblock(u->block());
+            n += u->numents ? u->numents : u->numcubes;
             if(ops > 10 || n > 500)
             {
                 if(nompedit) { multiplayer(); return; }
@@ -907,12 +1229,15 @@ void swapundo(undolist &a, undolist &b, int op)
         }
         if(r)
         {
-            r->size = u->size;
+            r->size = undosize(r);
             r->timestamp = totalmillis;
             b.add(r);
+            totalundos += r->size;
+            queueundo(r);
         }
         pasteundo(u);
         if(!u->numents) changed(*u->block(), false);
+        totalundos -= u->size;
         freeundo(u);
     }
     commitchanges();
@@ -1029,7 +1354,7 @@ static void unpackcube(cube &c, B &buf)
 }
 
 template<class B>
-static bool unpackblock(block3 *&b, B &buf)
+static bool unpackblock(block3 *&b, B &buf, int maxgrid)
 {
     if(b) { freeblock(b); b = NULL; }
     block3 hdr;
@@ -1038,7 +1363,7 @@ static bool unpackblock(block3 *&b, B &buf)
     lilswap(hdr.s.v, 3);
     lilswap(&hdr.grid, 1);
     lilswap(&hdr.orient, 1);
-    if(hdr.size() > (1<<20) || hdr.grid <= 0 || hdr.grid > (1<<12)) return false;
+    if(hdr.size() > (1<<20) || hdr.grid <= 0 || hdr.grid > maxgrid) return false;
     b = (block3 *)new uchar[sizeof(block3)+hdr.size()*sizeof(cube)];
     *b = hdr;
     cube *c = b->c();
@@ -1091,59 +1416,111 @@ static void unpackvslots(block3 &b, ucharbuf &buf)
     unpackingvslots.setsize(0);
 }
 
-static bool compresseditinfo(const uchar *inbuf, int inlen, uchar *&outbuf, int &outlen)
+/// edit payloads travel in chunks: packed ones are deflated chunk by chunk while being sent,
+/// received ones get inflated as they come in. buf holds the uncompressed data of maxlen bytes,
+/// len counts the bytes inflated or deflated so far.
+struct editstream
 {
-    uLongf len = compressBound(inlen);
-    if(len > (1<<20)) return false;
-    outbuf = new uchar[len];
-    if(compress2((Bytef *)outbuf, &len, (const Bytef *)inbuf, inlen, Z_BEST_COMPRESSION) != Z_OK || len > (1<<16))
-    {
-        delete[] outbuf;
-        outbuf = NULL;
-        return false;
-    }
-    outlen = len;
-    return true;
-}
-
-static bool uncompresseditinfo(const uchar *inbuf, int inlen, uchar *&outbuf, int &outlen)
-{
-    if(compressBound(outlen) > (1<<20)) return false;
-    uLongf len = outlen;
-    outbuf = new uchar[len];
-    if(uncompress((Bytef *)outbuf, &len, (const Bytef *)inbuf, inlen) != Z_OK)
-    {
-        delete[] outbuf;
-        outbuf = NULL;
-        return false;
-    }
-    outlen = len;
-    return true;
-}
+    z_stream zs;
+    uchar *buf;
+    int len, maxlen;
+    bool packing, ended;
+};
 
-bool packeditinfo(editinfo *e, int &inlen, uchar *&outbuf, int &outlen)
+editstream *openeditstream(int unpacklen)
+{
+    if(unpacklen <= 0 || unpacklen > (1<<24)) return NULL;
+    editstream *s = new editstream;
+    memset(&s->zs, 0, sizeof(s->zs));
+    if(inflateInit(&s->zs) != Z_OK) { delete s; return NULL; }
+    s->buf = new uchar[unpacklen];
+    s->len = 0;
+    s->maxlen = unpacklen;
+    s->packing = s->ended = false;
+    s->zs.next_out = (Bytef *)s->buf;
+    s->zs.avail_out = unpacklen;
+    return s;
+}
+
+/// copies the packed edit in buf for deflating it by geteditstream().
+static editstream *openpackstream(const vector<uchar> &buf)
+{
+    if(buf.empty() || buf.length() > (1<<24)) return NULL;
+    editstream *s = new editstream;
+    memset(&s->zs, 0, sizeof(s->zs));
+    if(deflateInit(&s->zs, Z_DEFAULT_COMPRESSION) != Z_OK) { delete s; return NULL; }
+    s->maxlen = buf.length();
+    s->buf = new uchar[s->maxlen];
+    memcpy(s->buf, buf.getbuf(), s->maxlen);
+    s->len = 0;
+    s->packing = true;
+    s->ended = false;
+    s->zs.next_in = (Bytef *)s->buf;
+    s->zs.avail_in = s->maxlen;
+    return s;
+}
+
+/// deflates the next chunk of at most maxlen bytes into out, only as much input as is needed to fill it.
+/// returns its length or -1 on failure, ended is set with the last chunk.
+int geteditstream(editstream *s, uchar *out, int maxlen, bool &ended)
+{
+    ended = true;
+    if(!s || !s->packing || maxlen <= 0) return -1;
+    if(s->ended) return 0;
+    s->zs.next_out = (Bytef *)out;
+    s->zs.avail_out = maxlen;
+    int err = deflate(&s->zs, Z_FINISH);
+    if(err != Z_OK && err != Z_STREAM_END) return -1;
+    int len = maxlen - s->zs.avail_out;
+    s->len += len;
+    if(s->len > (1<<22)) return -1;
+    s->ended = ended = err == Z_STREAM_END;
+    return len;
+}
+
+/// the uncompressed size of an edit stream.
+int editstreamsize(editstream *s) { return s ? s->maxlen : 0; }
+
+/// how much of a packed edit stream got deflated, from 0 to 1.
+float editstreamprogress(editstream *s) { return s && s->maxlen ? float(s->zs.total_in)/s->maxlen : 1; }
+
+bool puteditstream(editstream *s, const uchar *buf, int len)
+{
+    if(!s || s->packing) return false;
+    if(len <= 0) return true;
+    s->zs.next_in = (Bytef *)buf;
+    s->zs.avail_in = len;
+    int err = inflate(&s->zs, Z_NO_FLUSH);
+    s->len = s->maxlen - s->zs.avail_out;
+    return (err == Z_OK || err == Z_STREAM_END) && !s->zs.avail_in;
+}
+
+void closeeditstream(editstream *&s)
+{
+    if(!s) return;
+    if(s->packing) deflateEnd(&s->zs);
+    else inflateEnd(&s->zs);
+    delete[] s->buf;
+    delete s;
+    s = NULL;
+}
+
+editstream *packeditinfo(editinfo *e)
 {
     vector<uchar> buf;
-    if(!e || !e->copy || !packblock(*e->copy, buf)) return false;
+    if(!e || !e->copy || !packblock(*e->copy, buf)) return NULL;
     packvslots(*e->copy, buf);
-    inlen = buf.length();
-    return compresseditinfo(buf.getbuf(), buf.length(), outbuf, outlen);
+    return openpackstream(buf);
 }
 
-bool unpackeditinfo(editinfo *&e, const uchar *inbuf, int inlen, int outlen)
+bool unpackeditinfo(editinfo *&e, editstream *s)
 {
     if(e && e->copy) { freeblock(e->copy); e->copy = NULL; }
-    uchar *outbuf = NULL;
-    if(!uncompresseditinfo(inbuf, inlen, outbuf, outlen)) return false;
-    ucharbuf buf(outbuf, outlen);
+    if(!s || s->packing || !s->len) return false;
+    ucharbuf buf(s->buf, s->len);
     if(!e) e = editinfos.add(new editinfo);
-    if(!unpackblock(e->copy, buf))
-    {
-        delete[] outbuf;
-        return false;
-    }
+    if(!unpackblock(e->copy, buf)) return false;
     unpackvslots(*e->copy, buf);
-    delete[] outbuf;
     return true;
 }
 
@@ -1156,7 +1533,7 @@ void freeeditinfo(editinfo *&e)
     e = NULL;
 }
 
-bool packundo(undoblock *u, int &inlen, uchar *&outbuf, int &outlen)
+editstream *packundo(undoblock *u)
 {
     vector<uchar> buf;
     buf.reserve(512);
@@ -1175,29 +1552,28 @@ bool packundo(undoblock *u, int &inlen, uchar *&outbuf, int &outlen)
     }
     else
     {
-        block3 &b = *u->block();
-        if(!packblock(b, buf)) return false;
-        buf.put(u->gridmap(), b.size());
-        packvslots(b, buf);
+        claimundo(u);
+        vector<uchar> cubes;
+        uchar *g = NULL;
+        block3 *b = unpackundocubes(u, cubes, g);
+        if(!b) return NULL;
+        buf.put(cubes.getbuf(), cubes.length());
+        packvslots(*b, buf);
+        freeblock(b);
+        queueundo(u);
     }
-    inlen = buf.length();
-    return compresseditinfo(buf.getbuf(), buf.length(), outbuf, outlen);
+    return openpackstream(buf);
 }
 
-bool unpackundo(const uchar *inbuf, int inlen, int outlen)
+bool unpackundo(editstream *s)
 {
-    uchar *outbuf = NULL;
-    if(!uncompresseditinfo(inbuf, inlen, outbuf, outlen)) return false;
-    ucharbuf buf(outbuf, outlen);
+    if(!s || s->packing || !s->len) return false;
+    ucharbuf buf(s->buf, s->len);
     if(buf.remaining() < 2) return false;
     int numents = lilswap(*(const ushort *)buf.pad(2));
     if(numents)
     {
-        if(buf.remaining() < numents*int(2 + sizeof(entity)))
-        {
-            delete[] outbuf;
-            return false;
-        }
+        if(buf.remaining() < numents*int(2 + sizeof(entity))) return false;
         loopi(numents)
         {
             int idx = lilswap(*(const ushort *)buf.pad(2));
@@ -1213,7 +1589,6 @@ bool unpackundo(const uchar *inbuf, int inlen, int outlen)
         if(!unpackblock(b, buf) || b->grid >= worldsize || buf.remaining() < b->size())
         {
             freeblock(b);
-            delete[] outbuf;
             return false;
         }
         uchar *g = buf.pad(b->size());
@@ -1222,33 +1597,35 @@ bool unpackundo(const uchar *inbuf, int inlen, int outlen)
         changed(*b, false);
         freeblock(b);
     }
-    delete[] outbuf;
     commitchanges();
     return true;
 }
 
-bool packundo(int op, int &inlen, uchar *&outbuf, int &outlen)
+editstream *packundo(int op)
 {
     switch(op)
     {
-        case EDIT_UNDO: return !undos.empty() && packundo(undos.last, inlen, outbuf, outlen);
-        case EDIT_REDO: return !redos.empty() && packundo(redos.last, inlen, outbuf, outlen);
-        default: return false;
+        case EDIT_UNDO: return !undos.empty() ? packundo(undos.last) : NULL;
+        case EDIT_REDO: return !redos.empty() ? packundo(redos.last) : NULL;
+        default: return NULL;
     }
 }
 
 SVARP(prefabdir, "media/prefab");
+/// version 0 prefabs are gzipped as a whole, version 1 prefabs store the packed cubes uncompressed after the header
 struct prefabheader
 {
     char magic[4];
     int version;
 };
 
+/// unpacked prefabs stay cached until their file changes
 struct prefab : editinfo
 {
     char *name;
+    long long filetime;
 
-    prefab() : name(NULL) {}
+    prefab() : name(NULL), filetime(0) {}
     ~prefab() { DELETEA(name); if(copy) freeblock(copy); }
 };
 
@@ -1261,6 +1638,12 @@ void delprefab(char *name)
 }
 COMMAND(delprefab, "s");
 
+static long long prefabtime(const char *filename)
+{
+    const char *found = findfile(filename, "rb");
+    return found ? getfiletime(found) : 0;
+}
+
 void saveprefab(char *name)
 {
     if(!name[0] || noedit(true) || (nompedit && multiplayer())) return;
@@ -1275,20 +1658,88 @@ void saveprefab(char *name)
     changed(sel);
     defformatstring(filename, "%s/%s.obr", *prefabdir, name);
     path(filename);
-    stream *f = opengzfile(filename, "wb");
-    if(!f) { conoutf(CON_ERROR, "could not write prefab to %s", filename); return; }
+    vector<uchar> buf;
     prefabheader hdr;
     memcpy(hdr.magic, "OEBR", 4);
-    hdr.version = 0;
+    hdr.version = 1;
     lilswap(&hdr.version, 1);
-    f->write(&hdr, sizeof(hdr));
-    streambuf<uchar> s(f);
-    if(!packblock(*b->copy, s)) { delete f; conoutf(CON_ERROR, "could not pack prefab %s", filename); return; }
+    buf.put((const uchar *)&hdr, sizeof(hdr));
+    if(!packblock(*b->copy, buf)) { conoutf(CON_ERROR, "could not pack prefab %s", filename); return; }
+    stream *f = openrawfile(filename, "wb");
+    if(!f) { conoutf(CON_ERROR, "could not write prefab to %s", filename); return; }
+    bool written = f->write(buf.getbuf(), buf.length()) == size_t(buf.length());
     delete f;
+    if(!written) { conoutf(CON_ERROR, "could not write prefab to %s", filename); return; }
+    b->filetime = prefabtime(filename);
     conoutf("wrote prefab file %s", filename);
 }
 COMMAND(saveprefab, "s");
 
+static block3 *readprefab(stream *f, const char *filename)
+{
+    prefabheader hdr;
+    if(f->read(&hdr, sizeof(hdr)) != sizeof(prefabheader) || memcmp(hdr.magic, "OEBR", 4)) { conoutf(CON_ERROR, "prefab %s has malformatted header", filename); return NULL; }
+    lilswap(&hdr.version, 1);
+    if(hdr.version != 0 && hdr.version != 1) { conoutf(CON_ERROR, "prefab %s uses unsupported version", filename); return NULL; }
+    block3 *copy = NULL;
+    bool unpacked;
+    if(hdr.version == 0)
+    {
+        streambuf<uchar> s(f);
+        unpacked = unpackblock(copy, s);
+    }
+    else
+    {
+        stream::offset len = f->size() - f->tell();
+        vector<uchar> buf;
+        unpacked = len > 0 && len <= (1<<26) && f->read(buf.pad(int(len)), int(len)) == size_t(len);
+        if(unpacked)
+        {
+            ucharbuf s(buf.getbuf(), buf.length());
+            unpacked = unpackblock(copy, s);
+        }
+    }
+    if(!unpacked) { conoutf(CON_ERROR, "could not unpack prefab %s", filename); return NULL; }
+    return copy;
+}
+
+static block3 *loadprefab(const char *filename)
+{
+    stream *f = openfile(filename, "rb");
+    if(!f) { conoutf(CON_ERROR, "could not read prefab %s", filename); return NULL; }
+    uchar magic[2];
+    bool gzipped = f->read(magic, 2) == 2 && magic[0] == 0x1F && magic[1] == 0x8B;
+    f->seek(0, SEEK_SET);
+    stream *gz = gzipped ? opengzfile(NULL, "rb", f) : NULL;
+    block3 *copy = NULL;
+    if(gzipped && !gz) conoutf(CON_ERROR, "could not read prefab %s", filename);
+    else copy = readprefab(gz ? gz : f, filename);
+    delete gz;
+    delete f;
+    return copy;
+}
+
+/// looks the prefab up in the cache and only reads its file if it is new or was changed since.
+static prefab *getprefab(const char *name)
+{
+    defformatstring(filename, "%s/%s.obr", *prefabdir, name);
+    path(filename);
+    long long filetime = prefabtime(filename);
+    prefab *b = prefabs.access(name);
+    if(b && b->copy && (b->filetime == filetime || !filetime)) return b;
+    block3 *copy = loadprefab(filename);
+    if(!copy) return b && b->copy ? b : NULL;
+    if(!b)
+    {
+        b = &prefabs[name];
+        b->name = newstring(name);
+    }
+    if(b->copy) freeblock(b->copy);
+    b->copy = copy;
+    b->filetime = filetime;
+    return b;
+}
+
 void pasteblock(block3 &b, selinfo &sel, bool local)
 {
     sel.s = b.s;
@@ -1302,28 +1753,38 @@ void pasteblock(block3 &b, selinfo &sel, bool local)
 void pasteprefab(char *name)
 {
     if(!name[0] || noedit() || (nompedit && multiplayer())) return;
-    prefab *b = prefabs.access(name);
-    if(!b)
+    prefab *b = getprefab(name);
+    if(b) pasteblock(*b->copy, sel, true);
+}
+COMMAND(pasteprefab, "s");
+
+/// outlines where the cubes of a prefab would go at the selection, "" turns it off
+static string prefabpreview = "";
+ICOMMAND(previewprefab, "s", (char *name), { copystring(prefabpreview, name); if(name[0] && !getprefab(name)) prefabpreview[0] = '\0'; });
+
+VARP(prefabpreviewcubes, 0, 4096, 1<<16);
+
+static void renderprefabpreview()
+{
+    if(!prefabpreview[0]) return;
+    prefab *p = prefabs.access(prefabpreview);
+    if(!p || !p->copy) return;
+    block3 &b = *p->copy;
+    int dim = dimension(b.orient), dc = dimcoord(b.orient);
+    gle::colorub(120,0,120);
+    boxs3D(vec(sel.o), vec(b.s), sel.grid);
+    if(b.size() > prefabpreviewcubes) return;
+    cube *c = b.c();
+    loop(z, b.s[D[dim]]) loop(y, b.s[C[dim]]) loop(x, b.s[R[dim]])
     {
-        defformatstring(filename, "%s/%s.obr", *prefabdir, name);
-        path(filename);
-        stream *f = opengzfile(filename, "rb");
-        if(!f) { conoutf(CON_ERROR, "could not read prefab %s", filename); return; }
-        prefabheader hdr;
-        if(f->read(&hdr, sizeof(hdr)) != sizeof(prefabheader) || memcmp(hdr.magic, "OEBR", 4)) { delete f; conoutf(CON_ERROR, "prefab %s has malformatted header", filename); return; }
-        lilswap(&hdr.version, 1);
-        if(hdr.version != 0) { delete f; conoutf(CON_ERROR, "prefab %s uses unsupported version", filename); return; }
-        streambuf<uchar> s(f);
-        block3 *copy = NULL;
-        if(!unpackblock(copy, s)) { delete f; conoutf(CON_ERROR, "could not unpack prefab %s", filename); return; }
-        delete f;
-        b = &prefabs[name];
-        b->name = newstring(name);
-        b->copy = copy;
+        cube &s = *c++;
+        if(isempty(s) && !s.children && s.material == MAT_AIR) continue;
+        ivec o(dim, x*sel.grid, y*sel.grid, dc*(b.s[dim]-1)*sel.grid);
+        o.add(sel.o);
+        if(dc) o[dim] -= z*sel.grid; else o[dim] += z*sel.grid;
+        boxs3D(vec(o), vec(1), sel.grid);
     }
-    pasteblock(*b->copy, sel, true);
 }
-COMMAND(pasteprefab, "s");
 
 void mpcopy(editinfo *&e, selinfo &sel, bool local)
 {
@@ -1376,6 +1837,30 @@ struct vslotref
 };
 #define editingvslot(...) vslotref vslotrefs[] = { __VA_ARGS__ }; (void)vslotrefs;
 
+/// remaps the slots in the packed cubes of an undo record, which may need to be unspilled for it.
+static void compactundovslots(undoblock *u)
+{
+    claimundo(u);
+    vector<uchar> buf;
+    uchar *g = NULL;
+    block3 *b = unpackundocubes(u, buf, g);
+    if(!b) return;
+    compactvslots(b->c(), b->size());
+    vector<uchar> cubes;
+    packblock(*b, cubes);
+    cubes.put(g, b->size());
+    freeblock(b);
+    delete[] u->data;
+    unspillundo(u);
+    totalundos -= u->size;
+    u->state = UNDO_RAW;
+    u->size = u->rawlen = u->datalen = cubes.length();
+    u->data = new uchar[u->rawlen];
+    memcpy(u->data, cubes.getbuf(), u->rawlen);
+    totalundos += u->size;
+    queueundo(u);
+}
+
 void compacteditvslots()
 {
     loopv(editingvslots) if(*editingvslots[i]) compactvslot(*editingvslots[i]);
@@ -1387,10 +1872,11 @@ void compacteditvslots()
     }
     for(undoblock *u = undos.first; u; u = u->next)
         if(!u->numents)
-            compactvslots(u->block()->c(), u->block()->size());
+            compactundovslots(u);
     for(undoblock *u = redos.first; u; u = u->next)
         if(!u->numents)
-            compactvslots(u->block()->c(), u->block()->size());
+            compactundovslots(u);
+    totalundos = syncundos(totalundos);
 }
 
 ///////////// height maps ////////////////
@@ -202,11 +202,20 @@ static inline uint hthash(const sortkey &k)
     return k.tex + k.lmid*9741;
 }
 
+/// the vertex and index data of a va waiting to be put into vbos.
+struct vaupload
+{
+    vtxarray *va;
+    int worldtris, skytris;
+    vector<vertex> verts;
+    vector<ushort> skyindices, indices;
+};
+
 struct vacollect : verthash
 {
     ivec origin;
     int size;
-    hashtable<sortkey, sortval> indices;
+    openhashtable<sortkey, sortval> indices;
     vector<sortkey> texs;
     vector<grasstri> grasstris;
     vector<materialsurface> matsurfs;
@@ -394,8 +403,13 @@ struct vacollect : verthash
         GENVERTS(vertex, buf, { *f = v; f->norm.flip(); f->tangent.flip(); });
     }
 
-    void setupdata(vtxarray *va)
+    /// fills in the va and everything that goes into its vbos, which is put there later by uploadva() on the main thread.
+    void setupdata(vtxarray *va, vaupload &u)
     {
+        u.va = va;
+        u.worldtris = worldtris;
+        u.skytris = skytris;
+
         va->verts = verts.length();
         va->tris = worldtris/3;
         va->vbuf = 0;
@@ -403,19 +417,7 @@ struct vacollect : verthash
         va->minvert = 0;
         va->maxvert = va->verts-1;
         va->voffset = 0;
-        if(va->verts)
-        {
-            if(vbosize[VBO_VBUF] + verts.length() > maxvbosize || 
-               vbosize[VBO_EBUF] + worldtris > USHRT_MAX ||
-               vbosize[VBO_SKYBUF] + skytris > USHRT_MAX) 
-                flushvbo();
-
-            va->voffset = vbosize[VBO_VBUF];
-            uchar *vdata = addvbo(va, VBO_VBUF, va->verts, sizeof(vertex));
-            genverts(vdata);
-            va->minvert += va->voffset;
-            va->maxvert += va->voffset;
-        }
+        if(va->verts) genverts(u.verts.pad(va->verts));
 
         va->matbuf = NULL;
         va->matsurfs = matsurfs.length();
@@ -431,11 +433,8 @@ struct vacollect : verthash
         va->explicitsky = explicitskyindices.length();
         if(va->sky + va->explicitsky)
         {
-            va->skydata += vbosize[VBO_SKYBUF];
-            ushort *skydata = (ushort *)addvbo(va, VBO_SKYBUF, va->sky+va->explicitsky, sizeof(ushort));
-            memcpy(skydata, skyindices.getbuf(), va->sky*sizeof(ushort));
-            memcpy(skydata+va->sky, explicitskyindices.getbuf(), va->explicitsky*sizeof(ushort));
-            if(va->voffset) loopi(va->sky+va->explicitsky) skydata[i] += va->voffset; 
+            u.skyindices.put(skyindices.getbuf(), va->sky);
+            u.skyindices.put(explicitskyindices.getbuf(), va->explicitsky);
         }
 
         va->eslist = NULL;
@@ -451,8 +450,7 @@ struct vacollect : verthash
         if(va->texs)
         {
             va->eslist = new elementset[va->texs];
-            va->edata += vbosize[VBO_EBUF];
-            ushort *edata = (ushort *)addvbo(va, VBO_EBUF, worldtris, sizeof(ushort)), *curbuf = edata;
+            ushort *curbuf = u.indices.pad(worldtris);
             loopv(texs)
             {
                 const sortkey &k = texs[i];
@@ -475,7 +473,6 @@ struct vacollect : verthash
 
                         loopvj(t.tris[l])
                         {
-                            curbuf[j] += va->voffset;
                             e.minvert[l] = min(e.minvert[l], curbuf[j]);
                             e.maxvert[l] = max(e.maxvert[l], curbuf[j]);
                         }
@@ -498,11 +495,7 @@ struct vacollect : verthash
             if(slot.shader->type&SHADER_ENVMAP) va->texmask |= 1<<TEX_ENVMAP;
         }
 
-        if(grasstris.length())
-        {
-            va->grasstris.move(grasstris);
-            useshaderbyname("grass");
-        }
+        if(grasstris.length()) va->grasstris.move(grasstris);
 
         if(mapmodels.length()) va->mapmodels.put(mapmodels.getbuf(), mapmodels.length());
     }
@@ -511,14 +504,21 @@ struct vacollect : verthash
     {
         return verts.empty() && matsurfs.empty() && skyindices.empty() && explicitskyindices.empty() && grasstris.empty() && mapmodels.empty();
     }            
-} vc;
+} mainvc;
+
+/// the collector of the calling thread, worker threads building a subtree use their own.
+static thread_local vacollect *vc = &mainvc;
+
+struct vajob;
+/// the subtree the calling thread is building, vas built there are uploaded once all subtrees are done.
+static thread_local vajob *curvajob = NULL;
 
 int recalcprogress = 0;
-#define progress(s)     if((recalcprogress++&0xFFF)==0) renderprogress(recalcprogress/(float)allocnodes, s);
+#define progress(s)     if(!curvajob && (recalcprogress++&0xFFF)==0) renderprogress(recalcprogress/(float)allocnodes, s);
 
 vector<tjoint> tjoints;
 
-vec shadowmapmin, shadowmapmax;
+static thread_local vec shadowmapmin, shadowmapmax;
 
 int calcshadowmask(vec *pos, int numpos)
 {
@@ -585,11 +585,11 @@ vec orientation_bitangent[6][3] =
 
 void addtris(const sortkey &key, int orient, vertex *verts, int *index, int numverts, int convex, int shadowmask, int tj)
 {
-    int &total = key.tex==DEFAULT_SKY ? vc.skytris : vc.worldtris;
+    int &total = key.tex==DEFAULT_SKY ? vc->skytris : vc->worldtris;
     int edge = orient*(MAXFACEVERTS+1);
     loopi(numverts-2) if(index[0]!=index[i+1] && index[i+1]!=index[i+2] && index[i+2]!=index[0])
     {
-        vector<ushort> &idxs = key.tex==DEFAULT_SKY ? vc.explicitskyindices : vc.indices[key].tris[(shadowmask>>i)&1];
+        vector<ushort> &idxs = key.tex==DEFAULT_SKY ? vc->explicitskyindices : vc->indices[key].tris[(shadowmask>>i)&1];
         int left = index[0], mid = index[i+1], right = index[i+2], start = left, i0 = left, i1 = -1;
         loopk(4)
         {
@@ -652,7 +652,7 @@ void addtris(const sortkey &key, int orient, vertex *verts, int *index, int numv
                     vt.lm.y = short(v1.lm.y + (v2.lm.y-v1.lm.y)*offset);
                     vt.norm.lerp(v1.norm, v2.norm, offset);
                     vt.tangent.lerp(v1.tangent, v2.tangent, offset);
-                    int i2 = vc.addvert(vt);
+                    int i2 = vc->addvert(vt);
                     if(i2 < 0) return;
                     if(i1 >= 0)
                     {
@@ -673,7 +673,7 @@ void addtris(const sortkey &key, int orient, vertex *verts, int *index, int numv
 
 void addgrasstri(int face, vertex *verts, int numv, ushort texture, ushort lmid)
 {
-    grasstri &g = vc.grasstris.add();
+    grasstri &g = vc->grasstris.add();
     int i1, i2, i3, i4;
     if(numv <= 3 && face%2) { i1 = face+1; i2 = face+2; i3 = i4 = 0; }
     else { i1 = 0; i2 = face+1; i3 = face+2; i4 = numv > 3 ? face+3 : i3; } 
@@ -684,7 +684,7 @@ void addgrasstri(int face, vertex *verts, int numv, ushort texture, ushort lmid)
     g.numv = numv;
 
     g.surface.toplane(g.v[0], g.v[1], g.v[2]);
-    if(g.surface.z <= 0) { vc.grasstris.pop(); return; }
+    if(g.surface.z <= 0) { vc->grasstris.pop(); return; }
 
     g.minz = min(min(g.v[0].z, g.v[1].z), min(g.v[2].z, g.v[3].z));
     g.maxz = max(max(g.v[0].z, g.v[1].z), max(g.v[2].z, g.v[3].z));
@@ -820,14 +820,14 @@ void addcubeverts(VSlot &vslot, int orient, int size, vec *pos, int convex, usho
             v.norm = vinfo && vinfo[k].norm && envmap != EMID_NONE ? bvec(decodenormal(vinfo[k].norm)) : bvec(128, 128, 255);
             v.tangent = bvec4(255, 128, 128, 255);
         }
-        index[k] = vc.addvert(v);
+        index[k] = vc->addvert(v);
         if(index[k] < 0) return;
     }
 
     if(texture == DEFAULT_SKY)
     {
-        loopk(numverts) vc.skyclip = min(vc.skyclip, int(pos[k].z*8)>>3);
-        vc.skymask |= 0x3F&~(1<<orient);
+        loopk(numverts) vc->skyclip = min(vc->skyclip, int(pos[k].z*8)>>3);
+        vc->skymask |= 0x3F&~(1<<orient);
     }
 
     if(lmid >= LMID_RESERVED) lmid = lm ? lm->tex : LMID_AMBIENT;
@@ -885,7 +885,7 @@ struct cubeedge
 };
 
 vector<cubeedge> cubeedges;
-hashtable<edgegroup, int> edgegroups(1<<13);
+openhashtable<edgegroup, int> edgegroups(1<<13);
 
 void gencubeedges(cube &c, const ivec &co, int size)
 {
@@ -1061,7 +1061,7 @@ static inline bool skyoccluded(cube &c, int orient)
     return touchingface(c, orient) && faceedges(c, orient) == F_SOLID;
 }
 
-static int dummyskyfaces[6];
+static thread_local int dummyskyfaces[6];
 static inline int hasskyfaces(cube &c, const ivec &co, int size, int faces[6] = dummyskyfaces)
 {
     int numfaces = 0;
@@ -1115,8 +1115,8 @@ void genskyfaces(cube &c, const ivec &o, int size)
         m.v2 = m.v1 + (size<<3);
         minskyface(c, orient, o, size, m);
         if(m.u1 >= m.u2 || m.v1 >= m.v2) continue;
-        vc.skyarea += (int(m.u2-m.u1)*int(m.v2-m.v1) + (1<<(2*3))-1)>>(2*3);
-        vc.skyfaces[orient].add(m);
+        vc->skyarea += (int(m.u2-m.u1)*int(m.v2-m.v1) + (1<<(2*3))-1)>>(2*3);
+        vc->skyfaces[orient].add(m);
     }
 }
 
@@ -1125,9 +1125,9 @@ void addskyverts(const ivec &o, int size)
     loopi(6)
     {
         int dim = dimension(i), c = C[dim], r = R[dim];
-        vector<facebounds> &sf = vc.skyfaces[i]; 
+        vector<facebounds> &sf = vc->skyfaces[i]; 
         if(sf.empty()) continue;
-        vc.skymask |= 0x3F&~(1<<opposite(i));
+        vc->skymask |= 0x3F&~(1<<opposite(i));
         sf.setsize(mergefaces(i, sf.getbuf(), sf.length()));
         loopvj(sf)
         {
@@ -1141,19 +1141,19 @@ void addskyverts(const ivec &o, int size)
                 if(coords[dim]) v[dim] += size;
                 v[c] = (o[c]&~0xFFF) + (coords[c] ? m.u2 : m.u1)/8.0f;
                 v[r] = (o[r]&~0xFFF) + (coords[r] ? m.v2 : m.v1)/8.0f;
-                index[k] = vc.addvert(v);
+                index[k] = vc->addvert(v);
                 if(index[k] < 0) goto nextskyface;
-                vc.skyclip = min(vc.skyclip, int(v.z*8)>>3);
+                vc->skyclip = min(vc->skyclip, int(v.z*8)>>3);
             }
-            if(vc.skytris + 6 > USHRT_MAX) break;
-            vc.skytris += 6;
-            vc.skyindices.add(index[0]);
-            vc.skyindices.add(index[1]);
-            vc.skyindices.add(index[2]);
-
-            vc.skyindices.add(index[0]);
-            vc.skyindices.add(index[2]);
-            vc.skyindices.add(index[3]);
+            if(vc->skytris + 6 > USHRT_MAX) break;
+            vc->skytris += 6;
+            vc->skyindices.add(index[0]);
+            vc->skyindices.add(index[1]);
+            vc->skyindices.add(index[2]);
+
+            vc->skyindices.add(index[0]);
+            vc->skyindices.add(index[2]);
+            vc->skyindices.add(index[3]);
         nextskyface:;
         }
     }
@@ -1165,17 +1165,82 @@ int allocva = 0;
 int wtris = 0, wverts = 0, vtris = 0, vverts = 0, glde = 0, gbatches = 0;
 vector<vtxarray *> valist, varoot;
 
+/// an octree subtree of the size that always gets its own va, which makes it independent of the rest of the tree.
+/// octarender() builds these on worker threads, only uploading their vbos is left to the main thread.
+struct vajob
+{
+    cube *c;
+    ivec o;
+    int size, csi, depth;
+    const cube *neighbours[32];
+    vector<uchar> slotmask;
+    vector<ushort> slots;
+    vector<vtxarray *> roots;
+    vector<vaupload> uploads;
+};
+
+static void uploadva(vaupload &u)
+{
+    vtxarray *va = u.va;
+    if(va->verts)
+    {
+        if(vbosize[VBO_VBUF] + va->verts > maxvbosize || 
+           vbosize[VBO_EBUF] + u.worldtris > USHRT_MAX ||
+           vbosize[VBO_SKYBUF] + u.skytris > USHRT_MAX) 
+            flushvbo();
+
+        va->voffset = vbosize[VBO_VBUF];
+        memcpy(addvbo(va, VBO_VBUF, va->verts, sizeof(vertex)), u.verts.getbuf(), va->verts*sizeof(vertex));
+        va->minvert += va->voffset;
+        va->maxvert += va->voffset;
+    }
+
+    if(u.skyindices.length())
+    {
+        va->skydata += vbosize[VBO_SKYBUF];
+        ushort *skydata = (ushort *)addvbo(va, VBO_SKYBUF, u.skyindices.length(), sizeof(ushort));
+        loopv(u.skyindices) skydata[i] = u.skyindices[i] + va->voffset;
+    }
+
+    if(va->eslist)
+    {
+        va->edata += vbosize[VBO_EBUF];
+        ushort *edata = (ushort *)addvbo(va, VBO_EBUF, u.worldtris, sizeof(ushort));
+        loopv(u.indices) edata[i] = u.indices[i] + va->voffset;
+        if(va->voffset) loopi(va->texs+va->blends+va->alphaback+va->alphafront)
+        {
+            elementset &e = va->eslist[i];
+            loopl(2) if(e.minvert[l] <= e.maxvert[l])
+            {
+                e.minvert[l] += va->voffset;
+                e.maxvert[l] += va->voffset;
+            }
+        }
+    }
+
+    if(va->grasstris.length()) useshaderbyname("grass");
+
+    wverts += va->verts;
+    wtris  += va->tris + va->blends + va->alphabacktris + va->alphafronttris;
+    allocva++;
+    valist.add(va);
+
+    u.verts.setsize(0);
+    u.skyindices.setsize(0);
+    u.indices.setsize(0);
+}
+
 vtxarray *newva(const ivec &co, int size)
 {
-    vc.optimize();
+    vc->optimize();
 
     vtxarray *va = new vtxarray;
     va->parent = NULL;
     va->o = co;
     va->size = size;
-    va->skyarea = vc.skyarea;
-    va->skyfaces = vc.skymask;
-    va->skyclip = vc.skyclip < INT_MAX ? vc.skyclip : INT_MAX;
+    va->skyarea = vc->skyarea;
+    va->skyfaces = vc->skymask;
+    va->skyclip = vc->skyclip < INT_MAX ? vc->skyclip : INT_MAX;
     va->curvfc = VFC_NOT_VISIBLE;
     va->occluded = OCCLUDE_NOTHING;
     va->query = NULL;
@@ -1184,12 +1249,13 @@ vtxarray *newva(const ivec &co, int size)
     va->hasmerges = 0;
     va->mergelevel = -1;
 
-    vc.setupdata(va);
-
-    wverts += va->verts;
-    wtris  += va->tris + va->blends + va->alphabacktris + va->alphafronttris;
-    allocva++;
-    valist.add(va);
+    if(curvajob) vc->setupdata(va, curvajob->uploads.add());
+    else
+    {
+        static vaupload u;
+        vc->setupdata(va, u);
+        uploadva(u);
+    }
 
     return va;
 }
@@ -1289,8 +1355,9 @@ struct mergedface
 };  
 
 #define MAXMERGELEVEL 12
-static int vahasmerges = 0, vamergemax = 0;
-static vector<mergedface> vamerges[MAXMERGELEVEL+1];
+static thread_local int vahasmerges = 0, vamergemax = 0;
+static vector<mergedface> mainmerges[MAXMERGELEVEL+1];
+static thread_local vector<mergedface> *vamerges = mainmerges;
 
 int genmergedfaces(cube &c, const ivec &co, int size, int minlevel = -1)
 {
@@ -1417,7 +1484,7 @@ void rendercube(cube &c, const ivec &co, int size, int csi, int &maxlevel)  // c
 
         if(c.ext)
         {
-            if(c.ext->ents && c.ext->ents->mapmodels.length()) vc.mapmodels.add(c.ext->ents);
+            if(c.ext->ents && c.ext->ents->mapmodels.length()) vc->mapmodels.add(c.ext->ents);
         }
         return;
     }
@@ -1429,11 +1496,11 @@ void rendercube(cube &c, const ivec &co, int size, int csi, int &maxlevel)  // c
         gencubeverts(c, co, size, csi);
         if(c.merged) maxlevel = max(maxlevel, genmergedfaces(c, co, size));
     }
-    if(c.material != MAT_AIR) genmatsurfs(c, co, size, vc.matsurfs);
+    if(c.material != MAT_AIR) genmatsurfs(c, co, size, vc->matsurfs);
 
     if(c.ext)
     {
-        if(c.ext->ents && c.ext->ents->mapmodels.length()) vc.mapmodels.add(c.ext->ents);
+        if(c.ext->ents && c.ext->ents->mapmodels.length()) vc->mapmodels.add(c.ext->ents);
     }
 
     if(csi <= MAXMERGELEVEL && vamerges[csi].length()) addmergedverts(csi, co);
@@ -1444,9 +1511,9 @@ void calcgeombb(const ivec &co, int size, ivec &bbmin, ivec &bbmax)
     vec vmin(co), vmax = vmin;
     vmin.add(size);
 
-    loopv(vc.verts)
+    loopv(vc->verts)
     {
-        const vec &v = vc.verts[i].pos;
+        const vec &v = vc->verts[i].pos;
         vmin.min(v);
         vmax.max(v);
     }
@@ -1459,9 +1526,9 @@ void calcmatbb(const ivec &co, int size, ivec &bbmin, ivec &bbmax)
 {
     bbmax = co;
     (bbmin = bbmax).add(size);
-    loopv(vc.matsurfs)
+    loopv(vc->matsurfs)
     {
-        materialsurface &m = vc.matsurfs[i];
+        materialsurface &m = vc->matsurfs[i];
         switch(m.material&MATF_VOLUME)
         {
             case MAT_WATER:
@@ -1494,8 +1561,8 @@ void setva(cube &c, const ivec &co, int size, int csi)
     int vamergeoffset[MAXMERGELEVEL+1];
     loopi(MAXMERGELEVEL+1) vamergeoffset[i] = vamerges[i].length();
 
-    vc.origin = co;
-    vc.size = size;
+    vc->origin = co;
+    vc->size = size;
 
     shadowmapmin = vec(co).add(size);
     shadowmapmax = vec(co);
@@ -1509,7 +1576,7 @@ void setva(cube &c, const ivec &co, int size, int csi)
 
     addskyverts(co, size);
 
-    if(size == min(0x1000, worldsize/2) || !vc.emptyva())
+    if(size == min(0x1000, worldsize/2) || !vc->emptyva())
     {
         vtxarray *va = newva(co, size);
         ext(c).va = va;
@@ -1526,7 +1593,7 @@ void setva(cube &c, const ivec &co, int size, int csi)
         loopi(MAXMERGELEVEL+1) vamerges[i].setsize(vamergeoffset[i]);
     }
 
-    vc.clear();
+    vc->clear();
 }
 
 static inline int setcubevisibility(cube &c, const ivec &co, int size)
@@ -1554,6 +1621,30 @@ static inline int setcubevisibility(cube &c, const ivec &co, int size)
     return numvis;
 }
 
+/// while set, octarender() only builds the vas touching this box before vadeadline, see octarenderregion().
+static const ivec *varegion = NULL;
+static benchclock::time_point vadeadline;
+static bool vaouttime = false;
+/// set when a va below the current cube was put off, so the cube can't get one either.
+static thread_local bool vadeferred = false;
+
+static bool deferva(const ivec &o, int size)
+{
+    if(!varegion) return false;
+    if(o.x >= varegion[1].x || o.y >= varegion[1].y || o.z >= varegion[1].z ||
+       o.x + size <= varegion[0].x || o.y + size <= varegion[0].y || o.z + size <= varegion[0].z)
+        return true;
+    if(benchclock::now() >= vadeadline) vaouttime = true;
+    return vaouttime;
+}
+
+/// puts the vas of a subtree which was put off into the root list, so they are still rendered.
+static void addvaroots(cube &c, vector<vtxarray *> &roots)
+{
+    if(c.ext && c.ext->va) roots.add(c.ext->va);
+    else if(c.children) loopi(8) addvaroots(c.children[i], roots);
+}
+
 VARF(vafacemax, 64, 384, 256*256, allchanged());
 VARF(vafacemin, 0, 96, 256*256, allchanged());
 VARF(vacubesize, 32, 128, 0x1000, allchanged());
@@ -1562,40 +1653,51 @@ int updateva(cube *c, const ivec &co, int size, int csi)
 {
     progress("recalculating geometry...");
     int ccount = 0, cmergemax = vamergemax, chasmerges = vahasmerges;
+    vector<vtxarray *> &roots = curvajob ? curvajob->roots : varoot;
     neighbourstack[++neighbourdepth] = c;
     loopi(8)                                    // counting number of semi-solid/solid children cubes
     {
-        int count = 0, childpos = varoot.length();
+        int count = 0, childpos = roots.length();
         ivec o(i, co, size);
         vamergemax = 0;
         vahasmerges = 0;
         if(c[i].ext && c[i].ext->va) 
         {
-            varoot.add(c[i].ext->va);
+            roots.add(c[i].ext->va);
             if(c[i].ext->va->hasmerges&MERGE_ORIGIN) findmergedfaces(c[i], o, size, csi, csi);
         }
+        else if(deferva(o, size))
+        {
+            addvaroots(c[i], roots);
+            vadeferred = true;
+            continue;
+        }
         else
         {
+            bool parentdeferred = vadeferred;
+            vadeferred = false;
             if(c[i].children) count += updateva(c[i].children, o, size/2, csi-1);
             else 
             {
                 if(!isempty(c[i])) count += setcubevisibility(c[i], o, size);
                 count += hasskyfaces(c[i], o, size);
             }
+            bool deferred = vadeferred;
+            vadeferred = parentdeferred || deferred;
             int tcount = count + (csi <= MAXMERGELEVEL ? vamerges[csi].length() : 0);
-            if(tcount > vafacemax || (tcount >= vafacemin && size >= vacubesize) || size == min(0x1000, worldsize/2)) 
+            if(!deferred && (tcount > vafacemax || (tcount >= vafacemin && size >= vacubesize) || size == min(0x1000, worldsize/2)))
             {
-                loadprogress = clamp(recalcprogress/float(allocnodes), 0.0f, 1.0f);
+                if(!curvajob) loadprogress = clamp(recalcprogress/float(allocnodes), 0.0f, 1.0f);
                 setva(c[i], o, size, csi);
                 if(c[i].ext && c[i].ext->va)
                 {
-                    while(varoot.length() > childpos)
+                    while(roots.length() > childpos)
                     {
-                        vtxarray *child = varoot.pop();
+                        vtxarray *child = roots.pop();
                         c[i].ext->va->children.add(child);
                         child->parent = c[i].ext->va;
                     }
-                    varoot.add(c[i].ext->va);
+                    roots.add(c[i].ext->va);
                     if(vamergemax > size)
                     {
                         cmergemax = max(cmergemax, vamergemax);
@@ -1691,6 +1793,122 @@ void findtjoints()
     edgegroups.clear();
 }
 
+static void findvajobs(cube *c, const ivec &co, int size, int csi, vector<vajob> &jobs)
+{
+    neighbourstack[++neighbourdepth] = c;
+    loopi(8) if(!c[i].ext || !c[i].ext->va)
+    {
+        ivec o(i, co, size);
+        if(size == min(0x1000, worldsize/2))
+        {
+            vajob &j = jobs.add();
+            j.c = &c[i];
+            j.o = o;
+            j.size = size;
+            j.csi = csi;
+            j.depth = neighbourdepth;
+            memcpy(j.neighbours, neighbourstack, (neighbourdepth+1)*sizeof(neighbourstack[0]));
+        }
+        else if(c[i].children) findvajobs(c[i].children, o, size/2, csi-1, jobs);
+    }
+    --neighbourdepth;
+}
+
+static void beginvajob(vajob &j)
+{
+    curvajob = &j;
+    memcpy(neighbourstack, j.neighbours, (j.depth+1)*sizeof(neighbourstack[0]));
+    neighbourdepth = j.depth;
+}
+
+static void endvajob()
+{
+    curvajob = NULL;
+    neighbourdepth = -1;
+}
+
+/// collects the texture slots of all faces in the subtree which might become visible.
+static void findvaslots(cube &c, const ivec &co, int size, vajob &j)
+{
+    if(c.ext && c.ext->va) return;
+    if(c.children)
+    {
+        neighbourstack[++neighbourdepth] = c.children;
+        loopi(8) findvaslots(c.children[i], ivec(i, co, size/2), size/2, j);
+        --neighbourdepth;
+    }
+    else if(!isempty(c) && setcubevisibility(c, co, size))
+    {
+        int faces = (c.visible&0x80 ? 0x3F : c.visible&0x3F) | c.merged;
+        loopi(6) if(faces&(1<<i))
+        {
+            ushort tex = c.texture[i];
+            if(j.slotmask.inrange(tex))
+            {
+                if(j.slotmask[tex]) continue;
+                j.slotmask[tex] = 1;
+            }
+            j.slots.add(tex);
+        }
+    }
+}
+
+static void genvajob(vajob &j)
+{
+    vacollect *jobvc = new vacollect, *oldvc = vc;
+    vector<mergedface> merges[MAXMERGELEVEL+1], *oldmerges = vamerges;
+    int oldmergemax = vamergemax, oldhasmerges = vahasmerges;
+    vc = jobvc;
+    vamerges = merges;
+    vamergemax = vahasmerges = 0;
+    beginvajob(j);
+
+    cube &c = *j.c;
+    if(c.children) updateva(c.children, j.o, j.size/2, j.csi-1);
+    else if(!isempty(c)) setcubevisibility(c, j.o, j.size);
+    setva(c, j.o, j.size, j.csi);
+    vtxarray *va = c.ext->va;
+    while(j.roots.length())
+    {
+        vtxarray *child = j.roots.pop();
+        va->children.add(child);
+        child->parent = va;
+    }
+
+    endvajob();
+    vc = oldvc;
+    vamerges = oldmerges;
+    vamergemax = oldmergemax;
+    vahasmerges = oldhasmerges;
+    delete jobvc;
+}
+
+/// builds the subtrees which always get a va of their own on the worker threads, updateva() then only has to link them.
+static void genvajobs(int csi)
+{
+    vector<vajob> jobs;
+    findvajobs(worldroot, ivec(0, 0, 0), worldsize/2, csi, jobs);
+    if(jobs.length() < 2) return;
+
+    renderprogress(0, "recalculating geometry...");
+    // loading textures needs the main thread, so link all slots the subtrees might use before building them
+    parallelfor(jobs.length(), [&](int i)
+    {
+        vajob &j = jobs[i];
+        memset(j.slotmask.pad(vslots.length()), 0, vslots.length());
+        beginvajob(j);
+        findvaslots(*j.c, j.o, j.size, j);
+        endvajob();
+    });
+    loopv(jobs) loopvj(jobs[i].slots)
+    {
+        VSlot &vslot = lookupvslot(jobs[i].slots[j], true);
+        if(vslot.layer) lookupvslot(vslot.layer, true);
+    }
+    parallelfor(jobs.length(), [&](int i) { genvajob(jobs[i]); });
+    loopv(jobs) loopvj(jobs[i].uploads) uploadva(jobs[i].uploads[j]);
+}
+
 void octarender()                               // creates va s for all leaf cubes that don't already have them
 {
     int csi = 0;
@@ -1698,6 +1916,9 @@ void octarender()                               // creates va s for all leaf cub
 
     recalcprogress = 0;
     varoot.setsize(0);
+    loopi(MAXMERGELEVEL+1) vamerges[i].setsize(0);
+    vadeferred = false;
+    if(!varegion) genvajobs(csi-1);
     updateva(worldroot, ivec(0, 0, 0), worldsize/2, csi-1);
     loadprogress = 0;
     flushvbo();
@@ -1715,6 +1936,20 @@ void octarender()                               // creates va s for all leaf cub
     visibleva = NULL;
 }
 
+/// like octarender(), but only builds the vas touching the box from bbmin to bbmax until the deadline has passed.
+/// the ones put off stay missing and their children are rendered on their own until a later call builds them.
+/// returns false if it ran out of time.
+bool octarenderregion(const ivec &bbmin, const ivec &bbmax, const benchclock::time_point &deadline)
+{
+    ivec region[2] = { bbmin, bbmax };
+    varegion = region;
+    vadeadline = deadline;
+    vaouttime = false;
+    octarender();
+    varegion = NULL;
+    return !vaouttime;
+}
+
 void precachetextures()
 {
     vector<int> texs;
@@ -5,31 +5,78 @@
 
 #include "inexor/engine/engine.h"
 #include "inexor/engine/mpr.h"
+#include "inexor/util/thread_local.h"
 
 const int MAXCLIPPLANES = 1024;
-static clipplanes clipcache[MAXCLIPPLANES];
-static int clipcacheversion = -2;
 
-static inline clipplanes &getclipplanes(const cube &c, const ivec &o, int size, bool collide = true, int offset = 0)
+/// clip planes cached by one thread, so ray and collision queries may run on several threads at once.
+/// version tags entries as collide (even) or ray (odd) planes, worldversion is the resetclipplanes() count it was filled at.
+struct ShadowRayCache
+{
+    clipplanes clipcache[MAXCLIPPLANES];
+    int version, worldversion;
+
+    ShadowRayCache() : version(-2), worldversion(-1) {}
+};
+
+static SDL_atomic_t clipworldversion;
+static inexor::util::thread_local_ptr<ShadowRayCache> threadclipcaches;
+
+void resetshadowraycache(ShadowRayCache *cache)
+{
+    cache->version += 2;
+    if(!cache->version)
+    {
+        memset(cache->clipcache, 0, sizeof(cache->clipcache));
+        cache->version = 2;
+    }
+}
+
+/// drops everything cached before the last edit of the world geometry.
+static inline ShadowRayCache *checkclipcache(ShadowRayCache *cache)
 {
-    clipplanes &p = clipcache[int(&c - worldroot)&(MAXCLIPPLANES-1)];
-    if(p.owner != &c || p.version != clipcacheversion+offset) 
+    int worldversion = SDL_AtomicGet(&clipworldversion);
+    if(cache->worldversion != worldversion)
+    {
+        resetshadowraycache(cache);
+        cache->worldversion = worldversion;
+    }
+    return cache;
+}
+
+/// the clip plane cache of the calling thread, set up by threadclipcache() at the start of each query.
+static thread_local ShadowRayCache *curclipcache = NULL;
+
+/// fetches the clip plane cache of the calling thread and checks it against world edits, once per query.
+static inline ShadowRayCache *threadclipcache()
+{
+    if(!curclipcache) curclipcache = threadclipcaches.get();
+    return checkclipcache(curclipcache);
+}
+
+static inline clipplanes &getclipplanes(ShadowRayCache *cache, const cube &c, const ivec &o, int size, bool collide = false)
+{
+    clipplanes &p = cache->clipcache[int(&c - worldroot)&(MAXCLIPPLANES-1)];
+    int version = cache->version + (collide ? 0 : 1);
+    if(p.owner != &c || p.version != version)
     {
         p.owner = &c;
-        p.version = clipcacheversion+offset;
+        p.version = version;
         genclipplanes(c, o, size, p, collide);
     }
     return p;
 }
 
+/// the per cube lookup of collide(), which already called threadclipcache().
+static inline clipplanes &getclipplanes(const cube &c, const ivec &o, int size, bool collide = true)
+{
+    return getclipplanes(curclipcache, c, o, size, collide);
+}
+
+/// invalidates the clip plane caches of all threads, called whenever the octree changes.
 void resetclipplanes()
 {
-    clipcacheversion += 2;
-    if(!clipcacheversion)
-    {
-        memset(clipcache, 0, sizeof(clipcache));
-        clipcacheversion = 2;
-    }
+    SDL_AtomicAdd(&clipworldversion, 1);
 }
 
 /////////////////////////  ray - cube collision ///////////////////////////////////////////////
@@ -101,15 +148,15 @@ bool pointincube(const clipplanes &p, const vec &v)
 
 vec hitsurface;
 
-static inline bool raycubeintersect(const clipplanes &p, const cube &c, const vec &v, const vec &ray, const vec &invray, float &dist)
+static inline bool raycubeintersect(const clipplanes &p, const cube &c, const vec &v, const vec &ray, const vec &invray, float &dist, vec &surface)
 {
     int entry = -1, bbentry = -1;
     INTERSECTPLANES(entry = i, return false);
     INTERSECTBOX(bbentry = i, return false);
     if(exitdist < 0) return false;
     dist = max(enterdist+0.1f, 0.0f);
-    if(bbentry>=0) { hitsurface = vec(0, 0, 0); hitsurface[bbentry] = ray[bbentry]>0 ? -1 : 1; }
-    else hitsurface = p.p[entry];
+    if(bbentry>=0) { surface = vec(0, 0, 0); surface[bbentry] = ray[bbentry]>0 ? -1 : 1; }
+    else surface = p.p[entry];
     return true;
 }
 
@@ -117,7 +164,7 @@ extern void entselectionbox(const entity &e, vec &eo, vec &es);
 float hitentdist;
 int hitent, hitorient;
 
-static float disttoent(octaentities *oc, const vec &o, const vec &ray, float radius, int mode, extentity *t)
+static float disttoent(octaentities *oc, const vec &o, const vec &ray, float radius, int mode, extentity *t, bool record = true)
 {
     vec eo, es;
     int orient = -1;
@@ -132,9 +179,13 @@ static float disttoent(octaentities *oc, const vec &o, const vec &ray, float rad
             func; \
             if(f<dist && f>0 && vec(ray).mul(f).add(o).insidebb(oc->o, oc->size)) \
             { \
-                hitentdist = dist = f; \
-                hitent = oc->type[i]; \
-                hitorient = orient; \
+                dist = f; \
+                if(record) \
+                { \
+                    hitentdist = f; \
+                    hitent = oc->type[i]; \
+                    hitorient = orient; \
+                } \
             } \
         } \
     }
@@ -269,9 +320,13 @@ static float shadowent(octaentities *oc, const vec &o, const vec &ray, float rad
             diff >>= 1; \
         } while(diff);
 
-float raycube(const vec &o, const vec &ray, float radius, int mode, int size, extentity *t)
+/// with a cache this only writes to the cache and surface, so it can run on worker threads (see preloadraymodels()).
+static float raycube(ShadowRayCache *cache, vec &surface, const vec &o, const vec &ray, float radius, int mode, int size, extentity *t)
 {
     if(ray.iszero()) return 0;
+    bool record = !cache;
+    if(record) cache = threadclipcache();
+    #define disttoentcached(oc, o, ray, radius, mode, t) disttoent(oc, o, ray, radius, mode, t, record)
 
     INITRAYCUBE;
     CHECKINSIDEWORLD;
@@ -279,7 +334,7 @@ float raycube(const vec &o, const vec &ray, float radius, int mode, int size, ex
     int closest = -1, x = int(v.x), y = int(v.y), z = int(v.z);
     for(;;)
     {
-        DOWNOCTREE(disttoent, if(mode&RAY_SHADOW));
+        DOWNOCTREE(disttoentcached, if(mode&RAY_SHADOW));
 
         int lsize = 1<<lshift;
 
@@ -291,7 +346,7 @@ float raycube(const vec &o, const vec &ray, float radius, int mode, int size, ex
             isentirelysolid(c) ||
             dent < dist))
         {
-            if(closest >= 0) { hitsurface = vec(0, 0, 0); hitsurface[closest] = ray[closest]>0 ? -1 : 1; }
+            if(closest >= 0) { surface = vec(0, 0, 0); surface[closest] = ray[closest]>0 ? -1 : 1; }
             return min(dent, dist);
         }
 
@@ -299,9 +354,9 @@ float raycube(const vec &o, const vec &ray, float radius, int mode, int size, ex
 
         if(!isempty(c))
         {
-            const clipplanes &p = getclipplanes(c, lo, lsize, false, 1);
+            const clipplanes &p = getclipplanes(cache, c, lo, lsize);
             float f = 0;
-            if(raycubeintersect(p, c, v, ray, invray, f) && (dist+f>0 || !(mode&RAY_SKIPFIRST)))
+            if(raycubeintersect(p, c, v, ray, invray, f, surface) && (dist+f>0 || !(mode&RAY_SKIPFIRST)))
                 return min(dent, dist+f);
         }
 
@@ -311,11 +366,18 @@ float raycube(const vec &o, const vec &ray, float radius, int mode, int size, ex
 
         UPOCTREE(return min(dent, radius>0 ? radius : dist));
     }
+    #undef disttoentcached
+}
+
+float raycube(const vec &o, const vec &ray, float radius, int mode, int size, extentity *t)
+{
+    return raycube(NULL, hitsurface, o, ray, radius, mode, size, t);
 }
 
 // optimized version for lightmap shadowing... every cycle here counts!!!
 float shadowray(const vec &o, const vec &ray, float radius, int mode, extentity *t)
 {
+    ShadowRayCache *cache = threadclipcache();
     INITRAYCUBE;
     CHECKINSIDEWORLD;
 
@@ -330,7 +392,7 @@ float shadowray(const vec &o, const vec &ray, float radius, int mode, extentity
         if(!isempty(c) && !(c.material&MAT_ALPHA))
         {
             if(isentirelysolid(c)) return c.texture[side]==DEFAULT_SKY && mode&RAY_SKIPSKY ? radius : dist;
-            const clipplanes &p = getclipplanes(c, lo, 1<<lshift, false, 1);
+            const clipplanes &p = getclipplanes(cache, c, lo, 1<<lshift);
             INTERSECTPLANES(side = p.side[i], goto nextcube);
             INTERSECTBOX(side = (i<<1) + 1 - lsizemask[i], goto nextcube);
             if(exitdist >= 0) return c.texture[side]==DEFAULT_SKY && mode&RAY_SKIPSKY ? radius : dist+max(enterdist+0.1f, 0.0f);
@@ -347,30 +409,13 @@ float shadowray(const vec &o, const vec &ray, float radius, int mode, extentity
 
 // thread safe version
 
-struct ShadowRayCache
-{
-    clipplanes clipcache[MAXCLIPPLANES];
-    int version;
-
-    ShadowRayCache() : version(-1) {}
-};
-
 ShadowRayCache *newshadowraycache() { return new ShadowRayCache; }
 
 void freeshadowraycache(ShadowRayCache *&cache) { delete cache; cache = NULL; }
 
-void resetshadowraycache(ShadowRayCache *cache) 
-{ 
-    cache->version++;
-    if(!cache->version)
-    {
-        memset(cache->clipcache, 0, sizeof(cache->clipcache));
-        cache->version = 1;
-    }
-}
-
 float shadowray(ShadowRayCache *cache, const vec &o, const vec &ray, float radius, int mode, extentity *t)
 {
+    checkclipcache(cache);
     INITRAYCUBE;
     CHECKINSIDEWORLD;
 
@@ -385,8 +430,7 @@ float shadowray(ShadowRayCache *cache, const vec &o, const vec &ray, float radiu
         if(!isempty(c) && !(c.material&MAT_ALPHA))
         {
             if(isentirelysolid(c)) return c.texture[side]==DEFAULT_SKY && mode&RAY_SKIPSKY ? radius : dist;
-            clipplanes &p = cache->clipcache[int(&c - worldroot)&(MAXCLIPPLANES-1)];
-            if(p.owner != &c || p.version != cache->version) { p.owner = &c; p.version = cache->version; genclipplanes(c, lo, 1<<lshift, p, false); }
+            const clipplanes &p = getclipplanes(cache, c, lo, 1<<lshift);
             INTERSECTPLANES(side = p.side[i], goto nextcube);
             INTERSECTBOX(side = (i<<1) + 1 - lsizemask[i], goto nextcube);
             if(exitdist >= 0) return c.texture[side]==DEFAULT_SKY && mode&RAY_SKIPSKY ? radius : dist+max(enterdist+0.1f, 0.0f);
@@ -436,6 +480,89 @@ bool raycubelos(const vec &o, const vec &dest, vec &hitpos)
     return distance >= mag;
 }
 
+/// map models are loaded and get their BIH on first use, which must not happen on worker threads.
+static void preloadraymodels()
+{
+    const vector<extentity *> &ents = entities::getents();
+    loopv(ents) if(ents[i]->type == ET_MAPMODEL)
+    {
+        model *m = loadmapmodel(ents[i]->attr2);
+        if(m) m->preloadBIH();
+    }
+}
+
+#define RAYQUERYBATCH 32
+
+static inline uint raymortonbits(uint x)
+{
+    x &= 0x3FF;
+    x = (x | (x << 16)) & 0x030000FF;
+    x = (x | (x << 8)) & 0x0300F00F;
+    x = (x | (x << 4)) & 0x030C30C3;
+    x = (x | (x << 2)) & 0x09249249;
+    return x;
+}
+
+/// orders rays along a morton curve of their origins, so rays cast after each other run through the same cubes.
+static void sortrays(const vec *origins, int stride, int num, vector<ivec2> &order)
+{
+    int shift = max(worldscale - 10, 0);
+    order.setsize(0);
+    loopi(num)
+    {
+        const vec &o = *(const vec *)((const uchar *)origins + i*stride);
+        ivec c = ivec(int(o.x), int(o.y), int(o.z)).max(0).min(worldsize-1).shr(shift);
+        order.add(ivec2(raymortonbits(c.x) | (raymortonbits(c.y)<<1) | (raymortonbits(c.z)<<2), i));
+    }
+    order.sort([](const ivec2 &x, const ivec2 &y) { return x.x < y.x; });
+}
+
+/// calls fn(cache, surface, i) for all i in [0, num), in runs of RAYQUERYBATCH coherent rays spread across the worker threads.
+template<class T, class F> static void raybatch(T *queries, int num, F fn)
+{
+    if(num <= 0) return;
+    preloadraymodels();
+    static vector<ivec2> order;
+    bool sorted = num > RAYQUERYBATCH;
+    if(sorted) sortrays(&queries[0].o, sizeof(T), num, order);
+    parallelfor((num + RAYQUERYBATCH - 1) / RAYQUERYBATCH, [&](int batch)
+    {
+        ShadowRayCache *cache = threadclipcache();
+        vec surface;
+        for(int i = batch*RAYQUERYBATCH, end = min(i + RAYQUERYBATCH, num); i < end; i++)
+            fn(cache, surface, queries[sorted ? order[i].y : i]);
+    });
+}
+
+/// answers many line of sight queries at once, spread across the worker threads.
+void raycubelos(losquery *queries, int num)
+{
+    raybatch(queries, num, [](ShadowRayCache *cache, vec &surface, losquery &q)
+    {
+        vec ray(q.dest);
+        ray.sub(q.o);
+        float mag = ray.magnitude();
+        if(mag <= 0) { q.hitpos = q.o; q.los = true; return; }
+        ray.mul(1/mag);
+        float dist = raycube(cache, surface, q.o, ray, mag, RAY_CLIPMAT|RAY_POLY, 0, NULL);
+        if(dist >= mag) dist = mag;
+        q.hitpos = vec(ray).mul(dist).add(q.o);
+        q.los = dist >= mag;
+    });
+}
+
+/// casts many rays at once like raycube(), also setting the hit position (see raycubepos()) and surface normal of each.
+void raycube(rayquery *queries, int num)
+{
+    raybatch(queries, num, [](ShadowRayCache *cache, vec &surface, rayquery &q)
+    {
+        surface = vec(0, 0, 0);
+        q.dist = raycube(cache, surface, q.o, q.ray, q.radius, q.mode, q.size, NULL);
+        q.hitpos = vec(q.ray).mul(q.radius>0 && q.dist>=q.radius ? q.radius : q.dist).add(q.o);
+        q.surface = surface;
+    });
+}
+
 float rayfloor(const vec &o, vec &floor, int mode, float radius)
 {
     if(o.z<=0) return -1;
@@ -554,68 +681,122 @@ bool ellipsecollide(physent *d, const vec &dir, const vec &o, const vec &center,
     return false;
 }
 
-#define DYNENTCACHESIZE 1024
-
-static uint dynentframe = 0;
+/// most cells hold only a few dynents, so keep them inside the cell.
+typedef smallvector<physent *, 8> dynentlist;
 
-static struct dynentcacheentry
+/// dynents are kept in a loose grid: each one is only stored in the cell of its center, and lookups widen
+/// their range by the largest dynent radius around. the grid persists across frames, cleardynentcache() only
+/// makes the next lookup check every dynent once, moving those which changed cells and dropping the ones gone.
+struct dynentslot
 {
-    int x, y;
+    ivec2 cell;
     uint frame;
-    vector<physent *> dynents;
-} dynentcache[DYNENTCACHESIZE];
+};
+
+static inline uint hthash(const physent *d) { return uint(size_t(d) >> 4); }
+static inline bool htcmp(const physent *x, const physent *y) { return x == y; }
+
+static hashtable<ivec2, dynentlist> dynentgrid;
+static hashtable<const physent *, dynentslot> dynentslots;
+static uint dynentframe = 0;
+static bool dynentsdirty = true;
+static float dynentradius = 0;
 
 void cleardynentcache()
 {
-    dynentframe++;
-    if(!dynentframe || dynentframe == 1) loopi(DYNENTCACHESIZE) dynentcache[i].frame = 0;
-    if(!dynentframe) dynentframe = 1;
+    dynentsdirty = true;
+}
+
+static void resetdynentgrid()
+{
+    dynentgrid.clear();
+    dynentslots.clear();
+    dynentsdirty = true;
 }
 
-VARF(dynentsize, 4, 7, 12, cleardynentcache());
+VARF(dynentsize, 4, 7, 12, resetdynentgrid());
+
+static inline ivec2 dynentcell(const physent *d)
+{
+    return ivec2(clamp(int(d->o.x), 0, worldsize-1)>>dynentsize, clamp(int(d->o.y), 0, worldsize-1)>>dynentsize);
+}
+
+static void movedynent(physent *d)
+{
+    ivec2 cell = dynentcell(d);
+    dynentslot *slot = dynentslots.access(d);
+    if(slot)
+    {
+        slot->frame = dynentframe;
+        if(slot->cell == cell) return;
+        dynentgrid[slot->cell].removeobj(d);
+    }
+    else
+    {
+        slot = &dynentslots[d];
+        slot->frame = dynentframe;
+    }
+    slot->cell = cell;
+    dynentgrid[cell].add(d);
+    dynentradius = max(dynentradius, d->radius);
+}
 
-#define DYNENTHASH(x, y) (((((x)^(y))<<5) + (((x)^(y))>>5)) & (DYNENTCACHESIZE - 1))
+/// d may already be deleted, so it is only compared against.
+static void removedynent(physent *d)
+{
+    dynentslot *slot = dynentslots.access(d);
+    if(!slot) return;
+    dynentgrid[slot->cell].removeobj(d);
+    dynentslots.remove(d);
+}
 
-const vector<physent *> &checkdynentcache(int x, int y)
+static void syncdynents()
 {
-    dynentcacheentry &dec = dynentcache[DYNENTHASH(x, y)];
-    if(dec.x == x && dec.y == y && dec.frame == dynentframe) return dec.dynents;
-    dec.x = x;
-    dec.y = y;
-    dec.frame = dynentframe;
-    dec.dynents.shrink(0);
-    int numdyns = game::numdynents(), dsize = 1<<dynentsize, dx = x<<dynentsize, dy = y<<dynentsize;
+    if(!dynentsdirty) return;
+    dynentsdirty = false;
+    if(!++dynentframe)
+    {
+        enumerate(dynentslots, dynentslot, slot, slot.frame = 0);
+        dynentframe = 1;
+    }
+    dynentradius = 0;
+    int numdyns = game::numdynents();
     loopi(numdyns)
     {
         dynent *d = game::iterdynents(i);
-        if(d->state != CS_ALIVE ||
-           d->o.x+d->radius <= dx || d->o.x-d->radius >= dx+dsize ||
-           d->o.y+d->radius <= dy || d->o.y-d->radius >= dy+dsize)
-            continue;
-        dec.dynents.add(d);
+        if(d->state == CS_ALIVE) movedynent(d);
     }
-    return dec.dynents;
+    static vector<physent *> gone;
+    gone.setsize(0);
+    enumeratekt(dynentslots, const physent *, d, dynentslot, slot, { if(slot.frame != dynentframe) gone.add((physent *)d); });
+    loopv(gone) removedynent(gone[i]);
 }
 
+const dynentlist &checkdynentcache(int x, int y)
+{
+    static const dynentlist empty;
+    const dynentlist *dynents = dynentgrid.access(ivec2(x, y));
+    return dynents ? *dynents : empty;
+}
+
+/// call syncdynents() before looping.
 #define loopdynentcache(curx, cury, o, radius) \
-    for(int curx = max(int(o.x-radius), 0)>>dynentsize, endx = min(int(o.x+radius), worldsize-1)>>dynentsize; curx <= endx; curx++) \
-    for(int cury = max(int(o.y-radius), 0)>>dynentsize, endy = min(int(o.y+radius), worldsize-1)>>dynentsize; cury <= endy; cury++)
+    for(int curx = max(int(o.x-radius-dynentradius), 0)>>dynentsize, endx = min(int(o.x+radius+dynentradius), worldsize-1)>>dynentsize; curx <= endx; curx++) \
+    for(int cury = max(int(o.y-radius-dynentradius), 0)>>dynentsize, endy = min(int(o.y+radius+dynentradius), worldsize-1)>>dynentsize; cury <= endy; cury++)
 
 void updatedynentcache(physent *d)
 {
-    loopdynentcache(x, y, d->o, d->radius)
-    {
-        dynentcacheentry &dec = dynentcache[DYNENTHASH(x, y)];
-        if(dec.x != x || dec.y != y || dec.frame != dynentframe || dec.dynents.find(d) >= 0) continue;
-        dec.dynents.add(d);
-    }
+    if(dynentsdirty) return; // the next lookup checks all of them anyway
+    if(d->state == CS_ALIVE) movedynent(d);
+    else removedynent(d);
 }
 
 bool overlapsdynent(const vec &o, float radius)
 {
+    syncdynents();
     loopdynentcache(x, y, o, radius)
     {
-        const vector<physent *> &dynents = checkdynentcache(x, y);
+        const dynentlist &dynents = checkdynentcache(x, y);
         loopv(dynents)
         {
             physent *d = dynents[i];
@@ -644,9 +825,10 @@ static inline bool plcollide(physent *d, const vec &dir, physent *o)
 bool plcollide(physent *d, const vec &dir)    // collide with player or monster
 {
     if(d->type==ENT_CAMERA || d->state!=CS_ALIVE) return false;
+    syncdynents();
     loopdynentcache(x, y, d->o, d->radius)
     {
-        const vector<physent *> &dynents = checkdynentcache(x, y);
+        const dynentlist &dynents = checkdynentcache(x, y);
         loopv(dynents)
         {
             physent *o = dynents[i];
@@ -1025,6 +1207,7 @@ bool collide(physent *d, const vec &dir, float cutoff, bool playercol)
     ivec bo(int(d->o.x-d->radius), int(d->o.y-d->radius), int(d->o.z-d->eyeheight)),
          bs(int(d->o.x+d->radius), int(d->o.y+d->radius), int(d->o.z+d->aboveeye));
     bs.add(1);  // guard space for rounding errors
+    threadclipcache();
     return octacollide(d, dir, cutoff, bo, bs) || (playercol && plcollide(d, dir));
 }
 
@@ -1517,6 +1700,66 @@ void phystest()
 
 COMMAND(phystest, "");
 
+/// Times the octree traversals done all over the engine (lookupcube, raycube and collide) at the same random spots of the current map.
+void octabench(int *passes)
+{
+    int n = *passes > 0 ? *passes : 100000;
+    vector<vec> spots, dirs;
+    loopi(n)
+    {
+        spots.add(vec(detrnd(3*i, worldsize), detrnd(3*i+1, worldsize), detrnd(3*i+2, worldsize)));
+        dirs.add(vec(detrnd(3*i, 360)*RAD, (detrnd(3*i+1, 180)-90)*RAD));
+    }
+    int hits = 0;
+    benchclock::time_point start = benchclock::now();
+    loopv(spots) if(!isempty(lookupcube(ivec(spots[i])))) hits++;
+    benchclock::time_point looked = benchclock::now();
+    float dist = 0;
+    loopv(spots) dist += raycube(spots[i], dirs[i], 256, RAY_CLIPMAT|RAY_POLY);
+    benchclock::time_point rayed = benchclock::now();
+    physent d;
+    d.type = ENT_BOUNCE;
+    int collisions = 0;
+    loopv(spots)
+    {
+        d.o = spots[i];
+        if(collide(&d, dirs[i])) collisions++;
+    }
+    benchclock::time_point collided = benchclock::now();
+    conoutf("lookupcube: %d lookups %d us (%d solid)", n, benchmicros(start, looked), hits);
+    conoutf("raycube: %d rays %d us (%.0f)", n, benchmicros(looked, rayed), dist);
+    conoutf("collide: %d boxes %d us (%d collisions)", n, benchmicros(rayed, collided), collisions);
+}
+COMMAND(octabench, "i");
+
+/// Compares casting rays one at a time against the batched raycube() at the same random spots of the current map.
+void raybench(int *passes)
+{
+    int n = *passes > 0 ? *passes : 100000;
+    vector<rayquery> queries;
+    loopi(n)
+    {
+        rayquery &q = queries.add();
+        q.o = vec(detrnd(3*i, worldsize), detrnd(3*i+1, worldsize), detrnd(3*i+2, worldsize));
+        q.ray = vec(detrnd(3*i, 360)*RAD, (detrnd(3*i+1, 180)-90)*RAD);
+        q.radius = 1024;
+        q.mode = RAY_CLIPMAT|RAY_POLY;
+        q.size = 0;
+    }
+    vector<float> dists;
+    benchclock::time_point start = benchclock::now();
+    loopv(queries) dists.add(raycube(queries[i].o, queries[i].ray, queries[i].radius, queries[i].mode));
+    benchclock::time_point single = benchclock::now();
+    raycube(queries.getbuf(), queries.length());
+    benchclock::time_point batched = benchclock::now();
+    int mismatches = 0;
+    loopv(queries) if(fabs(queries[i].dist - dists[i]) > 1e-3f) mismatches++;
+    int singleus = max(benchmicros(start, single), 1), batchedus = max(benchmicros(single, batched), 1);
+    conoutf("raycube: %d rays %d us (%.0f rays/s)", n, singleus, n*1e6f/singleus);
+    conoutf("batched: %d rays %d us (%.0f rays/s, %d mismatches)", n, batchedus, n*1e6f/batchedus, mismatches);
+}
+COMMAND(raybench, "i");
+
 void vecfromyawpitch(float yaw, float pitch, int move, int strafe, vec &m)
 {
     if(move)
@@ -1886,10 +2129,10 @@ bool moveplatform(physent *p, const vec &dir)
 
     static vector<platforment> ents;
     ents.setsize(0);
-    for(int x = int(max(p->o.x-p->radius-PLATFORMBORDER, 0.0f))>>dynentsize, ex = int(min(p->o.x+p->radius+PLATFORMBORDER, worldsize-1.0f))>>dynentsize; x <= ex; x++)
-    for(int y = int(max(p->o.y-p->radius-PLATFORMBORDER, 0.0f))>>dynentsize, ey = int(min(p->o.y+p->radius+PLATFORMBORDER, worldsize-1.0f))>>dynentsize; y <= ey; y++)
+    syncdynents();
+    loopdynentcache(x, y, p->o, p->radius+PLATFORMBORDER)
     {
-        const vector<physent *> &dynents = checkdynentcache(x, y);
+        const dynentlist &dynents = checkdynentcache(x, y);
         loopv(dynents)
         {
             physent *d = dynents[i];
@@ -1,5 +1,9 @@
 #include "inexor/engine/engine.h"
 
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
 enum
 {
     PVS_HIDE_GEOM = 1<<0,
@@ -105,12 +109,6 @@ static void genpvsnodes(cube *c, int parent = 0, const ivec &co = ivec(0, 0, 0),
     else origpvsnodes[parent].children = index;
 }
 
-struct shaftplane
-{
-    float r, c, offset;
-    uchar rnear, cnear, rfar, cfar;
-};
-
 struct shaftbb
 {
     union
@@ -170,7 +168,9 @@ struct shaftbb
 struct shaft
 {
     shaftbb bounds;
-    shaftplane planes[8];
+    // separating planes stored as columns, so four of them can be tested at once
+    float rscale[8], cscale[8], offset[8];
+    uchar rnear[8], cnear[8], rfar[8], cfar[8];
     int numplanes;
 
     shaft(const shaftbb &from, const shaftbb &to)
@@ -196,42 +196,59 @@ struct shaft
         {
             int r = i%3, c = j%3, d = (r+1)%3;
             if(d==c) d = (c+1)%3;
-            shaftplane &p = planes[numplanes++];
-            p.r = from[j] - to[j];
-            if(i<3 ? p.r >= 0 : p.r < 0)
+            int k = numplanes++;
+            float pr = from[j] - to[j], pc;
+            if(i<3 ? pr >= 0 : pr < 0)
             {
-                p.r = -p.r;
-                p.c = from[i] - to[i];
+                pr = -pr;
+                pc = from[i] - to[i];
             }
-            else p.c = to[i] - from[i];
-            p.offset = -(from[i]*p.r + from[j]*p.c);
-            p.rnear = p.r >= 0 ? r : 3+r;
-            p.cnear = p.c >= 0 ? c : 3+c;
-            p.rfar = p.r < 0 ? r : 3+r;
-            p.cfar = p.c < 0 ? c : 3+c;
+            else pc = to[i] - from[i];
+            rscale[k] = pr;
+            cscale[k] = pc;
+            offset[k] = -(from[i]*pr + from[j]*pc);
+            rnear[k] = pr >= 0 ? r : 3+r;
+            cnear[k] = pc >= 0 ? c : 3+c;
+            rfar[k] = pr < 0 ? r : 3+r;
+            cfar[k] = pc < 0 ? c : 3+c;
+        }
+        // pad to a multiple of four with planes nothing is outside of
+        for(int k = numplanes; k&3; k++)
+        {
+            rscale[k] = cscale[k] = 0;
+            offset[k] = -1;
+            rnear[k] = cnear[k] = rfar[k] = cfar[k] = 0;
         }
     }
 
-    bool outside(const shaftbb &o) const
+    /// checks whether the corner of o picked by ri and ci is outside any of the planes
+    bool planesoutside(const shaftbb &o, const uchar *ri, const uchar *ci) const
     {
-        if(bounds.outside(o)) return true;
-
-        for(const shaftplane *p = planes; p < &planes[numplanes]; p++)
+#ifdef __SSE__
+        float v[6];
+        loopi(6) v[i] = o[i];
+        const __m128 zero = _mm_setzero_ps();
+        for(int i = 0; i < numplanes; i += 4)
         {
-            if(o[p->rnear]*p->r + o[p->cnear]*p->c + p->offset > 0) return true;
+            __m128 vr = _mm_set_ps(v[ri[i+3]], v[ri[i+2]], v[ri[i+1]], v[ri[i]]),
+                   vc = _mm_set_ps(v[ci[i+3]], v[ci[i+2]], v[ci[i+1]], v[ci[i]]),
+                   d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vr, _mm_loadu_ps(&rscale[i])), _mm_mul_ps(vc, _mm_loadu_ps(&cscale[i]))), _mm_loadu_ps(&offset[i]));
+            if(_mm_movemask_ps(_mm_cmpgt_ps(d, zero))) return true;
         }
+#else
+        loopi(numplanes) if(o[ri[i]]*rscale[i] + o[ci[i]]*cscale[i] + offset[i] > 0) return true;
+#endif
         return false;
     }
 
-    bool inside(const shaftbb &o) const
+    bool outside(const shaftbb &o) const
     {
-        if(bounds.notinside(o)) return false;
+        return bounds.outside(o) || planesoutside(o, rnear, cnear);
+    }
 
-        for(const shaftplane *p = planes; p < &planes[numplanes]; p++)
-        {
-            if(o[p->rfar]*p->r + o[p->cfar]*p->c + p->offset > 0) return false;
-        }
-        return true;
+    bool inside(const shaftbb &o) const
+    {
+        return !bounds.notinside(o) && !planesoutside(o, rfar, cfar);
     }
 };
 
@@ -261,20 +278,71 @@ static SDL_mutex *pvsmutex = NULL;
 static hashtable<pvsdata, int> pvscompress;
 static vector<pvsdata> pvs;
 
-static SDL_mutex *viewcellmutex = NULL;
 struct viewcellrequest
 {
     int *result;
     ivec o;
-    int size;
+    int size, deps;
 };
 static vector<viewcellrequest> viewcellrequests;
 
+/// every view cell remembers which parts of the world its pvs depends on, as bits in a coarse grid over the map.
+/// those are the leaves it could see and the blockers it used, so after edits only cells depending on them are redone.
+#define PVSDEPGRID 8
+#define PVSDEPWORDS (PVSDEPGRID*PVSDEPGRID*PVSDEPGRID/32)
+
+struct viewcelldeps
+{
+    ivec o;
+    int size, pvs;
+    uint mask[PVSDEPWORDS];
+};
+static vector<viewcelldeps> pvsdeps;
+
+struct pvsregion { ivec bbmin, bbmax; };
+static vector<pvsregion> pvsdirty;
+static int pvsviewcellsize = 0;
+
+static void markpvsdeps(uint *mask, const ivec &bbmin, const ivec &bbmax)
+{
+    int shift = worldscale - 3;
+    ivec lo = ivec(bbmin).max(0).min(worldsize-1).shr(shift), hi = ivec(bbmax).sub(1).max(0).min(worldsize-1).shr(shift);
+    for(int z = lo.z; z <= hi.z; z++) for(int y = lo.y; y <= hi.y; y++) for(int x = lo.x; x <= hi.x; x++)
+    {
+        int i = (z*PVSDEPGRID + y)*PVSDEPGRID + x;
+        mask[i>>5] |= 1U<<(i&31);
+    }
+}
+
 static bool genpvs_canceled = false;
 static int numviewcells = 0;
 
 VAR(maxpvsblocker, 1, 512, 1<<16);
 VAR(pvsleafsize, 1, 64, 1024);
+/// view cells a pvs worker takes off its range at once
+VAR(pvsbatch, 1, 16, 1024);
+
+static volatile bool check_genpvs_progress = false;
+
+static Uint32 genpvs_timer(Uint32 interval, void *param)
+{
+    check_genpvs_progress = true;
+    return interval;
+}
+
+static int totalviewcells = 0;
+
+static void show_genpvs_progress(int unique = pvs.length(), int processed = numviewcells)
+{
+    float bar1 = float(processed) / float(totalviewcells>0 ? totalviewcells : 1);
+
+    defformatstring(text1, "%d%% - %d of %d view cells (%d unique)", int(bar1 * 100), processed, totalviewcells, unique);
+
+    renderprogress(bar1, text1);
+
+    if(interceptkey(SDLK_ESCAPE)) genpvs_canceled = true;
+    check_genpvs_progress = false;
+}
 
 #define MAXWATERPVS 32
 
@@ -286,9 +354,12 @@ static struct
 static vector<materialsurface *> waterfalls;
 uint numwaterplanes = 0;
 
+struct pvsworker;
+static vector<pvsworker *> pvsworkers;
+
 struct pvsworker
 {
-    pvsworker() : thread(NULL), pvsnodes(new pvsnode[origpvsnodes.length()])
+    pvsworker() : thread(NULL), pvsnodes(new pvsnode[origpvsnodes.length()]), deps(NULL), lock(0), next(0), end(0)
     {
     }
     ~pvsworker()
@@ -298,6 +369,11 @@ struct pvsworker
 
     SDL_Thread *thread;
     pvsnode *pvsnodes;
+    uint *deps;
+
+    // range of viewcellrequests left to this worker, others steal from its end
+    SDL_SpinLock lock;
+    int next, end;
 
     shaftbb viewcellbb;
 
@@ -418,6 +494,7 @@ struct pvsworker
 
     void cullpvs(pvsnode &p, const ivec &co = ivec(0, 0, 0), int size = worldsize)
     {
+        if(deps && !p.children && !(p.flags&PVS_HIDE_BB)) markpvsdeps(deps, co, ivec(co).add(size));
         if(p.flags&(PVS_HIDE_BB | PVS_HIDE_GEOM) || genpvs_canceled) return;
         if(p.children && !(p.flags&PVS_HIDE_BB))
         {
@@ -615,6 +692,7 @@ struct pvsworker
                     }
                     //printf("(%d,%d,%d) x %d,%d,%d, side %d, ccenter = %d, origin = (%d,%d,%d), size = %d\n", bb.min.x, bb.min.y, bb.min.z, bb.max.x-bb.min.x, bb.max.y-bb.min.y, bb.max.z-bb.min.z, i, ccenter, co.x, co.y, co.z, size);
                 }
+                if(deps) markpvsdeps(deps, ivec(bb.min).sub(1), ivec(bb.max).add(1));
                 bool dup = false;
                 loopvj(prevblockers)
                 {
@@ -793,19 +871,64 @@ struct pvsworker
         return *val;
     }
 
-    static int run(void *data)
+    /// takes the next batch off this worker's range
+    bool takeviewcells(int &first, int &last)
+    {
+        SDL_AtomicLock(&lock);
+        first = next;
+        last = next = min(next + pvsbatch, end);
+        SDL_AtomicUnlock(&lock);
+        return first < last;
+    }
+
+    /// moves the back half of the largest range left to another worker over to this one
+    bool stealviewcells()
+    {
+        for(;;)
+        {
+            pvsworker *victim = NULL;
+            int most = 0;
+            loopv(pvsworkers)
+            {
+                pvsworker *w = pvsworkers[i];
+                if(w == this) continue;
+                SDL_AtomicLock(&w->lock);
+                int left = w->end - w->next;
+                SDL_AtomicUnlock(&w->lock);
+                if(left > most) { victim = w; most = left; }
+            }
+            if(!victim) return false;
+            SDL_AtomicLock(&victim->lock);
+            int left = victim->end - victim->next, stolen = (left+1)/2, last = victim->end;
+            victim->end -= stolen;
+            SDL_AtomicUnlock(&victim->lock);
+            if(stolen <= 0) continue;
+            SDL_AtomicLock(&lock);
+            next = last - stolen;
+            end = last;
+            SDL_AtomicUnlock(&lock);
+            return true;
+        }
+    }
+
+    void genviewcells(bool progress = false)
     {
-        pvsworker *w = (pvsworker *)data;
-        SDL_LockMutex(viewcellmutex);
-        while(viewcellrequests.length())
+        int first, last;
+        while(!genpvs_canceled && (takeviewcells(first, last) || (stealviewcells() && takeviewcells(first, last))))
         {
-            viewcellrequest req = viewcellrequests.pop();
-            SDL_UnlockMutex(viewcellmutex);
-            int result = w->genviewcell(req.o, req.size);
-            SDL_LockMutex(viewcellmutex);
-            *req.result = result;
+            for(int i = first; i < last && !genpvs_canceled; i++)
+            {
+                viewcellrequest &req = viewcellrequests[i];
+                deps = req.deps >= 0 ? pvsdeps[req.deps].mask : NULL;
+                *req.result = genviewcell(req.o, req.size);
+                if(progress && check_genpvs_progress) show_genpvs_progress();
+            }
         }
-        SDL_UnlockMutex(viewcellmutex);
+    }
+
+    static int run(void *data)
+    {
+        ((pvsworker *)data)->genviewcells();
         return 0;
     }
 };
@@ -830,29 +953,6 @@ struct viewcellnode
 };
 
 VARP(pvsthreads, 0, 0, 16);
-static vector<pvsworker *> pvsworkers;
-
-static volatile bool check_genpvs_progress = false;
-
-static Uint32 genpvs_timer(Uint32 interval, void *param)
-{
-    check_genpvs_progress = true;
-    return interval;
-}
-
-static int totalviewcells = 0;
-
-static void show_genpvs_progress(int unique = pvs.length(), int processed = numviewcells)
-{
-    float bar1 = float(processed) / float(totalviewcells>0 ? totalviewcells : 1);
-
-    defformatstring(text1, "%d%% - %d of %d view cells (%d unique)", int(bar1 * 100), processed, totalviewcells, unique);
-
-    renderprogress(bar1, text1);
-
-    if(interceptkey(SDLK_ESCAPE)) genpvs_canceled = true;
-    check_genpvs_progress = false;
-}
 
 static shaftbb pvsbounds;
 
@@ -884,29 +984,6 @@ static inline bool isallclip(cube *c)
     return true;
 }
    
-static int countviewcells(cube *c, const ivec &co, int size, int threshold)
-{
-    int count = 0;
-    loopi(8)
-    {
-        ivec o(i, co, size);
-        if(pvsbounds.outside(o, size)) continue;
-        cube &h = c[i];
-        if(h.children)
-        {
-            if(size>threshold)
-            {
-                count += countviewcells(h.children, o, size>>1, threshold);
-                continue;
-            }
-            if(isallclip(h.children)) continue;
-        }
-        else if(isentirelysolid(h) || (h.material&MATF_CLIP)==MAT_CLIP) continue;
-        count++;
-    }
-    return count;
-}
-
 static void genviewcells(viewcellnode &p, cube *c, const ivec &co, int size, int threshold)
 {
     if(genpvs_canceled) return;
@@ -927,19 +1004,16 @@ static void genviewcells(viewcellnode &p, cube *c, const ivec &co, int size, int
             if(isallclip(h.children)) continue;
         }
         else if(isentirelysolid(h) || (h.material&MATF_CLIP)==MAT_CLIP) continue;
-        if(pvsworkers.length())
-        {
-            if(genpvs_canceled) return;
-            p.children[i].pvs = pvsworkers[0]->genviewcell(o, size);
-            if(check_genpvs_progress) show_genpvs_progress();
-        }
-        else
-        {
-            viewcellrequest &req = viewcellrequests.add();
-            req.result = &p.children[i].pvs;
-            req.o = o;
-            req.size = size;
-        }
+        viewcellrequest &req = viewcellrequests.add();
+        req.result = &p.children[i].pvs;
+        req.o = o;
+        req.size = size;
+        req.deps = pvsdeps.length();
+        viewcelldeps &d = pvsdeps.add();
+        d.o = o;
+        d.size = size;
+        d.pvs = -1;
+        memset(d.mask, 0, sizeof(d.mask));
     }
 }
 
@@ -1011,6 +1085,9 @@ void clearpvs()
     DELETEP(viewcells);
     pvs.setsize(0);
     pvsbuf.setsize(0);
+    pvsdeps.setsize(0);
+    pvsdirty.setsize(0);
+    pvsviewcellsize = 0;
     curpvs = NULL;
     numwaterplanes = 0;
     lockpvs = 0;
@@ -1019,9 +1096,13 @@ void clearpvs()
 
 COMMAND(clearpvs, "");
 
+static ivec pvswatermin, pvswatermax;
+
 static void findwaterplanes()
 {
     extern vector<vtxarray *> valist;
+    pvswatermin = ivec(worldsize, worldsize, worldsize);
+    pvswatermax = ivec(0, 0, 0);
     loopi(MAXWATERPVS)
     {
         waterplanes[i].height = -1;
@@ -1036,6 +1117,12 @@ static void findwaterplanes()
         {
             materialsurface &m = va->matbuf[j];
             if((m.material&MATF_VOLUME)!=MAT_WATER || m.orient==O_BOTTOM) { j += m.skip; continue; }
+            int dim = dimension(m.orient);
+            ivec mmax(m.o);
+            mmax[R[dim]] += m.rsize;
+            mmax[C[dim]] += m.csize;
+            pvswatermin.min(ivec(m.o).sub(2));
+            pvswatermax.max(mmax.add(2));
             if(m.orient!=O_TOP)
             {
                 waterfalls.add(&m);
@@ -1065,6 +1152,7 @@ void testpvs(int *vcsize)
     uint oldnumwaterplanes = numwaterplanes;
     int oldwaterplanes[MAXWATERPVS];
     loopi(numwaterplanes) oldwaterplanes[i] = waterplanes[i].height;
+    ivec oldwatermin = pvswatermin, oldwatermax = pvswatermax;
 
     findwaterplanes();
 
@@ -1091,27 +1179,148 @@ void testpvs(int *vcsize)
     origpvsnodes.setsize(0);
     numwaterplanes = oldnumwaterplanes;
     loopi(numwaterplanes) waterplanes[i].height = oldwaterplanes[i];
+    pvswatermin = oldwatermin;
+    pvswatermax = oldwatermax;
 }
 
 COMMAND(testpvs, "i");
 
-void genpvs(int *viewcellsize)
+/// works through viewcellrequests with numthreads workers, each starting on an equal share of them.
+static void runpvsworkers(int numthreads, bool headless)
 {
-    if(worldsize > 1<<15)
+    numthreads = clamp(numthreads, 1, max(viewcellrequests.length(), 1));
+    loopi(numthreads)
     {
-        conoutf(CON_ERROR, "map is too large for PVS");
+        pvsworker *w = pvsworkers.add(new pvsworker);
+        w->next = i*viewcellrequests.length()/numthreads;
+        w->end = (i+1)*viewcellrequests.length()/numthreads;
+    }
+    if(numthreads<=1)
+    {
+        SDL_TimerID timer = headless ? 0 : SDL_AddTimer(500, genpvs_timer, NULL);
+        pvsworkers[0]->genviewcells(!headless);
+        if(timer) SDL_RemoveTimer(timer);
         return;
     }
+    if(!headless) renderprogress(0, "creating threads");
+    if(!pvsmutex) pvsmutex = SDL_CreateMutex();
+    int numcreated = 0;
+    loopv(pvsworkers)
+    {
+        pvsworker *w = pvsworkers[i];
+        w->thread = SDL_CreateThread(pvsworker::run, "pvs worker", w);
+        if(w->thread) numcreated++;
+    }
+    if(!numcreated) pvsworkers[0]->genviewcells(!headless);
+    else if(!headless)
+    {
+        show_genpvs_progress(0, 0);
+        while(!genpvs_canceled)
+        {
+            SDL_Delay(500);
+            SDL_LockMutex(pvsmutex);
+            int unique = pvs.length(), processed = numviewcells;
+            SDL_UnlockMutex(pvsmutex);
+            show_genpvs_progress(unique, processed);
+            if(processed >= viewcellrequests.length()) break;
+        }
+    }
+    loopv(pvsworkers) if(pvsworkers[i]->thread) SDL_WaitThread(pvsworkers[i]->thread, NULL);
+}
+
+/// records an edited region, so updatepvs knows which view cells to redo.
+void invalidatepvs(const ivec &bbmin, const ivec &bbmax)
+{
+    if(!viewcells || pvsdeps.empty()) return;
+    if(pvsdirty.length() >= 256)
+    {
+        pvsregion &r = pvsdirty[0];
+        loopv(pvsdirty) { r.bbmin.min(pvsdirty[i].bbmin); r.bbmax.max(pvsdirty[i].bbmax); }
+        pvsdirty.setsize(1);
+    }
+    pvsregion &r = pvsdirty.add();
+    r.bbmin = bbmin;
+    r.bbmax = bbmax;
+}
 
-    renderbackground("generating PVS (esc to abort)");
-    genpvs_canceled = false;
-    Uint32 start = SDL_GetTicks();
+static bool pvsdirtybox(const ivec &bbmin, const ivec &bbmax)
+{
+    loopv(pvsdirty)
+    {
+        const pvsregion &r = pvsdirty[i];
+        if(bbmin.x < r.bbmax.x && bbmin.y < r.bbmax.y && bbmin.z < r.bbmax.z &&
+           bbmax.x > r.bbmin.x && bbmax.y > r.bbmin.y && bbmax.z > r.bbmin.z)
+            return true;
+    }
+    return false;
+}
 
-    renderprogress(0, "finding view cells");
+static void compactviewcells(viewcellnode &p, vector<int> &remap, vector<pvsdata> &used, vector<uchar> &buf)
+{
+    loopi(8)
+    {
+        if(!(p.leafmask&(1<<i))) { compactviewcells(*p.children[i].node, remap, used, buf); continue; }
+        int &index = p.children[i].pvs;
+        if(index < 0) continue;
+        if(remap[index] < 0)
+        {
+            remap[index] = used.length();
+            used.add(pvsdata(buf.length(), pvs[index].len));
+            buf.put(&pvsbuf[pvs[index].offset], pvs[index].len);
+        }
+        index = remap[index];
+    }
+}
+
+/// drops the pvs data no view cell refers to anymore after an update.
+static void compactpvs()
+{
+    vector<int> remap;
+    loopv(pvs) remap.add(-1);
+    vector<pvsdata> used;
+    vector<uchar> buf;
+    compactviewcells(*viewcells, remap, used, buf);
+    loopv(pvsdeps) if(pvsdeps[i].pvs >= 0) pvsdeps[i].pvs = remap[pvsdeps[i].pvs];
+    pvs.setsize(0);
+    pvs.move(used);
+    pvsbuf.setsize(0);
+    pvsbuf.move(buf);
+}
+
+/// generates the pvs of all view cells, or with update only of those depending on regions edited since the last one.
+/// returns the number of view cells kept from the last pvs.
+static int buildpvs(int viewcellsize, int numthreads, bool headless, bool update = false)
+{
+    update = update && viewcells && pvsdeps.length() && viewcellsize == pvsviewcellsize;
+    uint oldnumwaterplanes = numwaterplanes;
+    int oldwaterplanes[MAXWATERPVS];
+    loopi(numwaterplanes) oldwaterplanes[i] = waterplanes[i].height;
+    ivec oldwatermin = pvswatermin, oldwatermax = pvswatermax;
 
-    clearpvs();
+    if(!update) clearpvs();
     calcpvsbounds();
     findwaterplanes();
+    if(update)
+    {
+        // water occlusion is computed for whole planes, so edits near water redo everything
+        bool samewater = numwaterplanes == oldnumwaterplanes && !pvsdirtybox(oldwatermin, oldwatermax) && !pvsdirtybox(pvswatermin, pvswatermax);
+        loopi(numwaterplanes) if(waterplanes[i].height != oldwaterplanes[i]) samewater = false;
+        if(!samewater)
+        {
+            update = false;
+            clearpvs();
+            findwaterplanes();
+        }
+    }
+
+    vector<viewcelldeps> olddeps;
+    if(update)
+    {
+        olddeps.move(pvsdeps);
+        DELETEP(viewcells);
+        curpvs = NULL;
+        loopv(pvs) pvscompress[pvs[i]] = i;
+    }
 
     pvsnode &root = origpvsnodes.add();
     memset(root.edges.v, 0xFF, 3);
@@ -1119,52 +1328,72 @@ void genpvs(int *viewcellsize)
     root.children = 0;
     genpvsnodes(worldroot);
 
-    totalviewcells = countviewcells(worldroot, ivec(0, 0, 0), worldsize>>1, *viewcellsize>0 ? *viewcellsize : 32);
     numviewcells = 0;
     genpvs_canceled = false;
     check_genpvs_progress = false;
-    SDL_TimerID timer = 0;
-    int numthreads = pvsthreads > 0 ? pvsthreads : numcpus;
-    if(numthreads<=1) 
-    {
-        pvsworkers.add(new pvsworker);
-        timer = SDL_AddTimer(500, genpvs_timer, NULL);
-    }
     viewcells = new viewcellnode;
-    genviewcells(*viewcells, worldroot, ivec(0, 0, 0), worldsize>>1, *viewcellsize>0 ? *viewcellsize : 32);
-    if(numthreads<=1)
-    {
-        SDL_RemoveTimer(timer);
-    }
-    else
+    genviewcells(*viewcells, worldroot, ivec(0, 0, 0), worldsize>>1, viewcellsize);
+
+    int kept = 0;
+    if(update)
     {
-        renderprogress(0, "creating threads");
-        if(!pvsmutex) pvsmutex = SDL_CreateMutex();
-        if(!viewcellmutex) viewcellmutex = SDL_CreateMutex();
-        loopi(numthreads)
+        hashtable<ivec4, int> oldcells;
+        loopv(olddeps) oldcells[ivec4(olddeps[i].o, olddeps[i].size)] = i;
+        uint dirty[PVSDEPWORDS];
+        memset(dirty, 0, sizeof(dirty));
+        loopv(pvsdirty) markpvsdeps(dirty, pvsdirty[i].bbmin, pvsdirty[i].bbmax);
+        int remaining = 0;
+        loopv(viewcellrequests)
         {
-            pvsworker *w = pvsworkers.add(new pvsworker);
-            w->thread = SDL_CreateThread(pvsworker::run, "pvs worker", w);
+            viewcellrequest &req = viewcellrequests[i];
+            int *old = oldcells.access(ivec4(req.o, req.size));
+            if(old && !pvsdirtybox(req.o, ivec(req.o).add(req.size)))
+            {
+                viewcelldeps &d = olddeps[*old];
+                bool affected = false;
+                loopj(PVSDEPWORDS) if(d.mask[j]&dirty[j]) { affected = true; break; }
+                if(!affected && d.pvs >= 0)
+                {
+                    memcpy(pvsdeps[req.deps].mask, d.mask, sizeof(d.mask));
+                    *req.result = pvsdeps[req.deps].pvs = d.pvs;
+                    kept++;
+                    continue;
+                }
+            }
+            viewcellrequests[remaining++] = req;
         }
-        show_genpvs_progress(0, 0);
-        while(!genpvs_canceled)
-        {
-            SDL_Delay(500);
-            SDL_LockMutex(viewcellmutex);
-            int unique = pvs.length(), processed = numviewcells, remaining = viewcellrequests.length();
-            SDL_UnlockMutex(viewcellmutex);
-            show_genpvs_progress(unique, processed);
-            if(!remaining) break;
-        }        
-        SDL_LockMutex(viewcellmutex);
-        viewcellrequests.setsize(0);
-        SDL_UnlockMutex(viewcellmutex);
-        loopv(pvsworkers) SDL_WaitThread(pvsworkers[i]->thread, NULL);
+        viewcellrequests.setsize(remaining);
     }
+    totalviewcells = viewcellrequests.length();
+
+    runpvsworkers(numthreads, headless);
+    loopv(viewcellrequests) pvsdeps[viewcellrequests[i].deps].pvs = *viewcellrequests[i].result;
+    viewcellrequests.setsize(0);
     pvsworkers.deletecontents();
 
     origpvsnodes.setsize(0);
     pvscompress.clear();
+    if(update) compactpvs();
+    pvsdirty.setsize(0);
+    pvsviewcellsize = viewcellsize;
+    return kept;
+}
+
+void genpvs(int *viewcellsize)
+{
+    if(worldsize > 1<<15)
+    {
+        conoutf(CON_ERROR, "map is too large for PVS");
+        return;
+    }
+
+    renderbackground("generating PVS (esc to abort)");
+    genpvs_canceled = false;
+    Uint32 start = SDL_GetTicks();
+
+    renderprogress(0, "finding view cells");
+
+    buildpvs(*viewcellsize>0 ? *viewcellsize : 32, pvsthreads > 0 ? pvsthreads : numcpus, false);
 
     Uint32 end = SDL_GetTicks();
     if(genpvs_canceled) 
@@ -1178,6 +1407,102 @@ void genpvs(int *viewcellsize)
 
 COMMAND(genpvs, "i");
 
+/// redoes only the view cells whose visibility could have changed by edits since the last genpvs or updatepvs.
+void updatepvs()
+{
+    if(!viewcells) { conoutf(CON_ERROR, "no PVS to update, use genpvs"); return; }
+    if(worldsize > 1<<15) return;
+
+    commitchanges(true);
+    renderbackground("updating PVS (esc to abort)");
+    Uint32 start = SDL_GetTicks();
+    renderprogress(0, "finding view cells");
+
+    int size = pvsviewcellsize > 0 ? pvsviewcellsize : 32, kept = buildpvs(size, pvsthreads > 0 ? pvsthreads : numcpus, false, true);
+
+    Uint32 end = SDL_GetTicks();
+    if(genpvs_canceled)
+    {
+        clearpvs();
+        conoutf("updatepvs aborted");
+    }
+    else conoutf("updated %d of %d view cells, %d unique totaling %.1f kB (%.1f seconds)",
+            numviewcells, numviewcells + kept, pvs.length(), pvsbuf.length()/1024.0f, (end - start) / 1000.0f);
+}
+
+COMMAND(updatepvs, "");
+
+/// everything buildpvs replaces, so the pvs of the map can be put back after generating a throwaway one.
+struct savedpvs
+{
+    viewcellnode *viewcells;
+    vector<pvsdata> pvs;
+    vector<uchar> pvsbuf;
+    vector<viewcelldeps> deps;
+    vector<pvsregion> dirty;
+    int viewcellsize;
+    uint numwaterplanes;
+    int waterheights[MAXWATERPVS];
+    ivec watermin, watermax;
+
+    void save()
+    {
+        lockpvs = 0;
+        lockpvs_(false);
+        viewcells = ::viewcells;
+        ::viewcells = NULL;
+        curpvs = NULL;
+        pvs.move(::pvs);
+        pvsbuf.move(::pvsbuf);
+        deps.move(pvsdeps);
+        dirty.move(pvsdirty);
+        viewcellsize = pvsviewcellsize;
+        numwaterplanes = ::numwaterplanes;
+        loopi(numwaterplanes) waterheights[i] = waterplanes[i].height;
+        watermin = pvswatermin;
+        watermax = pvswatermax;
+    }
+
+    void restore()
+    {
+        clearpvs();
+        ::viewcells = viewcells;
+        ::pvs.move(pvs);
+        ::pvsbuf.move(pvsbuf);
+        pvsdeps.move(deps);
+        pvsdirty.move(dirty);
+        pvsviewcellsize = viewcellsize;
+        ::numwaterplanes = numwaterplanes;
+        loopi(numwaterplanes) waterplanes[i].height = waterheights[i];
+        pvswatermin = watermin;
+        pvswatermax = watermax;
+    }
+};
+
+/// Times genpvs of the current map with 1, 2, 4... up to maxthreads workers (one per cpu by default), without showing progress.
+/// The pvs of the map is kept aside meanwhile and restored afterwards.
+void pvsbench(int *viewcellsize, int *maxthreads)
+{
+    if(worldsize > 1<<15)
+    {
+        conoutf(CON_ERROR, "map is too large for PVS");
+        return;
+    }
+    savedpvs saved;
+    saved.save();
+    int size = *viewcellsize>0 ? *viewcellsize : 32, most = *maxthreads>0 ? *maxthreads : numcpus;
+    for(int threads = 1;; threads = min(threads*2, most))
+    {
+        benchclock::time_point start = benchclock::now();
+        buildpvs(size, threads, true);
+        int us = max(benchmicros(start, benchclock::now()), 1);
+        conoutf("genpvs: %d threads %d view cells %d us (%.0f view cells/s, %d unique)", threads, numviewcells, us, numviewcells*1e6f/us, pvs.length());
+        if(threads >= most) break;
+    }
+    saved.restore();
+}
+COMMAND(pvsbench, "ii");
+
 void pvsstats()
 {
     conoutf("%d unique view cells totaling %.1f kB and averaging %d B",          
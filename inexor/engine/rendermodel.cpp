@@ -355,7 +355,7 @@ ICOMMAND(nummapmodels, "", (), { intret(mapmodels.length()); });
 
 // model registry
 
-hashnameset<model *> models;
+openhashnameset<model *> models;
 vector<const char *> preloadmodels;
 
 void preloadmodel(const char *name)
@@ -390,6 +390,7 @@ void preloadusedmapmodels(bool msg, bool bih)
         if(e.type==ET_MAPMODEL && e.attr2 >= 0 && mapmodels.find(e.attr2) < 0) mapmodels.add(e.attr2);
     }
 
+    vector<model *> bihmodels;
     loopv(mapmodels)
     {
         loadprogress = float(i+1)/mapmodels.length();
@@ -399,11 +400,16 @@ void preloadusedmapmodels(bool msg, bool bih)
         else if(mmi->name[0] && !loadmodel(NULL, mmindex, msg)) { if(msg) conoutf(CON_WARN, "could not load model: %s", mmi->name); }
         else if(mmi->m)
         {
-            if(bih) mmi->m->preloadBIH();
+            if(bih && bihmodels.find(mmi->m) < 0) bihmodels.add(mmi->m);
             mmi->m->preloadmeshes();
         }
     }
     loadprogress = 0;
+
+    // building the trees only reads the loaded meshes, so do it across all cpus,
+    // preloadBIH() afterwards just loads the alpha masks which have to stay on this thread.
+    parallelfor(bihmodels.length(), [&](int i) { if(!bihmodels[i]->bih) bihmodels[i]->setBIH(); });
+    loopv(bihmodels) bihmodels[i]->preloadBIH();
 }
 
 model *loadmodel(const char *name, int i, bool msg)
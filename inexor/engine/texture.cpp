@@ -694,7 +694,7 @@ void createcompressedtexture(int tnum, int w, int h, uchar *data, int align, int
     uploadcompressedtexture(target, subtarget, format, w, h, data, align, blocksize, levels, filter > 1); 
 }
 
-hashnameset<Texture> textures;
+openhashnameset<Texture> textures;
 
 Texture *notexture = NULL; // used as default, ensured to be loaded
 
@@ -0,0 +1,97 @@
+/// worker threads which split up work done in one go (like decoding a map) across all cpus.
+
+#include "inexor/engine/engine.h"
+
+/// number of threads taking part in parallelfor, 0 uses one per cpu.
+VARP(workerthreads, 0, 0, 16);
+
+struct workerjob
+{
+    void (*fn)(void *, int);
+    void *data;
+    int num;
+    SDL_atomic_t next;
+};
+
+static vector<SDL_Thread *> workers;
+static SDL_mutex *workermutex = NULL;
+static SDL_cond *workercond = NULL, *idlecond = NULL;
+static workerjob *curjob = NULL;
+static int jobid = 0, activeworkers = 0;
+
+static void runjob(workerjob &j)
+{
+    for(;;)
+    {
+        int i = SDL_AtomicAdd(&j.next, 1);
+        if(i >= j.num) break;
+        j.fn(j.data, i);
+    }
+}
+
+static int workerthread(void *)
+{
+    int lastjob = 0;
+    SDL_LockMutex(workermutex);
+    for(;;)
+    {
+        while(!curjob || lastjob == jobid) SDL_CondWait(workercond, workermutex);
+        workerjob *j = curjob;
+        lastjob = jobid;
+        activeworkers++;
+        SDL_UnlockMutex(workermutex);
+
+        runjob(*j);
+
+        SDL_LockMutex(workermutex);
+        if(!--activeworkers) SDL_CondSignal(idlecond);
+    }
+    return 0;
+}
+
+/// runs fn(data, i) for all i in [0, num) on the worker threads and the calling one, returns once all are done.
+/// fn may be called in any order and from any thread, so it must not touch anything GL or SDL video related.
+/// nested or concurrent calls simply run on the calling thread.
+void parallelfor(int num, void (*fn)(void *, int), void *data)
+{
+    int numthreads = min(workerthreads > 0 ? int(workerthreads) : int(numcpus), num);
+    if(numthreads > 1)
+    {
+        if(!workermutex)
+        {
+            workermutex = SDL_CreateMutex();
+            workercond = SDL_CreateCond();
+            idlecond = SDL_CreateCond();
+        }
+        SDL_LockMutex(workermutex);
+        if(curjob) numthreads = 1;
+        else while(workers.length() < numthreads-1)
+        {
+            SDL_Thread *t = SDL_CreateThread(workerthread, "worker", NULL);
+            if(!t) break;
+            workers.add(t);
+        }
+        if(numthreads > 1 && workers.length())
+        {
+            workerjob j;
+            j.fn = fn;
+            j.data = data;
+            j.num = num;
+            SDL_AtomicSet(&j.next, 0);
+            curjob = &j;
+            jobid++;
+            SDL_CondBroadcast(workercond);
+            SDL_UnlockMutex(workermutex);
+
+            runjob(j);
+
+            SDL_LockMutex(workermutex);
+            curjob = NULL;
+            while(activeworkers) SDL_CondWait(idlecond, workermutex);
+            SDL_UnlockMutex(workermutex);
+            return;
+        }
+        SDL_UnlockMutex(workermutex);
+    }
+    loopi(num) fn(data, i);
+}
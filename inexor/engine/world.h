@@ -6,7 +6,8 @@
 // 
 
 // bump if map format changes, see worldio.cpp last sauerbraten-one was 33
-#define MAPVERSION 40
+#define MAPVERSION 41
+#define MAPVERSION_CHUNKED 41 // first version with an octree split into separately compressed chunks
 
 // constant macros to describe visual appearance of game world
 #define WATER_AMPLITUDE 0.4f
@@ -246,178 +246,188 @@ enum
 
 static int savemapprogress = 0;
 
+/// forward function "savec"
+void savec(cube *c, const ivec &o, int size, stream *f, bool nolms);
 
-/// save OCTREE (and its children) to stream (file)
-/// this file calls itself (recursion) because of the OCTREE's structure
-/// @param c the cube (or child of a parent's cube) which contains the OCTREE data
-/// @param o a reference to an integer vector [mathematic vector]
-/// @param size the size of the stream
+/// save a single cube (and its children) to stream (file)
+/// @param c the cube which contains the OCTREE data
+/// @param co the position of the cube
+/// @param size the size of the cube
 /// @param f the stream to which data will be written
 /// @param nolms save without lightmaps
-/// @see 
-void savec(cube *c, const ivec &o, int size, stream *f, bool nolms)
+/// @see savec
+void savecube(cube &c, const ivec &co, int size, stream *f, bool nolms)
 {
-    /// render progress bar in the background
-    if((savemapprogress++&0xFFF)==0) renderprogress(float(savemapprogress)/allocnodes, "saving octree...");
-
-    loopi(8)
+    if(c.children)
     {
-        ivec co(i, o, size);
-        if(c[i].children)
-        {
-            f->putchar(OCTSAV_CHILDREN);
-            /// save children (recursion!)
-            savec(c[i].children, co, size>>1, f, nolms);
-        }
+        f->putchar(OCTSAV_CHILDREN);
+        /// save children (recursion!)
+        savec(c.children, co, size>>1, f, nolms);
+    }
+    else
+    {
+        int oflags = 0, surfmask = 0, totalverts = 0;
+        if(c.material!=MAT_AIR) oflags |= 0x40;
+        if(isempty(c)) f->putchar(oflags | OCTSAV_EMPTY);
         else
         {
-            int oflags = 0, surfmask = 0, totalverts = 0;
-            if(c[i].material!=MAT_AIR) oflags |= 0x40;
-            if(isempty(c[i])) f->putchar(oflags | OCTSAV_EMPTY);
-            else
+            /// lightmaps will be saved
+            if(!nolms)
             {
-                /// lightmaps will be saved
-                if(!nolms)
+                if(c.merged) oflags |= 0x80;
+                if(c.ext) loopj(6) 
                 {
-                    if(c[i].merged) oflags |= 0x80;
-                    if(c[i].ext) loopj(6) 
-                    {
-                        const surfaceinfo &surf = c[i].ext->surfaces[j];
-                        if(!surf.used()) continue;
-                        oflags |= 0x20; 
-                        surfmask |= 1<<j; 
-                        totalverts += surf.totalverts(); 
-                    }
+                    const surfaceinfo &surf = c.ext->surfaces[j];
+                    if(!surf.used()) continue;
+                    oflags |= 0x20; 
+                    surfmask |= 1<<j; 
+                    totalverts += surf.totalverts(); 
                 }
+            }
 
-                if(isentirelysolid(c[i])) f->putchar(oflags | OCTSAV_SOLID);
-                else
-                {
-                    f->putchar(oflags | OCTSAV_NORMAL);
-                    f->write(c[i].edges, 12);
-                }
+            if(isentirelysolid(c)) f->putchar(oflags | OCTSAV_SOLID);
+            else
+            {
+                f->putchar(oflags | OCTSAV_NORMAL);
+                f->write(c.edges, 12);
             }
-            /// texture coordinates
-            loopj(6) f->putlil<ushort>(c[i].texture[j]);
+        }
+        /// texture coordinates
+        loopj(6) f->putlil<ushort>(c.texture[j]);
 
-            /// material type
-            if(oflags&0x40) f->putlil<ushort>(c[i].material);
-            if(oflags&0x80) f->putchar(c[i].merged);
-            if(oflags&0x20) 
+        /// material type
+        if(oflags&0x40) f->putlil<ushort>(c.material);
+        if(oflags&0x80) f->putchar(c.merged);
+        if(oflags&0x20) 
+        {
+            f->putchar(surfmask);
+            f->putchar(totalverts);
+            loopj(6) if(surfmask&(1<<j))
             {
-                f->putchar(surfmask);
-                f->putchar(totalverts);
-                loopj(6) if(surfmask&(1<<j))
+                surfaceinfo surf = c.ext->surfaces[j];
+                vertinfo *verts = c.ext->verts() + surf.verts;
+                int layerverts = surf.numverts&MAXFACEVERTS, numverts = surf.totalverts(), 
+                    vertmask = 0, vertorder = 0, uvorder = 0,
+                    dim = dimension(j), vc = C[dim], vr = R[dim];
+                if(numverts)
                 {
-                    surfaceinfo surf = c[i].ext->surfaces[j];
-                    vertinfo *verts = c[i].ext->verts() + surf.verts;
-                    int layerverts = surf.numverts&MAXFACEVERTS, numverts = surf.totalverts(), 
-                        vertmask = 0, vertorder = 0, uvorder = 0,
-                        dim = dimension(j), vc = C[dim], vr = R[dim];
-                    if(numverts)
+                    if(c.merged&(1<<j)) 
                     {
-                        if(c[i].merged&(1<<j)) 
+                        vertmask |= 0x04;
+                        if(layerverts == 4)
                         {
-                            vertmask |= 0x04;
-                            if(layerverts == 4)
+                            ivec v[4] = { verts[0].getxyz(), verts[1].getxyz(), verts[2].getxyz(), verts[3].getxyz() };
+                            loopk(4) 
                             {
-                                ivec v[4] = { verts[0].getxyz(), verts[1].getxyz(), verts[2].getxyz(), verts[3].getxyz() };
-                                loopk(4) 
+                                const ivec &v0 = v[k], &v1 = v[(k+1)&3], &v2 = v[(k+2)&3], &v3 = v[(k+3)&3];
+                                if(v1[vc] == v0[vc] && v1[vr] == v2[vr] && v3[vc] == v2[vc] && v3[vr] == v0[vr])
                                 {
-                                    const ivec &v0 = v[k], &v1 = v[(k+1)&3], &v2 = v[(k+2)&3], &v3 = v[(k+3)&3];
-                                    if(v1[vc] == v0[vc] && v1[vr] == v2[vr] && v3[vc] == v2[vc] && v3[vr] == v0[vr])
-                                    {
-                                        vertmask |= 0x01;
-                                        vertorder = k;
-                                        break;
-                                    }
+                                    vertmask |= 0x01;
+                                    vertorder = k;
+                                    break;
                                 }
                             }
                         }
-                        else
-                        {
-                            int vis = visibletris(c[i], j, co, size);
-                            if(vis&4 || faceconvexity(c[i], j) < 0) vertmask |= 0x01;
-                            if(layerverts < 4 && vis&2) vertmask |= 0x02; 
-                        }
-                        bool matchnorm = true;
-                        loopk(numverts) 
-                        { 
-                            const vertinfo &v = verts[k]; 
-                            if(v.u || v.v) vertmask |= 0x40; 
-                            if(v.norm) { vertmask |= 0x80; if(v.norm != verts[0].norm) matchnorm = false; }
-                        }
-                        if(matchnorm) vertmask |= 0x08;
-                        if(vertmask&0x40 && layerverts == 4)
+                    }
+                    else
+                    {
+                        int vis = visibletris(c, j, co, size);
+                        if(vis&4 || faceconvexity(c, j) < 0) vertmask |= 0x01;
+                        if(layerverts < 4 && vis&2) vertmask |= 0x02; 
+                    }
+                    bool matchnorm = true;
+                    loopk(numverts) 
+                    { 
+                        const vertinfo &v = verts[k]; 
+                        if(v.u || v.v) vertmask |= 0x40; 
+                        if(v.norm) { vertmask |= 0x80; if(v.norm != verts[0].norm) matchnorm = false; }
+                    }
+                    if(matchnorm) vertmask |= 0x08;
+                    if(vertmask&0x40 && layerverts == 4)
+                    {
+                        loopk(4)
                         {
-                            loopk(4)
+                            const vertinfo &v0 = verts[k], &v1 = verts[(k+1)&3], &v2 = verts[(k+2)&3], &v3 = verts[(k+3)&3];
+                            if(v1.u == v0.u && v1.v == v2.v && v3.u == v2.u && v3.v == v0.v)
                             {
-                                const vertinfo &v0 = verts[k], &v1 = verts[(k+1)&3], &v2 = verts[(k+2)&3], &v3 = verts[(k+3)&3];
-                                if(v1.u == v0.u && v1.v == v2.v && v3.u == v2.u && v3.v == v0.v)
+                                if(surf.numverts&LAYER_DUP)
                                 {
-                                    if(surf.numverts&LAYER_DUP)
-                                    {
-                                        const vertinfo &b0 = verts[4+k], &b1 = verts[4+((k+1)&3)], &b2 = verts[4+((k+2)&3)], &b3 = verts[4+((k+3)&3)];
-                                        if(b1.u != b0.u || b1.v != b2.v || b3.u != b2.u || b3.v != b0.v)
-                                            continue;
-                                    }
-                                    uvorder = k;
-                                    vertmask |= 0x02 | (((k+4-vertorder)&3)<<4);
-                                    break;
+                                    const vertinfo &b0 = verts[4+k], &b1 = verts[4+((k+1)&3)], &b2 = verts[4+((k+2)&3)], &b3 = verts[4+((k+3)&3)];
+                                    if(b1.u != b0.u || b1.v != b2.v || b3.u != b2.u || b3.v != b0.v)
+                                        continue;
                                 }
-                            } 
-                        }
+                                uvorder = k;
+                                vertmask |= 0x02 | (((k+4-vertorder)&3)<<4);
+                                break;
+                            }
+                        } 
                     }
-                    surf.verts = vertmask;
-                    /// surface information
-                    f->write(&surf, sizeof(surfaceinfo));
-                    bool hasxyz = (vertmask&0x04)!=0, hasuv = (vertmask&0x40)!=0, hasnorm = (vertmask&0x80)!=0;
-                    if(layerverts == 4)
+                }
+                surf.verts = vertmask;
+                /// surface information
+                f->write(&surf, sizeof(surfaceinfo));
+                bool hasxyz = (vertmask&0x04)!=0, hasuv = (vertmask&0x40)!=0, hasnorm = (vertmask&0x80)!=0;
+                if(layerverts == 4)
+                {
+                    if(hasxyz && vertmask&0x01)
                     {
-                        if(hasxyz && vertmask&0x01)
-                        {
-                            ivec v0 = verts[vertorder].getxyz(), v2 = verts[(vertorder+2)&3].getxyz();
-                            f->putlil<ushort>(v0[vc]); f->putlil<ushort>(v0[vr]);
-                            f->putlil<ushort>(v2[vc]); f->putlil<ushort>(v2[vr]);
-                            hasxyz = false;
-                        }
-                        if(hasuv && vertmask&0x02)
-                        {
-                            const vertinfo &v0 = verts[uvorder], &v2 = verts[(uvorder+2)&3];
-                            f->putlil<ushort>(v0.u); f->putlil<ushort>(v0.v);
-                            f->putlil<ushort>(v2.u); f->putlil<ushort>(v2.v);
-                            if(surf.numverts&LAYER_DUP)
-                            {
-                                const vertinfo &b0 = verts[4+uvorder], &b2 = verts[4+((uvorder+2)&3)];
-                                f->putlil<ushort>(b0.u); f->putlil<ushort>(b0.v);
-                                f->putlil<ushort>(b2.u); f->putlil<ushort>(b2.v);
-                            }
-                            hasuv = false;
-                        }
+                        ivec v0 = verts[vertorder].getxyz(), v2 = verts[(vertorder+2)&3].getxyz();
+                        f->putlil<ushort>(v0[vc]); f->putlil<ushort>(v0[vr]);
+                        f->putlil<ushort>(v2[vc]); f->putlil<ushort>(v2[vr]);
+                        hasxyz = false;
                     }
-                    if(hasnorm && vertmask&0x08) { f->putlil<ushort>(verts[0].norm); hasnorm = false; }
-                    if(hasxyz || hasuv || hasnorm) loopk(layerverts)
+                    if(hasuv && vertmask&0x02)
                     {
-                        const vertinfo &v = verts[(k+vertorder)%layerverts];
-                        if(hasxyz) 
+                        const vertinfo &v0 = verts[uvorder], &v2 = verts[(uvorder+2)&3];
+                        f->putlil<ushort>(v0.u); f->putlil<ushort>(v0.v);
+                        f->putlil<ushort>(v2.u); f->putlil<ushort>(v2.v);
+                        if(surf.numverts&LAYER_DUP)
                         {
-                            ivec xyz = v.getxyz(); 
-                            f->putlil<ushort>(xyz[vc]); f->putlil<ushort>(xyz[vr]); 
+                            const vertinfo &b0 = verts[4+uvorder], &b2 = verts[4+((uvorder+2)&3)];
+                            f->putlil<ushort>(b0.u); f->putlil<ushort>(b0.v);
+                            f->putlil<ushort>(b2.u); f->putlil<ushort>(b2.v);
                         }
-                        if(hasuv) { f->putlil<ushort>(v.u); f->putlil<ushort>(v.v); }
-                        if(hasnorm) f->putlil<ushort>(v.norm); 
+                        hasuv = false;
                     }
-                    if(surf.numverts&LAYER_DUP) loopk(layerverts)
+                }
+                if(hasnorm && vertmask&0x08) { f->putlil<ushort>(verts[0].norm); hasnorm = false; }
+                if(hasxyz || hasuv || hasnorm) loopk(layerverts)
+                {
+                    const vertinfo &v = verts[(k+vertorder)%layerverts];
+                    if(hasxyz) 
                     {
-                        const vertinfo &v = verts[layerverts + (k+vertorder)%layerverts];
-                        if(hasuv) { f->putlil<ushort>(v.u); f->putlil<ushort>(v.v); }
+                        ivec xyz = v.getxyz(); 
+                        f->putlil<ushort>(xyz[vc]); f->putlil<ushort>(xyz[vr]); 
                     }
+                    if(hasuv) { f->putlil<ushort>(v.u); f->putlil<ushort>(v.v); }
+                    if(hasnorm) f->putlil<ushort>(v.norm); 
+                }
+                if(surf.numverts&LAYER_DUP) loopk(layerverts)
+                {
+                    const vertinfo &v = verts[layerverts + (k+vertorder)%layerverts];
+                    if(hasuv) { f->putlil<ushort>(v.u); f->putlil<ushort>(v.v); }
                 }
             }
         }
     }
 }
 
+/// save OCTREE (and its children) to stream (file)
+/// this file calls itself (recursion) because of the OCTREE's structure
+/// @param c the cube (or child of a parent's cube) which contains the OCTREE data
+/// @param o a reference to an integer vector [mathematic vector]
+/// @param size the size of the stream
+/// @param f the stream to which data will be written
+/// @param nolms save without lightmaps
+/// @see 
+void savec(cube *c, const ivec &o, int size, stream *f, bool nolms)
+{
+    /// render progress bar in the background
+    if((savemapprogress++&0xFFF)==0) renderprogress(float(savemapprogress)/allocnodes, "saving octree...");
+
+    loopi(8) savecube(c[i], ivec(i, o, size), size, f, nolms);
+}
+
 
 /// surface description
 struct surfacecompat
@@ -832,6 +842,148 @@ cube *loadchildren(stream *f, const ivec &co, int size, bool &failed)
 
 
 
+/// chunked octree format (MAPVERSION_CHUNKED and newer):
+/// the octree is split into the subtrees at depth MAPCHUNKDEPTH (or shallower where the tree ends earlier).
+/// each of them, each lightmap, the pvs and the blendmap are compressed separately,
+/// so they can be compressed and decoded on all cpus at once. loadc/loadchildren stay the legacy path.
+/// the gzip stream around such maps only stores its data (Z_NO_COMPRESSION), deflating the chunks a second time
+/// on one thread would take longer than compressing them did, and loading them would need one serial inflate again.
+#define MAPCHUNKDEPTH 2
+/// upper bound of the uncompressed size of a single chunk, larger ones in a map file are rejected as garbage.
+#define MAXMAPCHUNKSIZE (1<<28)
+
+/// whether maps are saved chunked (a legacy map format (40) loads in older clients).
+VARP(savemapchunked, 0, 1, 1);
+
+/// a separately compressed part of a chunked map (an octree subtree, a lightmap, the pvs or the blendmap)
+struct mapchunk
+{
+    memstream raw;      ///< uncompressed data, unless external is set
+    uchar *external;    ///< uncompressed data owned by somebody else (e.g. a lightmap)
+    uint size;          ///< uncompressed size
+    uchar *packed;
+    uint packedsize;
+    cube *c;            ///< the cube an octree chunk is decoded into
+    ivec co;
+    int cubesize;
+    bool failed;
+
+    mapchunk() : external(NULL), size(0), packed(NULL), packedsize(0), c(NULL), cubesize(0), failed(false) {}
+    ~mapchunk() { DELETEA(packed); }
+
+    uchar *data() { return external ? external : raw.data.getbuf(); }
+};
+
+/// writes which cubes above MAPCHUNKDEPTH are subdivided and serializes each of the subtrees below into a chunk
+static void savemapskeleton(cube *c, const ivec &o, int size, int depth, stream *f, vector<mapchunk> &chunks, bool nolms)
+{
+    loopi(8)
+    {
+        ivec co(i, o, size);
+        if(c[i].children && depth < MAPCHUNKDEPTH)
+        {
+            f->putchar(1);
+            savemapskeleton(c[i].children, co, size>>1, depth+1, f, chunks, nolms);
+        }
+        else
+        {
+            f->putchar(0);
+            mapchunk &chunk = chunks.add();
+            savecube(c[i], co, size, &chunk.raw, nolms);
+            chunk.size = chunk.raw.data.length();
+        }
+    }
+}
+
+/// counterpart of savemapskeleton: creates the cubes above MAPCHUNKDEPTH and one chunk per subtree to decode
+static bool loadmapskeleton(cube *c, const ivec &o, int size, int depth, stream *f, vector<mapchunk> &chunks)
+{
+    loopi(8)
+    {
+        ivec co(i, o, size);
+        switch(f->getchar())
+        {
+            case 1:
+                if(depth >= MAPCHUNKDEPTH || size <= 1) return false;
+                c[i].children = newcubes();
+                if(!loadmapskeleton(c[i].children, co, size>>1, depth+1, f, chunks)) return false;
+                break;
+
+            case 0:
+            {
+                mapchunk &chunk = chunks.add();
+                chunk.c = &c[i];
+                chunk.co = co;
+                chunk.cubesize = size;
+                break;
+            }
+
+            default: return false;
+        }
+    }
+    return true;
+}
+
+/// compresses all chunks in parallel and writes them behind a table of their sizes
+static void savemapchunks(stream *f, vector<mapchunk> &chunks)
+{
+    parallelfor(chunks.length(), [&](int i)
+    {
+        mapchunk &chunk = chunks[i];
+        uLongf len = compressBound(chunk.size);
+        chunk.packed = new uchar[len];
+        if(compress2(chunk.packed, &len, chunk.data(), chunk.size, Z_BEST_SPEED) != Z_OK) len = 0;
+        chunk.packedsize = len;
+    });
+    f->putlil<int>(chunks.length());
+    loopv(chunks)
+    {
+        f->putlil<uint>(chunks[i].size);
+        f->putlil<uint>(chunks[i].packedsize);
+    }
+    loopv(chunks) f->write(chunks[i].packed, chunks[i].packedsize);
+}
+
+/// reads the chunks behind the table of their sizes, then inflates and decodes all of them in parallel.
+/// the sizes of chunks with external storage have to be set before.
+/// the size table comes from the (possibly received) map, so it is validated before anything gets allocated.
+static bool loadmapchunks(stream *f, vector<mapchunk> &chunks)
+{
+    if(f->getlil<int>() != chunks.length()) return false;
+    stream::offset left = f->size();
+    if(left >= 0) left -= f->tell() + 2*sizeof(uint)*chunks.length();
+    loopv(chunks)
+    {
+        mapchunk &chunk = chunks[i];
+        uint size = f->getlil<uint>(), packedsize = f->getlil<uint>();
+        if((chunk.external && size != chunk.size) || !packedsize || size > MAXMAPCHUNKSIZE || packedsize > compressBound(size)) return false;
+        if(left >= 0)
+        {
+            if(packedsize > left) return false;
+            left -= packedsize;
+        }
+        chunk.size = size;
+        chunk.packedsize = packedsize;
+    }
+    loopv(chunks)
+    {
+        mapchunk &chunk = chunks[i];
+        chunk.packed = new uchar[chunk.packedsize];
+        if(f->read(chunk.packed, chunk.packedsize) != chunk.packedsize) return false;
+    }
+    parallelfor(chunks.length(), [&](int i)
+    {
+        mapchunk &chunk = chunks[i];
+        if(!chunk.external) chunk.raw.data.pad(chunk.size);
+        uLongf len = chunk.size;
+        if(uncompress(chunk.data(), &len, chunk.packed, chunk.packedsize) != Z_OK || len != chunk.size) { chunk.failed = true; return; }
+        DELETEA(chunk.packed);
+        if(chunk.c) loadc(&chunk.raw, *chunk.c, chunk.co, chunk.cubesize, chunk.failed);
+    });
+    loopv(chunks) if(chunks[i].failed) return false;
+    return true;
+}
+
 /// print map variables to screen
 VAR(dbgvars, 0, 0, 1);
 
@@ -984,24 +1136,81 @@ void loadvslots(stream *f, int numvslots)
 
 
 
+/// compress and write maps on a background thread, so editing can continue meanwhile.
+VARP(savemapbackground, 0, 1, 1);
+
+/// a snapshot of the map serialized into memory, which still needs to be compressed and written to disk.
+struct mapsave
+{
+    string name;
+    stream *file;
+    memstream head;         ///< everything in front of the chunks (or the whole map in the legacy format)
+    vector<mapchunk> chunks;
+    SDL_Thread *thread;
+    SDL_atomic_t done;
+
+    mapsave() : file(NULL), thread(NULL) { name[0] = '\0'; SDL_AtomicSet(&done, 0); }
+    ~mapsave() { DELETEP(file); }
+
+    /// compresses and writes the snapshot, touches nothing else (so it may run on any thread)
+    void write()
+    {
+        file->write(head.data.getbuf(), head.data.length());
+        if(chunks.length()) savemapchunks(file, chunks);
+        DELETEP(file);
+        SDL_AtomicSet(&done, 1);
+    }
+
+    static int run(void *data)
+    {
+        ((mapsave *)data)->write();
+        return 0;
+    }
+};
+
+static mapsave *pendingsave = NULL;
+
+/// waits until the map being saved in the background has been written
+void finishmapsave()
+{
+    if(!pendingsave) return;
+    SDL_WaitThread(pendingsave->thread, NULL);
+    conoutf("wrote map file %s", pendingsave->name);
+    DELETEP(pendingsave);
+}
+
+/// reports a map saved in the background once it's done, called every frame
+void checkmapsave()
+{
+    if(pendingsave && SDL_AtomicGet(&pendingsave->done)) finishmapsave();
+}
+
 /// save the current game world to a map file (.OGZ)
 /// @param mname map name
 /// @param nolms enable or disable lightmap loading
+/// @param background compress and write the map on a background thread (if savemapbackground is set),
+///        the octree, lightmaps and pvs are copied into memory before this returns
 /// @warning map stream will be compressed using GZIP automaticly!
-bool save_world(const char *mname, bool nolms)
+bool save_world(const char *mname, bool nolms, bool background)
 {
+    finishmapsave();
     /// validate map name
     if(!*mname) mname = game::getclientmap();
     setmapfilenames(*mname ? mname : "untitled");
     /// eventually save backup file
     if(savebak) backup(ogzname, bakname);
     /// open output stream
-    stream *f = opengzfile(ogzname, "wb");
-    if(!f) 
+    stream *file = opengzfile(ogzname, "wb", NULL, savemapchunked ? Z_NO_COMPRESSION : Z_BEST_COMPRESSION);
+    if(!file) 
     {
         conoutf(CON_WARN, "could not write map to %s", ogzname); 
         return false;
     }
+    /// everything gets serialized into memory first and then written at once (possibly in the background)
+    mapsave *save = new mapsave;
+    copystring(save->name, ogzname);
+    save->file = file;
+    stream *f = &save->head;
     /// get light map data
     int numvslots = vslots.length();
     if(!nolms && !multiplayer(false))
@@ -1016,7 +1225,7 @@ bool save_world(const char *mname, bool nolms)
     /// write map header
     octaheader hdr;
     memcpy(hdr.magic, "OCTA", 4);    /// "magic number"
-    hdr.version = MAPVERSION;        /// map version
+    hdr.version = savemapchunked ? MAPVERSION : MAPVERSION_CHUNKED-1; /// map version
     hdr.headersize = sizeof(hdr);    /// size of header structure
     hdr.worldsize = worldsize;       /// size of the game world
     hdr.numents = 0;                 /// set amount of entities to 0
@@ -1033,6 +1242,7 @@ bool save_world(const char *mname, bool nolms)
     {
         if((id.type == ID_VAR || id.type == ID_FVAR || id.type == ID_SVAR) && id.flags&IDF_OVERRIDE && !(id.flags&IDF_READONLY) && id.flags&IDF_OVERRIDDEN) hdr.numvars++;
     });
+    int version = hdr.version;
     lilswap(&hdr.version, 9);
     /// write header to map file
     f->write(&hdr, sizeof(hdr));
@@ -1099,30 +1309,65 @@ bool save_world(const char *mname, bool nolms)
     /// vertex shader slots?
     savevslots(f, numvslots);
 
-    /// save octree structure and display another progress bar menawhile
-    renderprogress(0, "saving octree...");
-    savec(worldroot, ivec(0, 0, 0), worldsize>>1, f, nolms);
-
-    if(!nolms) 
+    if(version >= MAPVERSION_CHUNKED)
     {
-        if(lightmaps.length()) renderprogress(0, "saving lightmaps...");
-        loopv(lightmaps)
+        renderprogress(0, "saving octree...");
+        vector<mapchunk> &chunks = save->chunks;
+        savemapskeleton(worldroot, ivec(0, 0, 0), worldsize>>1, 1, f, chunks, nolms);
+        if(!nolms)
         {
-            LightMap &lm = lightmaps[i];
-            f->putchar(lm.type | (lm.unlitx>=0 ? 0x80 : 0));
-            if(lm.unlitx>=0)
+            loopv(lightmaps)
             {
-                f->putlil<ushort>(ushort(lm.unlitx));
-                f->putlil<ushort>(ushort(lm.unlity));
+                LightMap &lm = lightmaps[i];
+                f->putchar(lm.type | (lm.unlitx>=0 ? 0x80 : 0));
+                if(lm.unlitx>=0)
+                {
+                    f->putlil<ushort>(ushort(lm.unlitx));
+                    f->putlil<ushort>(ushort(lm.unlity));
+                }
+                mapchunk &chunk = chunks.add();
+                chunk.size = lm.bpp*LM_PACKW*LM_PACKH;
+                chunk.raw.write(lm.data, chunk.size);
             }
-            f->write(lm.data, lm.bpp*LM_PACKW*LM_PACKH);
-            renderprogress(float(i+1)/lightmaps.length(), "saving lightmaps...");
+            if(getnumviewcells()>0) { mapchunk &chunk = chunks.add(); savepvs(&chunk.raw); chunk.size = chunk.raw.data.length(); }
         }
-        if(getnumviewcells()>0) { renderprogress(0, "saving pvs..."); savepvs(f); }
+        if(shouldsaveblendmap()) { mapchunk &chunk = chunks.add(); saveblendmap(&chunk.raw); chunk.size = chunk.raw.data.length(); }
     }
-    if(shouldsaveblendmap()) { renderprogress(0, "saving blendmap..."); saveblendmap(f); }
+    else
+    {
 
-    delete f;
+        /// save octree structure and display another progress bar menawhile
+        renderprogress(0, "saving octree...");
+        savec(worldroot, ivec(0, 0, 0), worldsize>>1, f, nolms);
+
+        if(!nolms) 
+        {
+            if(lightmaps.length()) renderprogress(0, "saving lightmaps...");
+            loopv(lightmaps)
+            {
+                LightMap &lm = lightmaps[i];
+                f->putchar(lm.type | (lm.unlitx>=0 ? 0x80 : 0));
+                if(lm.unlitx>=0)
+                {
+                    f->putlil<ushort>(ushort(lm.unlitx));
+                    f->putlil<ushort>(ushort(lm.unlity));
+                }
+                f->write(lm.data, lm.bpp*LM_PACKW*LM_PACKH);
+                renderprogress(float(i+1)/lightmaps.length(), "saving lightmaps...");
+            }
+            if(getnumviewcells()>0) { renderprogress(0, "saving pvs..."); savepvs(f); }
+        }
+        if(shouldsaveblendmap()) { renderprogress(0, "saving blendmap..."); saveblendmap(f); }
+    }
+
+    if(background && savemapbackground && (save->thread = SDL_CreateThread(mapsave::run, "map save", save)))
+    {
+        pendingsave = save;
+        return true;
+    }
+    renderprogress(0, "compressing map...");
+    save->write();
+    delete save;
     /// done
     conoutf("wrote map file %s", ogzname);
     return true;
@@ -1133,7 +1378,7 @@ bool save_world(const char *mname, bool nolms)
 /// automaticly detect map name
 void savecurrentmap()
 {
-    save_world(game::getclientmap());
+    save_world(game::getclientmap(), false, true);
 }
 COMMAND(savecurrentmap, "");
 
@@ -1142,7 +1387,7 @@ COMMAND(savecurrentmap, "");
 /// @param mname map name
 void savemap(char *mname)
 {
-    save_world(mname);
+    save_world(mname, false, true);
 }
 COMMAND(savemap, "s");
 
@@ -1174,6 +1419,7 @@ void clearmapcrc()
 bool load_world(const char *mname, const char *cname)        // still supports all map formats that have existed since the earliest cube betas!
 {
     int loadingstart = SDL_GetTicks();
+    finishmapsave();
     setmapfilenames(mname, cname);
     stream *f = opengzfile(ogzname, "rb");
     if(!f) { conoutf(CON_ERROR, "could not read map %s", ogzname); return false; }
@@ -1376,13 +1622,51 @@ bool load_world(const char *mname, const char *cname)        // still supports a
 
     renderprogress(0, "loading octree...");
     bool failed = false;
-    worldroot = loadchildren(f, ivec(0, 0, 0), hdr.worldsize>>1, failed);
-    if(failed) conoutf(CON_ERROR, "garbage in map");
+    if(hdr.version >= MAPVERSION_CHUNKED)
+    {
+        vector<mapchunk> chunks;
+        worldroot = newcubes();
+        failed = !loadmapskeleton(worldroot, ivec(0, 0, 0), hdr.worldsize>>1, 1, f, chunks);
+        if(!failed) loopi(hdr.lightmaps)
+        {
+            LightMap &lm = lightmaps.add();
+            int type = f->getchar();
+            lm.type = type&0x7F;
+            if(type&0x80)
+            {
+                lm.unlitx = f->getlil<ushort>();
+                lm.unlity = f->getlil<ushort>();
+            }
+            if(lm.type&LM_ALPHA && (lm.type&LM_TYPE)!=LM_BUMPMAP1) lm.bpp = 4;
+            lm.data = new uchar[lm.bpp*LM_PACKW*LM_PACKH];
+            lm.finalize();
+            mapchunk &chunk = chunks.add();
+            chunk.external = lm.data;
+            chunk.size = lm.bpp*LM_PACKW*LM_PACKH;
+        }
+        int pvschunk = -1, blendchunk = -1;
+        if(hdr.numpvs > 0) { pvschunk = chunks.length(); chunks.add(); }
+        if(hdr.blendmap) { blendchunk = chunks.length(); chunks.add(); }
+        if(!failed) failed = !loadmapchunks(f, chunks);
+        if(failed) conoutf(CON_ERROR, "garbage in map");
+        renderprogress(0, "validating...");
+        validatec(worldroot, hdr.worldsize>>1);
+        if(!failed)
+        {
+            if(pvschunk >= 0) loadpvs(&chunks[pvschunk].raw, hdr.numpvs);
+            if(blendchunk >= 0) loadblendmap(&chunks[blendchunk].raw, hdr.blendmap);
+        }
+    }
+    else
+    {
+        worldroot = loadchildren(f, ivec(0, 0, 0), hdr.worldsize>>1, failed);
+        if(failed) conoutf(CON_ERROR, "garbage in map");
 
-    renderprogress(0, "validating...");
-    validatec(worldroot, hdr.worldsize>>1);
+        renderprogress(0, "validating...");
+        validatec(worldroot, hdr.worldsize>>1);
+    }
 
-    if(!failed)
+    if(!failed && hdr.version < MAPVERSION_CHUNKED)
     {
         if(hdr.version >= 7) loopi(hdr.lightmaps)
         {
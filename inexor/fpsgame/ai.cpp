@@ -62,7 +62,7 @@ namespace ai
         return e->state == CS_ALIVE && !isteam(d->team, e->team);
     }
 
-    bool getsight(vec &o, float yaw, float pitch, vec &q, vec &v, float mdist, float fovx, float fovy)
+    static bool infov(const vec &o, float yaw, float pitch, const vec &q, float mdist, float fovx, float fovy)
     {
         float dist = o.dist(q);
 
@@ -70,19 +70,61 @@ namespace ai
         {
             float x = fmod(fabs(asin((q.z-o.z)/dist)/RAD-pitch), 360);
             float y = fmod(fabs(-atan2(q.x-o.x, q.y-o.y)/RAD-yaw), 360);
-            if(min(x, 360-x) <= fovx && min(y, 360-y) <= fovy) return raycubelos(o, q, v);
+            if(min(x, 360-x) <= fovx && min(y, 360-y) <= fovy) return true;
         }
         return false;
     }
 
-    bool cansee(fpsent *d, vec &x, vec &y, vec &targ)
+    bool getsight(vec &o, float yaw, float pitch, vec &q, vec &v, float mdist, float fovx, float fovy)
+    {
+        return infov(o, yaw, pitch, q, mdist, fovx, fovy) && raycubelos(o, q, v);
+    }
+
+    /// a player a bot might target this frame, as seen before the bots think.
+    struct sighttarget
+    {
+        fpsent *e;
+        float dist; ///< squared distance from the bot's head to where it aims at e
+        int query;  ///< the line of sight to e in sightqueries, -1 if e is out of view
+    };
+
+    static bool sighttargetcmp(const sighttarget &x, const sighttarget &y) { return x.dist < y.dist; }
+
+    /// the targets of every bot, closest first, and the line of sight to those in view.
+    /// the rays are cast and the targets sorted in parallel before the bots think, who then still decide one after the other.
+    static vector<sighttarget> sighttargets;
+    static vector<losquery> sightqueries;
+
+    bool cansee(fpsent *d, vec &x, vec &y, vec &targ, fpsent *e)
     {
         aistate &b = d->ai->getstate();
         if(canmove(d) && b.type != AI_S_WAIT)
-            return getsight(x, d->yaw, d->pitch, y, targ, d->ai->views[2], d->ai->views[0], d->ai->views[1]);
+        {
+            if(!infov(x, d->yaw, d->pitch, y, d->ai->views[2], d->ai->views[0], d->ai->views[1])) return false;
+            if(e) for(int i = d->ai->sightfirst; i < d->ai->sightlast; i++)
+            {
+                const sighttarget &t = sighttargets[i];
+                if(t.e != e || t.query < 0) continue;
+                const losquery &q = sightqueries[t.query];
+                if(q.o != x || q.dest != y) break; // aimed somewhere else since
+                targ = q.hitpos;
+                return q.los;
+            }
+            return raycubelos(x, y, targ);
+        }
         return false;
     }
 
+    /// like cansee() from d to where it aimed at t.e when the rays were cast.
+    static bool cansee(fpsent *d, const sighttarget &t)
+    {
+        aistate &b = d->ai->getstate();
+        if(t.query < 0 || !canmove(d) || b.type == AI_S_WAIT) return false;
+        const losquery &q = sightqueries[t.query];
+        aitarget = q.hitpos;
+        return q.los;
+    }
+
     bool canshoot(fpsent *d, fpsent *e)
     {
         if(weaprange(d, d->gunselect, e->o.squaredist(d->o)) && targetable(d, e))
@@ -109,24 +151,98 @@ namespace ai
         return false;
 	}
 
-    vec getaimpos(fpsent *d, fpsent *e)
+    /// where d aims at e with its current aim offsets.
+    static vec aimpos(fpsent *d, fpsent *e)
     {
         vec o = e->o;
         if(d->gunselect == GUN_RL) o.z += (e->aboveeye*0.2f)-(0.8f*d->eyeheight);
         else if(d->gunselect != GUN_GL) o.z += (e->aboveeye-e->eyeheight)*0.5f;
-        if(d->skill <= 100)
+        if(d->skill <= 100) loopk(3) o[k] += d->ai->aimrnd[k];
+        return o;
+    }
+
+    vec getaimpos(fpsent *d, fpsent *e)
+    {
+        if(d->skill <= 100 && lastmillis >= d->ai->lastaimrnd)
+        {
+            const int aiskew[NUMGUNS] = { 1, 10, 50, 5, 20, 1, 100, 1, 10, 10, 10, 1, 1 };
+            #define rndaioffset(r) ((rnd(int(r*aiskew[d->gunselect]*2)+1)-(r*aiskew[d->gunselect]))*(1.f/float(max(d->skill, 1))))
+            loopk(3) d->ai->aimrnd[k] = rndaioffset(e->radius);
+            int dur = (d->skill+10)*10;
+            d->ai->lastaimrnd = lastmillis+dur+rnd(dur);
+        }
+        return aimpos(d, e);
+    }
+
+    static void addsight(fpsent *d, const vec &dp, fpsent *e)
+    {
+        if(e == d || !targetable(d, e)) return;
+        vec ep = getaimpos(d, e); // picks the aim offsets of this frame before aiming any rays
+        sighttarget &t = sighttargets.add();
+        t.e = e;
+        t.dist = ep.squaredist(dp);
+        t.query = -1;
+        if(!infov(dp, d->yaw, d->pitch, ep, d->ai->views[2], d->ai->views[0], d->ai->views[1])) return;
+        t.query = sightqueries.length();
+        losquery &q = sightqueries.add();
+        q.o = dp;
+        q.dest = ep;
+    }
+
+    int closenode(fpsent *d);
+    static bool findremap(fpsent *d, int n, int &w, int &t, int &i);
+
+    /// a bot that is going to think this frame, and the detour its route check is going to search if any.
+    struct perceiver
+    {
+        fpsent *d;
+        int remapfrom, remapto;
+    };
+    static vector<perceiver> perceivers;
+
+    /// does the part of the bots' thinking that doesn't depend on what the other bots decide, for all of them at once:
+    /// every bot looks at every player it could target, scores them and searches the detours of its route.
+    /// the detours are left in the route cache, where the bots find them again when they check their routes.
+    static void perceive()
+    {
+        sightqueries.setsize(0);
+        sighttargets.setsize(0);
+        perceivers.setsize(0);
+        loopv(players) if(players[i]->ai)
         {
-            if(lastmillis >= d->ai->lastaimrnd)
+            fpsent *d = players[i];
+            d->ai->sightfirst = sighttargets.length();
+            if(d->state == CS_ALIVE && canmove(d))
             {
-                const int aiskew[NUMGUNS] = { 1, 10, 50, 5, 20, 1, 100, 1, 10, 10, 10, 1, 1 };
-                #define rndaioffset(r) ((rnd(int(r*aiskew[d->gunselect]*2)+1)-(r*aiskew[d->gunselect]))*(1.f/float(max(d->skill, 1))))
-                loopk(3) d->ai->aimrnd[k] = rndaioffset(e->radius);
-                int dur = (d->skill+10)*10;
-                d->ai->lastaimrnd = lastmillis+dur+rnd(dur);
+                perceiver &p = perceivers.add();
+                p.d = d;
+                p.remapfrom = p.remapto = -1;
+                vec dp = d->headpos();
+                loopvj(players) addsight(d, dp, players[j]);
+                if(routecachesize && !d->ai->route.empty() && d->ai->lastcheck && lastmillis-d->ai->lastcheck >= 500)
+                {
+                    int n = closenode(d), w, t, from;
+                    if(d->ai->route.inrange(n) && n >= 3 && findremap(d, n, w, t, from))
+                    {
+                        p.remapfrom = w;
+                        p.remapto = t;
+                    }
+                }
             }
-            loopk(3) o[k] += d->ai->aimrnd[k];
+            d->ai->sightlast = sighttargets.length();
         }
-        return o;
+        raycubelos(sightqueries.getbuf(), sightqueries.length());
+        prepareroutes();
+        parallelfor(perceivers.length(), [&](int i)
+        {
+            fpsent *d = perceivers[i].d;
+            sighttargets.sort(sighttargetcmp, d->ai->sightfirst, d->ai->sightlast - d->ai->sightfirst);
+            if(perceivers[i].remapfrom >= 0)
+            {
+                vector<int> remap;
+                route(d, perceivers[i].remapfrom, perceivers[i].remapto, remap, obstacles);
+            }
+        });
     }
 
     void create(fpsent *d)
@@ -201,6 +317,7 @@ namespace ai
                 iteration = 1;
                 itermillis = totalmillis;
             }
+            perceive();
             int count = 0;
             loopv(players) if(players[i]->ai) think(players[i], ++count == iteration ? true : false);
             if(++iteration > count) iteration = 0;
@@ -240,10 +357,19 @@ namespace ai
 		return false;
     }
 
+    /// waypoints around a position tried in turn when the closest one cannot be routed to
+    #define ROUTECANDIDATES 3
+
     bool makeroute(fpsent *d, aistate &b, const vec &pos, bool changed, int retries)
     {
-        int node = closestwaypoint(pos, SIGHTMIN, true);
-        return makeroute(d, b, node, changed, retries);
+        int nodes[ROUTECANDIDATES];
+        closestwaypoints(&pos, 1, SIGHTMIN, true, ROUTECANDIDATES, nodes);
+        loopi(ROUTECANDIDATES)
+        {
+            if(!iswaypoint(nodes[i])) break;
+            if(makeroute(d, b, nodes[i], changed, retries)) return true;
+        }
+        return false;
     }
 
     bool randomnode(fpsent *d, aistate &b, const vec &pos, float guard, float wander)
@@ -273,22 +399,12 @@ namespace ai
 
     bool enemy(fpsent *d, aistate &b, const vec &pos, float guard = SIGHTMIN, int pursue = 0)
     {
-        fpsent *t = NULL;
-        vec dp = d->headpos();
-        float mindist = guard*guard, bestdist = 1e16f;
-        loopv(players)
+        float mindist = guard*guard;
+        for(int i = d->ai->sightfirst; i < d->ai->sightlast; i++)
         {
-            fpsent *e = players[i];
-            if(e == d || !targetable(d, e)) continue;
-            vec ep = getaimpos(d, e);
-            float dist = ep.squaredist(dp);
-            if(dist < bestdist && (cansee(d, dp, ep) || dist <= mindist))
-            {
-                t = e;
-                bestdist = dist;
-            }
+            const sighttarget &t = sighttargets[i];
+            if(targetable(d, t.e) && (t.dist <= mindist || cansee(d, t))) return violence(d, b, t.e, pursue);
         }
-        if(t && violence(d, b, t, pursue)) return true;
         return false;
     }
 
@@ -354,30 +470,11 @@ namespace ai
 
     bool target(fpsent *d, aistate &b, int pursue = 0, bool force = false, float mindist = 0.f)
     {
-        static vector<fpsent *> hastried; hastried.setsize(0);
-        vec dp = d->headpos();
-        while(true)
-    {
-            float dist = 1e16f;
-        fpsent *t = NULL;
-        loopv(players)
+        for(int i = d->ai->sightfirst; i < d->ai->sightlast; i++) // closest first
         {
-            fpsent *e = players[i];
-                if(e == d || hastried.find(e) >= 0 || !targetable(d, e)) continue;
-            vec ep = getaimpos(d, e);
-                float v = ep.squaredist(dp);
-                if((!t || v < dist) && (mindist <= 0 || v <= mindist) && (force || cansee(d, dp, ep)))
-            {
-                t = e;
-                    dist = v;
-                }
-            }
-            if(t)
-            {
-                if(violence(d, b, t, pursue)) return true;
-                hastried.add(t);
-            }
-            else break;
+            const sighttarget &t = sighttargets[i];
+            if(mindist > 0 && t.dist > mindist) break;
+            if(targetable(d, t.e) && (force || cansee(d, t)) && violence(d, b, t.e, pursue)) return true;
         }
         return false;
     }
@@ -407,7 +504,8 @@ namespace ai
         }
     }
 
-    static void tryitem(fpsent *d, extentity &e, int id, aistate &b, vector<interest> &interests, bool force = false)
+    /// adds an interest in item e if d wants it, findnode = false leaves its waypoint to the caller.
+    static void tryitem(fpsent *d, extentity &e, int id, aistate &b, vector<interest> &interests, bool force = false, bool findnode = true)
     {
         float score = 0;
         switch(e.type)
@@ -440,7 +538,7 @@ namespace ai
         {
             interest &n = interests.add();
             n.state = AI_S_INTEREST;
-            n.node = closestwaypoint(e.o, SIGHTMIN, true);
+            n.node = findnode ? closestwaypoint(e.o, SIGHTMIN, true) : -1;
             n.target = id;
             n.targtype = AI_T_ENTITY;
             n.score = d->feetpos().squaredist(e.o)/(force ? -1 : score);
@@ -449,12 +547,22 @@ namespace ai
 
     void items(fpsent *d, aistate &b, vector<interest> &interests, bool force = false)
     {
+        static vector<vec> itempos;
+        static vector<int> itemnodes;
+        itempos.setsize(0);
+        int first = interests.length();
         loopv(entities::ents)
         {
             extentity &e = *(extentity *)entities::ents[i];
             if(!e.spawned() || !d->canpickup(e.type)) continue;
-            tryitem(d, e, i, b, interests, force);
+            int wanted = interests.length();
+            tryitem(d, e, i, b, interests, force, false);
+            if(interests.length() > wanted) itempos.add(e.o);
         }
+        // the waypoints of all wanted items are looked up at once
+        itemnodes.setsize(0);
+        closestwaypoints(itempos.getbuf(), itempos.length(), SIGHTMIN, true, 1, itemnodes.pad(itempos.length()));
+        loopv(itemnodes) interests[first + i].node = itemnodes[i];
     }
 
     static vector<int> targets;
@@ -826,13 +934,12 @@ namespace ai
         return false;
     }
 
-    bool checkroute(fpsent *d, int n)
+    /// finds the detour from w to t a route has to take around something in the way ahead of route[n],
+    /// replacing the route from index i on.
+    static bool findremap(fpsent *d, int n, int &w, int &t, int &i)
     {
-        if(d->ai->route.empty() || !d->ai->route.inrange(n)) return false;
-        int last = d->ai->lastcheck ? lastmillis-d->ai->lastcheck : 0;
-        if(last < 500 || n < 3) return false; // route length is too short
-        d->ai->lastcheck = lastmillis;
-        int w = iswaypoint(d->lastnode) ? d->lastnode : d->ai->route[n], c = min(n-1, NUMPREVNODES);
+        w = iswaypoint(d->lastnode) ? d->lastnode : d->ai->route[n];
+        int c = min(n-1, NUMPREVNODES);
         loopj(c) // check ahead to see if we need to go around something
         {
             int p = n-j-1, v = d->ai->route[p];
@@ -840,26 +947,34 @@ namespace ai
             {
                 int m = p-1;
                 if(m < 3) return false; // route length is too short from this point
-                loopirev(m)
+                for(i = m-1; i >= 0; i--)
                 {
-                    int t = d->ai->route[i];
-                    if(!d->ai->hasprevnode(t) && !obstacles.find(t, d))
-                    {
-                        static vector<int> remap; remap.setsize(0);
-                        if(route(d, w, t, remap, obstacles))
-                        { // kill what we don't want and put the remap in
-                            while(d->ai->route.length() > i) d->ai->route.pop();
-                            loopvk(remap) d->ai->route.add(remap[k]);
-                            return true;
-			                  }
-                        return false; // we failed
-                    }
+                    t = d->ai->route[i];
+                    if(!d->ai->hasprevnode(t) && !obstacles.find(t, d)) return true;
                 }
                 return false;
             }
 		}
         return false;
-  }
+    }
+
+    bool checkroute(fpsent *d, int n)
+    {
+        if(d->ai->route.empty() || !d->ai->route.inrange(n)) return false;
+        int last = d->ai->lastcheck ? lastmillis-d->ai->lastcheck : 0;
+        if(last < 500 || n < 3) return false; // route length is too short
+        d->ai->lastcheck = lastmillis;
+        int w, t, i;
+        if(!findremap(d, n, w, t, i)) return false;
+        static vector<int> remap; remap.setsize(0);
+        if(route(d, w, t, remap, obstacles)) // usually found by perceive() already
+        { // kill what we don't want and put the remap in
+            while(d->ai->route.length() > i) d->ai->route.pop();
+            loopvk(remap) d->ai->route.add(remap[k]);
+            return true;
+        }
+        return false; // we failed
+    }
 
   bool hunt(fpsent *d, aistate &b)
 	{
@@ -1044,7 +1159,7 @@ namespace ai
             float yaw, pitch;
             getyawpitch(dp, ep, yaw, pitch);
             fixrange(yaw, pitch);
-            bool insight = cansee(d, dp, ep), hasseen = d->ai->enemyseen && lastmillis-d->ai->enemyseen <= (d->skill*10)+3000,
+            bool insight = cansee(d, dp, ep, aitarget, e), hasseen = d->ai->enemyseen && lastmillis-d->ai->enemyseen <= (d->skill*10)+3000,
                 quick = d->ai->enemyseen && lastmillis-d->ai->enemyseen <= (d->gunselect == GUN_CG ? 300 : skmod)+30;
             if(insight) d->ai->enemyseen = lastmillis;
             if(idle || insight || hasseen || quick)
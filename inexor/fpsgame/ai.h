@@ -24,15 +24,11 @@ namespace ai
     struct waypoint
     {
         vec o;
-        float curscore, estscore;
 		int weight;
-        ushort route, prev;
         ushort links[MAXWAYPOINTLINKS];
 
         waypoint() {}
-        waypoint(const vec &o, int weight = 0) : o(o), weight(weight), route(0) { memset(links, 0, sizeof(links)); }
-
-        int score() const { return int(curscore) + int(estscore); }
+        waypoint(const vec &o, int weight = 0) : o(o), weight(weight) { memset(links, 0, sizeof(links)); }
 
         int find(int wp)
 		{
@@ -51,6 +47,8 @@ namespace ai
 
     extern SharedVar<int> showwaypoints, dropwaypoints;
     extern int closestwaypoint(const vec &pos, float mindist, bool links, fpsent *d = NULL);
+    /// the k closest waypoints of each of num positions, nearest first and padded with -1, into results[i*k...i*k+k-1].
+    extern void closestwaypoints(const vec *pos, int num, float mindist, bool links, int k, int *results);
     extern void findwaypointswithin(const vec &pos, float mindist, float maxdist, vector<int> &results);
 	extern void inferwaypoints(fpsent *d, const vec &o, const vec &v, float mindist = ai::CLOSEDIST);
 
@@ -128,7 +126,11 @@ namespace ai
         int remap(fpsent *d, int n, vec &pos, bool retry = false);
     };
 
+    extern SharedVar<int> routecachesize;
     extern bool route(fpsent *d, int node, int goal, vector<int> &route, const avoidset &obstacles, int retries = 0);
+    /// brings everything route() reads up to date, after that routes can be searched on several threads at once
+    /// as long as the waypoints and obstacles stay the same.
+    extern void prepareroutes();
     extern void navigate();
     extern void clearwaypoints(bool full = false);
     extern void seedwaypoints();
@@ -188,11 +190,12 @@ namespace ai
         vector<int> route;
         vec target, spot;
         int enemy, enemyseen, enemymillis, weappref, prevnodes[NUMPREVNODES], targnode, targlast, targtime, targseq,
-            lastrun, lasthunt, lastaction, lastcheck, jumpseed, jumprand, blocktime, huntseq, blockseq, lastaimrnd;
+            lastrun, lasthunt, lastaction, lastcheck, jumpseed, jumprand, blocktime, huntseq, blockseq, lastaimrnd,
+            sightfirst, sightlast;
         float targyaw, targpitch, views[3], aimrnd[3];
         bool dontmove, becareful, tryreset, trywipe;
 
-        aiinfo()
+        aiinfo() : sightfirst(0), sightlast(0)
         {
             clearsetup();
             reset();
@@ -287,7 +290,7 @@ namespace ai
     extern float viewfieldx(int x = 101);
     extern float viewfieldy(int x = 101);
     extern bool targetable(fpsent *d, fpsent *e);
-    extern bool cansee(fpsent *d, vec &x, vec &y, vec &targ = aitarget);
+    extern bool cansee(fpsent *d, vec &x, vec &y, vec &targ = aitarget, fpsent *e = NULL);
 
     extern void init(fpsent *d, int at, int on, int sk, int bn, int pm, const char *name, const char *team);
     extern void update();
@@ -767,23 +767,92 @@ namespace game
 	/// ?
     int needclipboard = -1;
 
+    /// clipboard or undo being streamed to the server, messages are held back until it is sent.
+    /// it is deflated chunk by chunk as it goes out, so big selections do not stall the client at once.
+    editstream *editsend = NULL;
+    int editsendtype = -1, editsendpos = 0;
+
+    /// kilobytes of edit chunks sent per update
+    VARP(editsendrate, 1, 64, 4096);
+
+    static void cleareditsend()
+    {
+        closeeditstream(editsend);
+        editsendtype = -1;
+        editsendpos = 0;
+    }
+
+	/// send up to budget bytes of the pending edit chunks, returns true once all are sent.
+	/// packlen is only known with the last chunk, earlier ones carry 0; an unpacklen of 0 aborts the edit.
+    bool sendeditchunks(int budget)
+    {
+        static uchar chunk[EDITCHUNKSIZE];
+        while(editsendtype >= 0 && budget > 0)
+        {
+            bool ended = true;
+            int unpacklen = editstreamsize(editsend), len = editsend ? geteditstream(editsend, chunk, EDITCHUNKSIZE, ended) : 0;
+            if(len < 0) { conoutf(CON_ERROR, "could not send edit"); unpacklen = len = 0; ended = true; }
+            packetbuf p(32 + len, ENET_PACKET_FLAG_RELIABLE);
+            putint(p, editsendtype);
+            putint(p, unpacklen);
+            putint(p, ended ? editsendpos + len : 0);
+            putint(p, editsendpos);
+            putint(p, len);
+            if(len > 0) p.put(chunk, len);
+            sendclientpacket(p.finalize(), 1);
+            editsendpos += len;
+            budget -= max(len, 1);
+            if(ended)
+            {
+                if(editsendpos > EDITCHUNKSIZE) conoutf("sent %d KB of edits", editsendpos>>10);
+                cleareditsend();
+            }
+        }
+        return editsendtype < 0;
+    }
+
+    /// start streaming an edit payload, after all messages queued so far
+    void queueeditsend(int type, editstream *s)
+    {
+        if(editsendtype >= 0) sendeditchunks(INT_MAX);
+        c2sinfo(true);
+        editsendtype = type;
+        editsendpos = 0;
+        editsend = s;
+        sendeditchunks(editsendrate<<10);
+    }
+
+    /// cubescript: progress of the edit currently sent to the server, from 0 to 1
+    ICOMMAND(editsendprogress, "", (), floatret(editsendtype >= 0 ? editstreamprogress(editsend) : 1));
+
 	/// send copied data from your clipboard to server
     void sendclipboard()
     {
-        uchar *outbuf = NULL;
-        int inlen = 0, outlen = 0;
-        if(!packeditinfo(localedit, inlen, outbuf, outlen))
+        queueeditsend(N_CLIPBOARD, packeditinfo(localedit));
+        needclipboard = -1;
+    }
+
+	/// take a chunk of another player's clipboard or undo, which is applied once complete
+    void receiveedit(fpsent *d, int type, int unpacklen, int packlen, int offset, ucharbuf &q)
+    {
+        if(!offset)
         {
-            outbuf = NULL;
-            inlen = outlen = 0;
+            closeeditstream(d->editrecv);
+            if(type == N_CLIPBOARD && unpacklen <= 0) { unpackeditinfo(d->edit, NULL); return; }
+            d->editrecv = openeditstream(unpacklen);
+            d->editrecvtype = type;
+            d->editrecvpos = 0;
         }
-        packetbuf p(16 + outlen, ENET_PACKET_FLAG_RELIABLE);
-        putint(p, N_CLIPBOARD);
-        putint(p, inlen);
-        putint(p, outlen);
-        if(outlen > 0) p.put(outbuf, outlen);
-        sendclientpacket(p.finalize(), 1);
-        needclipboard = -1;
+        if(!d->editrecv || d->editrecvtype != type || offset != d->editrecvpos || !puteditstream(d->editrecv, q.buf, q.maxlen))
+        {
+            closeeditstream(d->editrecv);
+            return;
+        }
+        d->editrecvpos += q.maxlen;
+        if(packlen <= 0 || d->editrecvpos < packlen) return;
+        if(type == N_CLIPBOARD) unpackeditinfo(d->edit, d->editrecv);
+        else unpackundo(d->editrecv);
+        closeeditstream(d->editrecv);
     }
 
     /// send edit messages to servers
@@ -882,13 +951,8 @@ namespace game
             case EDIT_UNDO:
             case EDIT_REDO:
             {
-                uchar *outbuf = NULL;
-                int inlen = 0, outlen = 0;
-                if(packundo(op, inlen, outbuf, outlen))
-                {
-                    if(addmsg(N_EDITF + op, "ri2", inlen, outlen)) messages.put(outbuf, outlen);
-                    delete[] outbuf;
-                }
+                editstream *s = packundo(op);
+                if(s) queueeditsend(N_EDITF + op, s);
                 break;
             }
         }
@@ -1094,6 +1158,7 @@ namespace game
         messages.setsize(0);
         messagereliable = false;
         messagecn = -1;
+        cleareditsend();
         player1->respawn();
         player1->lifesequence = 0;
         player1->state = CS_ALIVE;
@@ -1232,7 +1297,8 @@ namespace game
             if(cmode) cmode->senditems(p);
             senditemstoserver = false;
         }
-        if(messages.length())
+        bool editsending = editsendtype >= 0 && !sendeditchunks(editsendrate<<10);
+        if(messages.length() && !editsending)
         {
             p.put(messages.getbuf(), messages.length());
             messages.setsize(0);
@@ -1864,20 +1930,13 @@ namespace game
             }
 
             case N_CLIPBOARD:
-            {
-                int cn = getint(p), unpacklen = getint(p), packlen = getint(p);
-                fpsent *d = getclient(cn);
-                ucharbuf q = p.subbuf(max(packlen, 0));
-                if(d) unpackeditinfo(d->edit, q.buf, q.maxlen, unpacklen);
-                break;
-            }
             case N_UNDO:
             case N_REDO:
             {
-                int cn = getint(p), unpacklen = getint(p), packlen = getint(p);
+                int cn = getint(p), unpacklen = getint(p), packlen = getint(p), offset = getint(p), len = getint(p);
                 fpsent *d = getclient(cn);
-                ucharbuf q = p.subbuf(max(packlen, 0));
-                if(d) unpackundo(q.buf, q.maxlen, unpacklen);
+                ucharbuf q = p.subbuf(max(len, 0));
+                if(d) receiveedit(d, type, unpacklen, packlen, offset, q);
                 break;
             }
 
@@ -2246,7 +2305,7 @@ namespace game
                 delete map;
                 if(load_world(mname, oldname[0] ? oldname : NULL))
                     entities::spawnitems(true);
-                remove(findfile(fname, "rb"));
+                removefile(fname);
                 break;
             }
         }
@@ -2345,7 +2404,7 @@ namespace game
             delete map;
         }
         else conoutf(CON_ERROR, "could not read map");
-        remove(findfile(fname, "rb"));
+        removefile(fname);
     }
     COMMAND(sendmap, "");
 
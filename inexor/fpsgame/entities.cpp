@@ -269,34 +269,73 @@ namespace entities
         }
     }
 
+    // what checkitems(), teleport() and the trigger functions look for, so they need not walk all of ents.
+    // pickups (items, teleports, jumppads and respawn points) are bucketed into a grid of 1<<PICKUPGRIDSHIFT sized cells.
+    static const int PICKUPGRIDSHIFT = 5;
+    static hashtable<ivec2, smallvector<int, 4> > pickupgrid;
+    static hashtable<int, int> teledests;   // first teledest of each tag
+    static vector<int> triggerents;         // mapmodels with a trigger type, users still check validtrigger()
+    static int indexedents = 0;             // ents below this are in the index
+    static bool entindexdirty = true;
+
+    static inline bool pickupent(int type)
+    {
+        return (type>=I_SHELLS && type<=I_QUAD) || type==TELEPORT || type==JUMPPAD || type==RESPAWNPOINT;
+    }
+
+    static inline ivec2 pickupcell(float x, float y)
+    {
+        return ivec2(int(floor(x))>>PICKUPGRIDSHIFT, int(floor(y))>>PICKUPGRIDSHIFT);
+    }
+
+    static void indexent(int i)
+    {
+        extentity &e = *ents[i];
+        if(pickupent(e.type)) pickupgrid[pickupcell(e.o.x, e.o.y)].add(i);
+        else if(e.type==TELEDEST) { if(!teledests.access(e.attr2)) teledests[e.attr2] = i; }
+        else if(e.type==ET_MAPMODEL && e.attr3) triggerents.add(i);
+    }
+
+    /// rebuilds the index after edits, entities appended since the last call (like pushed items) are just added.
+    static void updateentindex()
+    {
+        if(entindexdirty || indexedents > ents.length())
+        {
+            pickupgrid.clear();
+            teledests.clear();
+            triggerents.setsize(0);
+            indexedents = 0;
+            entindexdirty = false;
+        }
+        for(; indexedents < ents.length(); indexedents++) indexent(indexedents);
+    }
+
+    static int findteledest(int tag)
+    {
+        updateentindex();
+        int *e = teledests.access(tag);
+        return e ? *e : -1;
+    }
+
     void teleport(int n, fpsent *d)     // also used by monsters
     {
-        int e = -1, tag = ents[n]->attr1, beenhere = -1;
-        for(;;)
+        int tag = ents[n]->attr1, e = findteledest(tag);
+        if(e<0) { conoutf(CON_WARN, "no teleport destination for tag %d", tag); return; }
+        teleporteffects(d, n, e, true);
+        d->o = ents[e]->o;
+        d->yaw = ents[e]->attr1;
+        if(ents[e]->attr3 > 0)
         {
-            e = findentity(TELEDEST, e+1);
-            if(e==beenhere || e<0) { conoutf(CON_WARN, "no teleport destination for tag %d", tag); return; }
-            if(beenhere<0) beenhere = e;
-            if(ents[e]->attr2==tag)
-            {
-                teleporteffects(d, n, e, true);
-                d->o = ents[e]->o;
-                d->yaw = ents[e]->attr1;
-                if(ents[e]->attr3 > 0)
-                {
-                    vec dir;
-                    vecfromyawpitch(d->yaw, 0, 1, 0, dir);
-                    float speed = d->vel.magnitude2();
-                    d->vel.x = dir.x*speed;
-                    d->vel.y = dir.y*speed;
-                }
-                else d->vel = vec(0, 0, 0);
-                entinmap(d);
-                updatedynentcache(d);
-                ai::inferwaypoints(d, ents[n]->o, ents[e]->o, 16.f);
-                break;
-            }
+            vec dir;
+            vecfromyawpitch(d->yaw, 0, 1, 0, dir);
+            float speed = d->vel.magnitude2();
+            d->vel.x = dir.x*speed;
+            d->vel.y = dir.y*speed;
         }
+        else d->vel = vec(0, 0, 0);
+        entinmap(d);
+        updatedynentcache(d);
+        ai::inferwaypoints(d, ents[n]->o, ents[e]->o, 16.f);
     }
 
     void trypickup(int n, fpsent *d)
@@ -353,14 +392,24 @@ namespace entities
     void checkitems(fpsent *d)
     {
         if(d->state!=CS_ALIVE) return;
+        updateentindex();
         vec o = d->feetpos();
-        loopv(ents)
+        static vector<int> nearby;
+        nearby.setsize(0);
+        ivec2 cmin = pickupcell(o.x-16, o.y-16), cmax = pickupcell(o.x+16, o.y+16);
+        for(int y = cmin.y; y <= cmax.y; y++) for(int x = cmin.x; x <= cmax.x; x++)
         {
-            extentity &e = *ents[i];
-            if(e.type==NOTUSED) continue;
+            smallvector<int, 4> *cell = pickupgrid.access(ivec2(x, y));
+            if(cell) nearby.put(cell->getbuf(), cell->length());
+        }
+        nearby.sort(); // pick up in entity order, like walking all of ents would
+        loopv(nearby)
+        {
+            int n = nearby[i];
+            extentity &e = *ents[n];
             if(!e.spawned() && e.type!=TELEPORT && e.type!=JUMPPAD && e.type!=RESPAWNPOINT) continue;
             float dist = e.o.dist(o);
-            if(dist<(e.type==TELEPORT ? 16 : 12)) trypickup(i, d);
+            if(dist<(e.type==TELEPORT ? 16 : 12)) trypickup(n, d);
         }
     }
 
@@ -413,6 +462,7 @@ namespace entities
     void clearents()
     {
         while(ents.length()) deleteentity(ents.pop());
+        entindexdirty = true;
     }
 
     enum
@@ -496,9 +546,10 @@ namespace entities
 
     void resettriggers()
     {
-        loopv(ents)
+        updateentindex();
+        loopv(triggerents)
         {
-            fpsentity &e = *(fpsentity *)ents[i];
+            fpsentity &e = *(fpsentity *)ents[triggerents[i]];
             if(e.type != ET_MAPMODEL || !validtrigger(e.attr3)) continue;
             e.triggerstate = TRIGGER_RESET;
             e.lasttrigger = 0;
@@ -508,9 +559,10 @@ namespace entities
 
     void unlocktriggers(int tag, int oldstate = TRIGGER_RESET, int newstate = TRIGGERING)
     {
-        loopv(ents)
+        updateentindex();
+        loopv(triggerents)
         {
-            fpsentity &e = *(fpsentity *)ents[i];
+            fpsentity &e = *(fpsentity *)ents[triggerents[i]];
             if(e.type != ET_MAPMODEL || !validtrigger(e.attr3)) continue;
             if(e.attr4 == tag && e.triggerstate == oldstate && checktriggertype(e.attr3, TRIG_LOCKED))
             {
@@ -543,10 +595,11 @@ namespace entities
     void checktriggers()
     {
         if(player1->state != CS_ALIVE) return;
+        updateentindex();
         vec o = player1->feetpos();
-        loopv(ents)
+        loopv(triggerents)
         {
-            fpsentity &e = *(fpsentity *)ents[i];
+            fpsentity &e = *(fpsentity *)ents[triggerents[i]];
             if(e.type != ET_MAPMODEL || !validtrigger(e.attr3)) continue;
             switch(e.triggerstate)
             {
@@ -653,12 +706,11 @@ namespace entities
         switch(e.type)
         {
             case TELEPORT:
-                loopv(ents) if(ents[i]->type == TELEDEST && e.attr1==ents[i]->attr2)
-                {
-                    renderentarrow(e, vec(ents[i]->o).sub(e.o).normalize(), e.o.dist(ents[i]->o));
-                    break;
-                }
+            {
+                int td = findteledest(e.attr1);
+                if(td >= 0) renderentarrow(e, vec(ents[td]->o).sub(e.o).normalize(), e.o.dist(ents[td]->o));
                 break;
+            }
 
             case JUMPPAD:
                 renderentarrow(e, vec((int)(char)e.attr3*10.0f, (int)(char)e.attr2*10.0f, e.attr1*12.5f).normalize(), 4);
@@ -713,6 +765,7 @@ namespace entities
 
     void editent(int i, bool local)
     {
+        entindexdirty = true;
         extentity &e = *ents[i];
         if(e.type == ET_MAPMODEL && validtrigger(e.attr3))
         {
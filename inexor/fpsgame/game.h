@@ -416,7 +416,7 @@ enum
 	N_NEWMAP,				/// C2S|S2C  a client started a new map (requires editmode)
 	N_GETMAP,				/// C2S      a client downloaded the current map from server's map buffer (NOT ALWAYS UP TO DATE! MAP MUST BE SENT BEFORE DOWNLOADING!)
 	N_SENDMAP,				/// S2C      server sends map to client (requires coop mode. YOU CAN'T SEND MAPS IN INSTACTF e.g. (YET))
-	N_CLIPBOARD,			/// C2S      send copied data from your clipboard to server
+	N_CLIPBOARD,			/// C2S|S2C  send a chunk of the copied data from your clipboard to server
 	N_EDITVAR,				/// C2S|S2C  set map var value (requires editmode)
     N_MASTERMODE,			/// C2S      change master mode (requires permissions)
 	N_KICK,					/// C2S      kick a specific player
@@ -531,10 +531,14 @@ static const int msgsizes[] =
 #define INEXOR_SERVER_PORT 31415
 #define INEXOR_MASTER_PORT 31416
 
-#define PROTOCOL_VERSION 301            // bump when protocol changes last sauerbraten protocol was 259
+#define PROTOCOL_VERSION 302            // bump when protocol changes last sauerbraten protocol was 259
 #define DEMO_VERSION 1                  // bump when demo format changes
 #define DEMO_MAGIC "INEXOR_DEMO"
 
+/// clipboards and undos are streamed in chunks of at most EDITCHUNKSIZE compressed bytes
+#define EDITCHUNKSIZE (16*1024)
+#define MAXEDITPACKLEN (4*1024*1024)
+
 /// demos contain stored network messages of a game
 /// which can be replayed to review games
 struct demoheader
@@ -929,6 +933,8 @@ struct fpsent : dynent, fpsstate
     vec lastcollect;
     int frags, flags, deaths, totaldamage, totalshots;
     editinfo *edit;
+    editstream *editrecv;
+    int editrecvtype, editrecvpos;
     float deltayaw, deltapitch, deltaroll, newyaw, newpitch, newroll;
     int smoothmillis;
 
@@ -939,7 +945,7 @@ struct fpsent : dynent, fpsstate
 
     vec muzzle;
 
-    fpsent() : weight(100), clientnum(-1), privilege(PRIV_NONE), lastupdate(0), plag(0), ping(0), lifesequence(0), respawned(-1), suicided(-1), lastpain(0), attacksound(-1), attackchan(-1), idlesound(-1), idlechan(-1), frags(0), flags(0), deaths(0), totaldamage(0), totalshots(0), edit(NULL), smoothmillis(-1), playermodel(-1), ai(NULL), ownernum(-1), muzzle(-1, -1, -1)
+    fpsent() : weight(100), clientnum(-1), privilege(PRIV_NONE), lastupdate(0), plag(0), ping(0), lifesequence(0), respawned(-1), suicided(-1), lastpain(0), attacksound(-1), attackchan(-1), idlesound(-1), idlechan(-1), frags(0), flags(0), deaths(0), totaldamage(0), totalshots(0), edit(NULL), editrecv(NULL), editrecvtype(-1), editrecvpos(0), smoothmillis(-1), playermodel(-1), ai(NULL), ownernum(-1), muzzle(-1, -1, -1)
     {
         name[0] = team[0] = info[0] = 0;
         respawn();
@@ -947,6 +953,7 @@ struct fpsent : dynent, fpsstate
     ~fpsent()
     {
         freeeditinfo(edit);
+        closeeditstream(editrecv);
         if(attackchan >= 0) stopsound(attacksound, attackchan);
         if(idlechan >= 0) stopsound(idlesound, idlechan);
         if(ai) delete ai;
@@ -1251,8 +1258,9 @@ namespace game
         int id;
         entitylight light;
         int generation;
+        float floorz; // bombs only: where the floor under them was found after their last move, see weaponcollide()
 
-        bouncer() : bounces(0), roll(0), variant(0)
+        bouncer() : bounces(0), roll(0), variant(0), floorz(0)
         {
             type = ENT_BOUNCE;
         }
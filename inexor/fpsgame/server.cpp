@@ -63,7 +63,7 @@ namespace server
     {
         int id, gun;
         vec from, to;
-        vector<hitinfo> hits;
+        smallvector<hitinfo, 4> hits;
 
         void process(clientinfo *ci);
     };
@@ -71,7 +71,7 @@ namespace server
     struct explodeevent : timedevent
     {
         int id, gun;
-        vector<hitinfo> hits;
+        smallvector<hitinfo, 4> hits;
 
         bool keepable() const { return true; }
 
@@ -245,8 +245,9 @@ namespace server
         string clientmap;
         int mapcrc;
         bool warned, gameclip;
-        ENetPacket *getdemo, *getmap, *clipboard;
-        int lastclipboard, needclipboard;
+        ENetPacket *getdemo, *getmap;
+        vector<ENetPacket *> clipboard; // chunks as relayed to other clients
+        int lastclipboard, needclipboard, clipboardlen, clipboardpos;
         int connectauth;
         uint authreq;
         string authname, authdesc;
@@ -254,7 +255,7 @@ namespace server
         int authkickvictim;
         char *authkickreason;
 
-        clientinfo() : getdemo(NULL), getmap(NULL), clipboard(NULL), authchallenge(NULL), authkickreason(NULL) { reset(); }
+        clientinfo() : getdemo(NULL), getmap(NULL), authchallenge(NULL), authkickreason(NULL) { reset(); }
         ~clientinfo() { events.deletecontents(); cleanclipboard(); cleanauth(); }
 
         void addevent(gameevent *e)
@@ -330,7 +331,9 @@ namespace server
 
         void cleanclipboard(bool fullclean = true)
         {
-            if(clipboard) { if(--clipboard->referenceCount <= 0) enet_packet_destroy(clipboard); clipboard = NULL; }
+            loopv(clipboard) if(--clipboard[i]->referenceCount <= 0) enet_packet_destroy(clipboard[i]);
+            clipboard.setsize(0);
+            clipboardlen = clipboardpos = 0;
             if(fullclean) lastclipboard = 0;
         }
 
@@ -730,8 +733,43 @@ namespace server
     uint mcrc = 0;
     vector<entity> ments;
     vector<server_entity> sents;
+    vector<int> respawningents; // sents with a spawntime running, so serverupdate() need not walk all of them
     vector<savedscore> scores;
 
+    /// sets the respawn timer of sents[i], keeping respawningents in sync.
+    static void setspawntime(int i, int millis)
+    {
+        server_entity &e = sents[i];
+        if(millis && !e.spawntime) respawningents.add(i);
+        else if(!millis && e.spawntime) respawningents.removeobj(i);
+        e.spawntime = millis;
+    }
+
+    // the items of ments bucketed into a grid of 1<<PICKUPGRIDSHIFT sized cells, like the clients find them with,
+    // so a pickup can be checked to be claimed by a player close to the item.
+    static const int PICKUPGRIDSHIFT = 5;
+    static const float PICKUPDIST = 64; // from the eyes: the 12 units around the feet, the eye height and some lag
+    static hashtable<ivec2, smallvector<int, 4> > pickupgrid;
+
+    static inline ivec2 pickupcell(float x, float y)
+    {
+        return ivec2(int(floor(x))>>PICKUPGRIDSHIFT, int(floor(y))>>PICKUPGRIDSHIFT);
+    }
+
+    /// whether ci is close enough to pick up item i, items only known from N_ITEMLIST have no position to check.
+    static bool nearpickup(clientinfo *ci, int i)
+    {
+        if(!ments.inrange(i)) return true;
+        const vec &o = ci->state.o;
+        ivec2 cmin = pickupcell(o.x-PICKUPDIST, o.y-PICKUPDIST), cmax = pickupcell(o.x+PICKUPDIST, o.y+PICKUPDIST);
+        for(int y = cmin.y; y <= cmax.y; y++) for(int x = cmin.x; x <= cmax.x; x++)
+        {
+            smallvector<int, 4> *cell = pickupgrid.access(ivec2(x, y));
+            if(cell && cell->find(i) >= 0) return ments[i].o.dist(o) <= PICKUPDIST;
+        }
+        return false;
+    }
+
     int msgsizelookup(int msg)
     {
         static int sizetable[NUMMSG] = { -1 };
@@ -777,6 +815,8 @@ namespace server
         mcrc = 0;
         ments.setsize(0);
         sents.setsize(0);
+        respawningents.setsize(0);
+        pickupgrid.clear();
         //cps.reset();
     }
 
@@ -925,9 +965,9 @@ namespace server
     {
         if((m_timed && gamemillis>=gamelimit) || !sents.inrange(i) || !sents[i].spawned) return false;
         clientinfo *ci = getinfo(sender);
-        if(!ci || (!ci->local && !ci->state.canpickup(sents[i].type))) return false;
+        if(!ci || (!ci->local && (!ci->state.canpickup(sents[i].type) || !nearpickup(ci, i)))) return false;
         sents[i].spawned = false;
-        sents[i].spawntime = spawntime(sents[i].type);
+        setspawntime(i, spawntime(sents[i].type));
         sendf(-1, 1, "ri3", N_ITEMACC, i, sender);
         ci->state.pickup(sents[i].type);
         return true;
@@ -1975,8 +2015,9 @@ namespace server
             server_entity se = { NOTUSED, 0, false };
             while(sents.length()<=i) sents.add(se);
             sents[i].type = ments[i].type;
-            if(m_mp(gamemode) && delayspawn(sents[i].type)) sents[i].spawntime = spawntime(sents[i].type);
+            if(m_mp(gamemode) && delayspawn(sents[i].type)) setspawntime(i, spawntime(sents[i].type));
             else sents[i].spawned = true;
+            pickupgrid[pickupcell(ments[i].o.x, ments[i].o.y)].add(i);
         }
         notgotitems = false;
     }
@@ -2486,19 +2527,22 @@ namespace server
                 processevents();
                 if(curtime)
                 {
-                    loopv(sents) if(sents[i].spawntime) // spawn entities when timer reached
+                    loopv(respawningents) // spawn entities when timer reached
                     {
-                        int oldtime = sents[i].spawntime;
-                        sents[i].spawntime -= curtime;
-                        if(sents[i].spawntime<=0)
+                        int n = respawningents[i];
+                        server_entity &e = sents[n];
+                        int oldtime = e.spawntime;
+                        e.spawntime -= curtime;
+                        if(e.spawntime<=0)
                         {
-                            sents[i].spawntime = 0;
-                            sents[i].spawned = true;
-                            sendf(-1, 1, "ri2", N_ITEMSPAWN, i);
+                            e.spawntime = 0;
+                            e.spawned = true;
+                            respawningents.removeunordered(i--);
+                            sendf(-1, 1, "ri2", N_ITEMSPAWN, n);
                         }
-                        else if(sents[i].spawntime<=10000 && oldtime>10000 && (sents[i].type==I_QUAD || sents[i].type==I_BOOST))
+                        else if(e.spawntime<=10000 && oldtime>10000 && (e.type==I_QUAD || e.type==I_BOOST))
                         {
-                            sendf(-1, 1, "ri2", N_ANNOUNCE, sents[i].type);
+                            sendf(-1, 1, "ri2", N_ANNOUNCE, e.type);
                         }
                     }
                 }
@@ -2900,7 +2944,7 @@ namespace server
 
     void sendclipboard(clientinfo *ci)
     {
-        if(!ci->lastclipboard || !ci->clipboard) return;
+        if(!ci->lastclipboard || ci->clipboard.empty() || ci->clipboardlen < 0) return;
         bool flushed = false;
         loopv(clients)
         {
@@ -2908,7 +2952,7 @@ namespace server
             if(e.clientnum != ci->clientnum && e.needclipboard - ci->lastclipboard >= 0)
             {
                 if(!flushed) { flushserver(true); flushed = true; }
-                sendpacket(e.clientnum, 1, ci->clipboard);
+                loopvj(ci->clipboard) sendpacket(e.clientnum, 1, ci->clipboard[j]);
             }
         }
     }
@@ -3350,7 +3394,7 @@ namespace server
                     sents[n].type = getint(p);
                     if(canspawnitem(sents[n].type))
                     {
-                        if(m_mp(gamemode) && delayspawn(sents[n].type)) sents[n].spawntime = spawntime(sents[n].type);
+                        if(m_mp(gamemode) && delayspawn(sents[n].type)) setspawntime(n, spawntime(sents[n].type));
                         else sents[n].spawned = true;
                     }
                 }
@@ -3374,7 +3418,7 @@ namespace server
                     sents[i].type = type;
                     if(canspawn ? !sents[i].spawned : (sents[i].spawned || sents[i].spawntime))
                     {
-                        sents[i].spawntime = canspawn ? 1 : 0;
+                        setspawntime(i, canspawn ? 1 : 0);
                         sents[i].spawned = false;
                     }
                 }
@@ -3671,26 +3715,34 @@ namespace server
     
             case N_CLIPBOARD:
             {
-                int unpacklen = getint(p), packlen = getint(p); 
-                ci->cleanclipboard(false);
+                int unpacklen = getint(p), packlen = getint(p), offset = getint(p), len = getint(p);
+                if(len < 0 || len > EDITCHUNKSIZE || p.remaining() < len) { disconnect_client(sender, DISC_MSGERR); return; }
+                if(!offset) ci->cleanclipboard(false);
                 if(ci->state.state==CS_SPECTATOR)
                 {
-                    if(packlen > 0) p.subbuf(packlen);
+                    p.subbuf(len);
                     break;
                 }
-                if(packlen <= 0 || packlen > (1<<16) || unpacklen <= 0) 
+                // packlen is only set on the last chunk, the payload is deflated while it is sent
+                if(packlen < 0 || packlen > MAXEDITPACKLEN || unpacklen <= 0 || offset != ci->clipboardpos || offset + len > MAXEDITPACKLEN || (packlen && offset + len != packlen))
                 {
-                    if(packlen > 0) p.subbuf(packlen);
-                    packlen = unpacklen = 0;
+                    p.subbuf(len);
+                    ci->cleanclipboard(false);
+                    packlen = unpacklen = offset = len = 0;
                 }
-                packetbuf q(32 + packlen, ENET_PACKET_FLAG_RELIABLE);
+                packetbuf q(32 + len, ENET_PACKET_FLAG_RELIABLE);
                 putint(q, N_CLIPBOARD);
                 putint(q, ci->clientnum);
                 putint(q, unpacklen);
-                putint(q, packlen); 
-                if(packlen > 0) p.get(q.subbuf(packlen).buf, packlen);
-                ci->clipboard = q.finalize();
-                ci->clipboard->referenceCount++;
+                putint(q, packlen);
+                putint(q, offset);
+                putint(q, len);
+                if(len > 0) p.get(q.subbuf(len).buf, len);
+                ENetPacket *chunk = q.finalize();
+                chunk->referenceCount++;
+                ci->clipboard.add(chunk);
+                ci->clipboardlen = unpacklen > 0 && !packlen ? -1 : packlen;
+                ci->clipboardpos = offset + len;
                 break;
             } 
 
@@ -3712,19 +3764,21 @@ namespace server
             case N_UNDO:
             case N_REDO:
             {
-                int unpacklen = getint(p), packlen = getint(p);
-                if(!ci || ci->state.state==CS_SPECTATOR || packlen <= 0 || packlen > (1<<16) || unpacklen <= 0)
+                int unpacklen = getint(p), packlen = getint(p), offset = getint(p), len = getint(p);
+                if(len < 0 || len > EDITCHUNKSIZE || p.remaining() < len) { disconnect_client(sender, DISC_MSGERR); return; }
+                if(!ci || ci->state.state==CS_SPECTATOR || packlen < 0 || packlen > MAXEDITPACKLEN || unpacklen <= 0 || offset < 0 || offset + len > MAXEDITPACKLEN || (packlen && offset + len != packlen))
                 {
-                    if(packlen > 0) p.subbuf(packlen);
+                    p.subbuf(len);
                     break;
                 }
-                if(p.remaining() < packlen) { disconnect_client(sender, DISC_MSGERR); return; }
-                packetbuf q(32 + packlen, ENET_PACKET_FLAG_RELIABLE);
+                packetbuf q(32 + len, ENET_PACKET_FLAG_RELIABLE);
                 putint(q, type);
                 putint(q, ci->clientnum);
                 putint(q, unpacklen);
                 putint(q, packlen);
-                if(packlen > 0) p.get(q.subbuf(packlen).buf, packlen);
+                putint(q, offset);
+                putint(q, len);
+                if(len > 0) p.get(q.subbuf(len).buf, len);
                 sendpacket(-1, 1, q.finalize(), ci->clientnum);
                 break;
             }
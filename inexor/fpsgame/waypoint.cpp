@@ -35,341 +35,221 @@ namespace ai
         return weight;
     }
 
-    enum
+    /// waypoints are indexed in a uniform grid of cells hashed by position.
+    /// new waypoints are inserted as they are dropped and remapping removes the deleted ones in place,
+    /// only loading or moving all waypoints throws the grid away, and rebuilding it is a single pass.
+    #define WPGRIDSHIFT 6
+
+    struct wpgridbucket
     {
-        WPCACHE_STATIC = 0,
-        WPCACHE_DYNAMIC,
-        NUMWPCACHES
+        vector<ushort> waypoints;
     };
 
-    struct wpcache
-    {
-        struct node
-        {
-            float split[2];
-            uint child[2];
+    static vector<wpgridbucket> wpgridcells;
+    static hashtable<ivec, int> wpgrid;
+    static ivec wpgridmin(0, 0, 0), wpgridmax(-1, -1, -1);
+    static int wpgridcount = 1; // waypoints below this are in the grid, the first one is never used
+    static bool wpavoiddirty = false;
 
-            int axis() const { return child[0]>>30; }
-            int childindex(int which) const { return child[which]&0x3FFFFFFF; }
-            bool isleaf(int which) const { return (child[1]&(1<<(30+which)))!=0; }
-        };
+    avoidset wpavoid;
 
-        vector<node> nodes;
-        int firstwp, lastwp;
-        vec bbmin, bbmax;
+    static inline ivec wpgridcell(const vec &o)
+    {
+        return ivec(int(floorf(o.x)), int(floorf(o.y)), int(floorf(o.z))).shr(WPGRIDSHIFT);
+    }
 
-        wpcache() { clear(); }
+    static void clearwpgrid()
+    {
+        wpgridcells.setsize(0);
+        wpgrid.clear();
+        wpgridmin = ivec(0, 0, 0);
+        wpgridmax = ivec(-1, -1, -1);
+        wpgridcount = 1;
+        wpavoid.clear();
+        wpavoiddirty = false;
+    }
 
-        void clear()
+    static void insertwpgrid(int wp)
+    {
+        const waypoint &w = waypoints[wp];
+        ivec cell = wpgridcell(w.o);
+        int *index = wpgrid.access(cell);
+        if(!index)
         {
-            nodes.setsize(0);
-            firstwp = lastwp = -1;
-            bbmin = vec(1e16f, 1e16f, 1e16f);
-            bbmax = vec(-1e16f, -1e16f, -1e16f);
+            index = &wpgrid[cell];
+            *index = wpgridcells.length();
+            wpgridcells.add();
+            if(wpgridmin.x > wpgridmax.x) wpgridmin = wpgridmax = cell;
+            else { wpgridmin.min(cell); wpgridmax.max(cell); }
         }
+        wpgridcells[*index].waypoints.add(wp);
+        if(w.weight < 0) wpavoiddirty = true;
+    }
 
-        void build(int first = 0, int last = -1)
+    /// drops deleted waypoints from the grid and renumbers the rest, see remapwaypoints().
+    static void remapwpgrid(const vector<ushort> &remap)
+    {
+        loopv(wpgridcells)
         {
-            if(last < 0) last = waypoints.length();
-            vector<int> indices;
-            for(int i = first; i < last; i++)
-            {
-                waypoint &w = waypoints[i];
-                indices.add(i);
-                if(firstwp < 0) firstwp = i;
-                float radius = WAYPOINTRADIUS;
-                bbmin.min(vec(w.o).sub(radius));
-                bbmax.max(vec(w.o).add(radius));
-            }
-            if(first < last) lastwp = max(lastwp, last-1);
-            if(indices.length())
-            {
-                nodes.reserve(indices.length());
-                build(indices.getbuf(), indices.length(), bbmin, bbmax);
-            }
+            vector<ushort> &cell = wpgridcells[i].waypoints;
+            int k = 0;
+            loopvj(cell) if(remap[cell[j]]) cell[k++] = remap[cell[j]];
+            cell.setsize(k);
         }
+        int count = 1;
+        for(int i = 1; i < wpgridcount; i++) if(remap[i]) count++;
+        wpgridcount = count;
+        wpavoiddirty = true;
+    }
 
-        void build(int *indices, int numindices, const vec &vmin, const vec &vmax)
+    static void updatewpgrid()
+    {
+        if(wpgridcount > waypoints.length()) clearwpgrid();
+        for(; wpgridcount < waypoints.length(); wpgridcount++) insertwpgrid(wpgridcount);
+        if(wpavoiddirty)
         {
-            int axis = 2;
-            loopk(2) if(vmax[k] - vmin[k] > vmax[axis] - vmin[axis]) axis = k;
-
-            vec leftmin(1e16f, 1e16f, 1e16f), leftmax(-1e16f, -1e16f, -1e16f), rightmin(1e16f, 1e16f, 1e16f), rightmax(-1e16f, -1e16f, -1e16f);
-            float split = 0.5f*(vmax[axis] + vmin[axis]), splitleft = -1e16f, splitright = 1e16f;
-            int left, right;
-            for(left = 0, right = numindices; left < right;)
-            {
-                waypoint &w = waypoints[indices[left]];
-                float radius = WAYPOINTRADIUS;
-                if(max(split - (w.o[axis]-radius), 0.0f) > max((w.o[axis]+radius) - split, 0.0f))
-                {
-                    ++left;
-                    splitleft = max(splitleft, w.o[axis]+radius);
-                    leftmin.min(vec(w.o).sub(radius));
-                    leftmax.max(vec(w.o).add(radius));
-                }
-                else
-                {
-                    --right;
-                    swap(indices[left], indices[right]);
-                    splitright = min(splitright, w.o[axis]-radius);
-                    rightmin.min(vec(w.o).sub(radius));
-                    rightmax.max(vec(w.o).add(radius));
-                }
-            }
-
-            if(!left || right==numindices)
-            {
-                leftmin = rightmin = vec(1e16f, 1e16f, 1e16f);
-                leftmax = rightmax = vec(-1e16f, -1e16f, -1e16f);
-                left = right = numindices/2;
-                splitleft = -1e16f;
-                splitright = 1e16f;
-                loopi(numindices)
-                {
-                    waypoint &w = waypoints[indices[i]];
-                    float radius = WAYPOINTRADIUS;
-                    if(i < left)
-                    {
-                        splitleft = max(splitleft, w.o[axis]+radius);
-                        leftmin.min(vec(w.o).sub(radius));
-                        leftmax.max(vec(w.o).add(radius));
-                    }
-                    else
-                    {
-                        splitright = min(splitright, w.o[axis]-radius);
-                        rightmin.min(vec(w.o).sub(radius));
-                        rightmax.max(vec(w.o).add(radius));
-                    }
-                }
-            }
-
-            int offset = nodes.length();
-            node &curnode = nodes.add();
-            curnode.split[0] = splitleft;
-            curnode.split[1] = splitright;
+            wpavoiddirty = false;
+            wpavoid.clear();
+            loopv(waypoints) if(waypoints[i].weight < 0) wpavoid.avoidnear(NULL, waypoints[i].o.z + WAYPOINTRADIUS, waypoints[i].o, WAYPOINTRADIUS);
+        }
+    }
 
-            if(left<=1) curnode.child[0] = (axis<<30) | (left>0 ? indices[0] : 0x3FFFFFFF);
-            else
-            {
-                curnode.child[0] = (axis<<30) | (nodes.length()-offset);
-                if(left) build(indices, left, leftmin, leftmax);
-            }
+    static void clearroutecache();
 
-            if(numindices-right<=1) curnode.child[1] = (1<<31) | (left<=1 ? 1<<30 : 0) | (numindices-right>0 ? indices[right] : 0x3FFFFFFF);
-            else
-            {
-                curnode.child[1] = (left<=1 ? 1<<30 : 0) | (nodes.length()-offset);
-                if(numindices-right) build(&indices[right], numindices-right, rightmin, rightmax);
-            }
-        }
-    } wpcaches[NUMWPCACHES];
+    static void clearwpclusters();
 
-    static int invalidatedwpcaches = 0, clearedwpcaches = (1<<NUMWPCACHES)-1, numinvalidatewpcaches = 0, lastwpcache = 0;
+    void clearwpcache(bool full = true)
+    {
+        clearroutecache();
+        clearwpclusters();
+        if(full) clearwpgrid();
+    }
+    ICOMMAND(clearwpcache, "", (), clearwpcache());
 
-    static inline void invalidatewpcache(int wp)
+    /// runs body for every waypoint index wp in the cells overlapping the box of radius around pos.
+    #define LOOPWPGRID(pos, radius, body) do { \
+        ivec lo = wpgridcell(vec(pos).sub(radius)).max(wpgridmin), hi = wpgridcell(vec(pos).add(radius)).min(wpgridmax); \
+        for(int z = lo.z; z <= hi.z; z++) for(int y = lo.y; y <= hi.y; y++) for(int x = lo.x; x <= hi.x; x++) \
+        { \
+            int *index = wpgrid.access(ivec(x, y, z)); \
+            if(!index) continue; \
+            const vector<ushort> &cell = wpgridcells[*index].waypoints; \
+            loopv(cell) { int wp = cell[i]; body; } \
+        } \
+    } while(0)
+
+    /// visits the cells at chebyshev distance r from center, clamped to the occupied part of the grid.
+    template<class F> static inline void loopwpgridshell(const ivec &center, int r, F &check)
     {
-        if(++numinvalidatewpcaches >= 1000) { numinvalidatewpcaches = 0; invalidatedwpcaches = (1<<NUMWPCACHES)-1; }
-        else
+        ivec lo = ivec(center).sub(r).max(wpgridmin), hi = ivec(center).add(r).min(wpgridmax);
+        for(int z = lo.z; z <= hi.z; z++) for(int y = lo.y; y <= hi.y; y++)
         {
-            loopi(WPCACHE_DYNAMIC) if(wp >= wpcaches[i].firstwp && wp <= wpcaches[i].lastwp) { invalidatedwpcaches |= 1<<i; return; }
-            invalidatedwpcaches |= 1<<WPCACHE_DYNAMIC;
+            int step = r > 0 && abs(z - center.z) < r && abs(y - center.y) < r ? 2*r : 1;
+            for(int x = center.x - r; x <= center.x + r; x += step)
+            {
+                if(x < lo.x || x > hi.x) continue;
+                int *index = wpgrid.access(ivec(x, y, z));
+                if(index) check(wpgridcells[*index].waypoints);
+            }
         }
     }
 
-    void clearwpcache(bool full = true)
+    /// keeps the k closest waypoints seen so far, sorted by distance.
+    struct wpnearest
     {
-        loopi(NUMWPCACHES) if(full || invalidatedwpcaches&(1<<i)) { wpcaches[i].clear(); clearedwpcaches |= 1<<i; }
-        if(full || invalidatedwpcaches == (1<<NUMWPCACHES)-1)
-	      {
-            numinvalidatewpcaches = 0;
-            lastwpcache = 0;
-        }
-        invalidatedwpcaches = 0;
-	  }
-    ICOMMAND(clearwpcache, "", (), clearwpcache());
+        const vec &pos;
+        float maxdist2;
+        bool links;
+        int k, num;
+        int *results;
+        float *dists;
 
-    avoidset wpavoid;
+        wpnearest(const vec &pos, float maxdist, bool links, int k, int *results, float *dists) : pos(pos), maxdist2(maxdist*maxdist), links(links), k(k), num(0), results(results), dists(dists) {}
 
-    void buildwpcache()
-    {
-        loopi(NUMWPCACHES) if(wpcaches[i].firstwp < 0)
-            wpcaches[i].build(i > 0 ? wpcaches[i-1].lastwp+1 : 1, i+1 >= NUMWPCACHES || wpcaches[i+1].firstwp < 0 ? -1 : wpcaches[i+1].firstwp);
-        clearedwpcaches = 0;
-        lastwpcache = waypoints.length();
+        float limit() const { return num < k ? maxdist2 : dists[num-1]; }
 
-		    wpavoid.clear();
-		    loopv(waypoints) if(waypoints[i].weight < 0) wpavoid.avoidnear(NULL, waypoints[i].o.z + WAYPOINTRADIUS, waypoints[i].o, WAYPOINTRADIUS);
-    }
-
-    struct wpcachestack
-    {
-        wpcache::node *node;
-        float tmin, tmax;
+        void operator()(const vector<ushort> &cell)
+        {
+            loopv(cell)
+            {
+                const waypoint &w = waypoints[cell[i]];
+                if(links && !w.links[0]) continue;
+                float dist = w.o.squaredist(pos);
+                if(dist >= limit()) continue;
+                int j = num < k ? num++ : num-1;
+                for(; j > 0 && dists[j-1] > dist; j--) { dists[j] = dists[j-1]; results[j] = results[j-1]; }
+                dists[j] = dist;
+                results[j] = cell[i];
+            }
+        }
     };
 
-    vector<wpcache::node *> wpcachestack;
+    /// expands shells of cells around pos until no closer waypoint can be found.
+    static int findnearest(const vec &pos, float maxdist, bool links, int k, int *results)
+    {
+        if(k <= 0 || wpgridmin.x > wpgridmax.x) return 0;
+        float stackdists[16], *dists = k <= 16 ? stackdists : new float[k];
+        wpnearest check(pos, maxdist, links, k, results, dists);
+        ivec center = wpgridcell(pos);
+        ivec far = ivec(center).sub(wpgridmin).abs().max(ivec(wpgridmax).sub(center).abs());
+        int maxr = min((int(ceilf(maxdist)) >> WPGRIDSHIFT) + 1, max(far.x, max(far.y, far.z)));
+        for(int r = 0; r <= maxr; r++)
+        {
+            // everything beyond this shell is at least r cells away from pos
+            if(r > 0)
+            {
+                float mindist = float((r - 1) << WPGRIDSHIFT);
+                if(mindist*mindist >= check.limit()) break;
+            }
+            loopwpgridshell(center, r, check);
+        }
+        if(dists != stackdists) delete[] dists;
+        return check.num;
+    }
 
     int closestwaypoint(const vec &pos, float mindist, bool links, fpsent *d)
     {
         if(waypoints.empty()) return -1;
-        if(clearedwpcaches) buildwpcache();
-
-        #define CHECKCLOSEST(index) do { \
-            int n = (index); \
-            if(n < waypoints.length()) \
-            { \
-                const waypoint &w = waypoints[n]; \
-                if(!links || w.links[0]) \
-                { \
-                    float dist = w.o.squaredist(pos); \
-                    if(dist < mindist*mindist) { closest = n; mindist = sqrtf(dist); } \
-                } \
-            } \
-        } while(0)
+        updatewpgrid();
         int closest = -1;
-        wpcache::node *curnode;
-        loop(which, NUMWPCACHES) if(wpcaches[which].firstwp >= 0) for(curnode = &wpcaches[which].nodes[0], wpcachestack.setsize(0);;)
+        return findnearest(pos, mindist, links, 1, &closest) ? closest : -1;
+    }
+
+    void closestwaypoints(const vec *pos, int num, float mindist, bool links, int k, int *results)
+    {
+        if(k <= 0 || num <= 0) return;
+        if(waypoints.empty()) { loopi(num*k) results[i] = -1; return; }
+        updatewpgrid();
+        loopi(num)
         {
-            int axis = curnode->axis();
-            float dist1 = pos[axis] - curnode->split[0], dist2 = curnode->split[1] - pos[axis];
-            if(dist1 >= mindist)
-            {
-                if(dist2 < mindist)
-                {
-                    if(!curnode->isleaf(1)) { curnode += curnode->childindex(1); continue; }
-                    CHECKCLOSEST(curnode->childindex(1));
-                }
-            }
-            else if(curnode->isleaf(0))
-            {
-                CHECKCLOSEST(curnode->childindex(0));
-                if(dist2 < mindist)
-                {
-                    if(!curnode->isleaf(1)) { curnode += curnode->childindex(1); continue; }
-                    CHECKCLOSEST(curnode->childindex(1));
-                }
-            }
-            else
-            {
-                if(dist2 < mindist)
-                {
-                    if(!curnode->isleaf(1)) wpcachestack.add(curnode + curnode->childindex(1));
-                    else CHECKCLOSEST(curnode->childindex(1));
-                }
-                curnode += curnode->childindex(0);
-                continue;
-            }
-            if(wpcachestack.empty()) break;
-            curnode = wpcachestack.pop();
+            int *nearest = &results[i*k];
+            for(int j = findnearest(pos[i], mindist, links, k, nearest); j < k; j++) nearest[j] = -1;
         }
-        for(int i = lastwpcache; i < waypoints.length(); i++) { CHECKCLOSEST(i); }
-        return closest;
     }
 
     void findwaypointswithin(const vec &pos, float mindist, float maxdist, vector<int> &results)
     {
         if(waypoints.empty()) return;
-        if(clearedwpcaches) buildwpcache();
+        updatewpgrid();
 
         float mindist2 = mindist*mindist, maxdist2 = maxdist*maxdist;
-        #define CHECKWITHIN(index) do { \
-            int n = (index); \
-            if(n < waypoints.length()) \
-            { \
-                const waypoint &w = waypoints[n]; \
-                float dist = w.o.squaredist(pos); \
-                if(dist > mindist2 && dist < maxdist2) results.add(n); \
-            } \
-        } while(0)
-        wpcache::node *curnode;
-        loop(which, NUMWPCACHES) if(wpcaches[which].firstwp >= 0) for(curnode = &wpcaches[which].nodes[0], wpcachestack.setsize(0);;)
-        {
-            int axis = curnode->axis();
-            float dist1 = pos[axis] - curnode->split[0], dist2 = curnode->split[1] - pos[axis];
-            if(dist1 >= maxdist)
-            {
-                if(dist2 < maxdist)
-                {
-                    if(!curnode->isleaf(1)) { curnode += curnode->childindex(1); continue; }
-                    CHECKWITHIN(curnode->childindex(1));
-                }
-            }
-            else if(curnode->isleaf(0))
-            {
-                CHECKWITHIN(curnode->childindex(0));
-                if(dist2 < maxdist)
-                {
-                    if(!curnode->isleaf(1)) { curnode += curnode->childindex(1); continue; }
-                    CHECKWITHIN(curnode->childindex(1));
-                }
-            }
-            else
-            {
-                if(dist2 < maxdist)
-                {
-                    if(!curnode->isleaf(1)) wpcachestack.add(curnode + curnode->childindex(1));
-                    else CHECKWITHIN(curnode->childindex(1));
-                }
-                curnode += curnode->childindex(0);
-                continue;
-            }
-            if(wpcachestack.empty()) break;
-            curnode = wpcachestack.pop();
-        }
-        for(int i = lastwpcache; i < waypoints.length(); i++) { CHECKWITHIN(i); }
+        LOOPWPGRID(pos, maxdist,
+        {
+            float dist = waypoints[wp].o.squaredist(pos);
+            if(dist > mindist2 && dist < maxdist2) results.add(wp);
+        });
     }
 
     void avoidset::avoidnear(void *owner, float above, const vec &pos, float limit)
     {
         if(ai::waypoints.empty()) return;
-        if(clearedwpcaches) buildwpcache();
+        updatewpgrid();
 
         float limit2 = limit*limit;
-        #define CHECKNEAR(index) do { \
-            int n = (index); \
-            if(n < ai::waypoints.length()) \
-            { \
-                const waypoint &w = ai::waypoints[n]; \
-                if(w.o.squaredist(pos) < limit2) add(owner, above, n); \
-            } \
-        } while(0)
-        wpcache::node *curnode;
-        loop(which, NUMWPCACHES) if(wpcaches[which].firstwp >= 0) for(curnode = &wpcaches[which].nodes[0], wpcachestack.setsize(0);;)
-        {
-            int axis = curnode->axis();
-            float dist1 = pos[axis] - curnode->split[0], dist2 = curnode->split[1] - pos[axis];
-            if(dist1 >= limit)
-            {
-                if(dist2 < limit)
-                {
-                    if(!curnode->isleaf(1)) { curnode += curnode->childindex(1); continue; }
-                    CHECKNEAR(curnode->childindex(1));
-                }
-            }
-            else if(curnode->isleaf(0))
-            {
-                CHECKNEAR(curnode->childindex(0));
-                if(dist2 < limit)
-                {
-                    if(!curnode->isleaf(1)) { curnode += curnode->childindex(1); continue; }
-                    CHECKNEAR(curnode->childindex(1));
-                }
-            }
-            else
-            {
-                if(dist2 < limit)
-                {
-                    if(!curnode->isleaf(1)) wpcachestack.add(curnode + curnode->childindex(1));
-                    else CHECKNEAR(curnode->childindex(1));
-                }
-                curnode += curnode->childindex(0);
-                continue;
-            }
-            if(wpcachestack.empty()) break;
-            curnode = wpcachestack.pop();
-        }
-        for(int i = lastwpcache; i < waypoints.length(); i++) { CHECKNEAR(i); }
+        LOOPWPGRID(pos, limit,
+        {
+            if(ai::waypoints[wp].o.squaredist(pos) < limit2) add(owner, above, wp);
+        });
     }
 
     int avoidset::remap(fpsent *d, int n, vec &pos, bool retry)
@@ -420,95 +300,438 @@ namespace ai
         return n;
     }
 
-    static inline float heapscore(waypoint *q) { return q->score(); }
+    /// open set of route(), a binary heap whose nodes know their index in it, so lowering a score doesn't need a search.
+    template<class T> struct routequeue
+    {
+        vector<T *> heap;
 
-    bool route(fpsent *d, int node, int goal, vector<int> &route, const avoidset &obstacles, int retries)
+        bool empty() const { return heap.empty(); }
+        void clear() { heap.setsize(0); }
+
+        void place(T *w, int i)
+        {
+            heap[i] = w;
+            w->heapindex = i;
+        }
+
+        void up(int i)
+        {
+            T *w = heap[i];
+            int score = w->score();
+            while(i > 0)
+            {
+                int pi = (i - 1) >> 1;
+                if(score >= heap[pi]->score()) break;
+                place(heap[pi], i);
+                i = pi;
+            }
+            place(w, i);
+        }
+
+        void down(int i)
+        {
+            T *w = heap[i];
+            int score = w->score();
+            for(;;)
+            {
+                int ci = (i << 1) + 1;
+                if(ci >= heap.length()) break;
+                if(ci+1 < heap.length() && heap[ci+1]->score() < heap[ci]->score()) ci++;
+                if(score <= heap[ci]->score()) break;
+                place(heap[ci], i);
+                i = ci;
+            }
+            place(w, i);
+        }
+
+        void add(T *w)
+        {
+            heap.add(w);
+            up(heap.length()-1);
+        }
+
+        /// w already is in the heap but its score got lower.
+        void update(T *w) { up(w->heapindex); }
+
+        T *remove()
+        {
+            T *w = heap[0], *last = heap.pop();
+            if(heap.length())
+            {
+                place(last, 0);
+                down(0);
+            }
+            w->heapindex = -1;
+            return w;
+        }
+    };
+
+    /// results of route() are shared between all bots until the waypoints change.
+    /// besides start and goal a route only depends on the waypoints it was told to avoid, so these are part of the key.
+    /// the key only holds a hash of the sorted avoided waypoints, a hit is confirmed against the list stored with the route.
+    struct routekey
     {
-        if(waypoints.empty() || !iswaypoint(node) || !iswaypoint(goal) || goal == node || !waypoints[node].links[0])
-            return false;
+        ushort node, goal;
+        uint blocked;
+        int numblocked;
+    };
+
+    static inline uint hthash(const routekey &k) { return (uint(k.node)<<16) ^ k.goal ^ k.blocked; }
+    static inline bool htcmp(const routekey &x, const routekey &y)
+    {
+        return x.node == y.node && x.goal == y.goal && x.blocked == y.blocked && x.numblocked == y.numblocked;
+    }
+
+    struct cachedroute
+    {
+        int offset, len;
+        int blocked; ///< offset of the sorted avoided waypoints in routecachebuf, numblocked of them
+    };
+
+    /// maximum number of waypoints stored in the route cache before it gets flushed, 0 disables it.
+    VAR(routecachesize, 0, 1<<16, 1<<22);
+
+    static hashtable<routekey, cachedroute> routecache;
+    static vector<ushort> routecachebuf;
+    static SDL_SpinLock routecachelock = 0; ///< routes are also searched on the worker threads, see planroutes()
+
+    static void clearroutecache()
+    {
+        routecache.clear();
+        routecachebuf.setsize(0);
+    }
+
+    /// waypoints are grouped into clusters by position, long routes are first searched on the much smaller graph
+    /// of clusters and then refined on the waypoints of the clusters along the way.
+    static const float WAYPOINTCLUSTERSIZE = 256;
+
+    /// routes between waypoints further apart than this are searched hierarchically, 0 always searches all waypoints.
+    VAR(routeclusterdist, 0, 1024, 1<<16);
+
+    struct clusterlink
+    {
+        int cluster;
+        float cost;
+    };
+
+    struct wpcluster
+    {
+        ivec cell;
+        vec center;
+        int numwaypoints;
+        vector<clusterlink> links;
+
+        wpcluster(const ivec &cell) : cell(cell), center(0, 0, 0), numwaypoints(0) {}
+    };
+
+    static vector<wpcluster> wpclusters;
+    static hashtable<ivec, int> wpclustercells;
+    static vector<int> wpclusterof;
+    static vector<ivec2> wpclusterlinks; // links made since the clusters were last updated
 
-        static ushort routeid = 1;
-        static vector<waypoint *> queue;
+    static void clearwpclusters()
+    {
+        wpclusters.setsize(0);
+        wpclustercells.clear();
+        wpclusterof.setsize(0);
+        wpclusterlinks.setsize(0);
+    }
 
-        if(!routeid)
+    static void linkwpclusters(int from, int to)
+    {
+        int a = wpclusterof[from], b = wpclusterof[to];
+        if(a == b || a < 0 || b < 0) return;
+        wpcluster &ca = wpclusters[a], &cb = wpclusters[b];
+        float cost = ca.center.dist(waypoints[from].o) + waypoints[from].o.dist(waypoints[to].o)*max(waypoints[to].weight, 1) + waypoints[to].o.dist(cb.center);
+        loopv(ca.links) if(ca.links[i].cluster == b)
         {
-            loopv(waypoints) waypoints[i].route = 0;
-            routeid = 1;
+            ca.links[i].cost = min(ca.links[i].cost, cost);
+            return;
         }
+        clusterlink &l = ca.links.add();
+        l.cluster = b;
+        l.cost = cost;
+    }
 
-        if(d)
+    /// brings the clusters up to date with the waypoints, only new waypoints and links are added.
+    /// costs between clusters are estimates from the cluster centers at the time a link was seen.
+    static void updatewpclusters()
+    {
+        int first = wpclusterof.length();
+        if(first > waypoints.length()) { clearwpclusters(); first = 0; }
+        if(first >= waypoints.length() && wpclusterlinks.empty()) return;
+        for(int i = first; i < waypoints.length(); i++)
         {
-            if(retries <= 1 && d->ai) loopi(ai::NUMPREVNODES) if(d->ai->prevnodes[i] != node && iswaypoint(d->ai->prevnodes[i]))
+            if(!i) { wpclusterof.add(-1); continue; }
+            const vec &o = waypoints[i].o;
+            ivec cell(int(floorf(o.x/WAYPOINTCLUSTERSIZE)), int(floorf(o.y/WAYPOINTCLUSTERSIZE)), int(floorf(o.z/WAYPOINTCLUSTERSIZE)));
+            int *index = wpclustercells.access(cell);
+            if(!index)
             {
-                waypoints[d->ai->prevnodes[i]].route = routeid;
-                waypoints[d->ai->prevnodes[i]].curscore = -1;
-                waypoints[d->ai->prevnodes[i]].estscore = 0;
+                index = &wpclustercells[cell];
+                *index = wpclusters.length();
+                wpclusters.add(wpcluster(cell));
             }
-			if(retries <= 0)
-			{
-            loopavoid(obstacles, d,
+            wpcluster &c = wpclusters[*index];
+            c.numwaypoints++;
+            c.center.add(vec(o).sub(c.center).div(c.numwaypoints));
+            wpclusterof.add(*index);
+        }
+        if(!first)
+        {
+            wpclusterlinks.setsize(0);
+            for(int i = 1; i < waypoints.length(); i++) loopj(MAXWAYPOINTLINKS)
+            {
+                int link = waypoints[i].links[j];
+                if(!link) break;
+                if(iswaypoint(link)) linkwpclusters(i, link);
+            }
+        }
+        else
+        {
+            for(int i = first; i < waypoints.length(); i++) loopj(MAXWAYPOINTLINKS)
             {
-					if(iswaypoint(wp) && wp != node && wp != goal && waypoints[node].find(wp) < 0 && waypoints[goal].find(wp) < 0)
+                int link = waypoints[i].links[j];
+                if(!link) break;
+                if(iswaypoint(link)) linkwpclusters(i, link);
+            }
+            loopv(wpclusterlinks) if(iswaypoint(wpclusterlinks[i].x) && iswaypoint(wpclusterlinks[i].y))
+                linkwpclusters(wpclusterlinks[i].x, wpclusterlinks[i].y);
+            wpclusterlinks.setsize(0);
+        }
+    }
+
+    /// the scores of a waypoint or cluster while a route is searched.
+    struct searchnode
+    {
+        float curscore, estscore;
+        int route, prev, heapindex;
+
+        searchnode() : route(0), prev(-1), heapindex(-1) {}
+
+        int score() const { return int(curscore) + int(estscore); }
+    };
+
+    /// all a route search writes to, kept out of the waypoints and clusters so routes can be searched on several threads at once.
+    struct routesearch
+    {
+        vector<searchnode> nodes, clusters;
+        vector<int> corridor;
+        vector<ushort> blocked;
+        routequeue<searchnode> queue;
+        int routeid, clusterroute, clustercorridor;
+
+        routesearch() : routeid(0), clusterroute(0), clustercorridor(0) {}
+    };
+
+    /// every thread gets its own search state the first time it searches a route.
+    static thread_local routesearch *cursearch = NULL;
+
+    static routesearch &getroutesearch()
+    {
+        if(!cursearch) cursearch = new routesearch;
+        return *cursearch;
+    }
+
+    /// searches the cluster graph from the cluster of node to the one of goal, and marks the clusters along
+    /// that way and their neighbours as the corridor the waypoint search is limited to.
+    static bool findcorridor(routesearch &rs, int node, int goal)
+    {
+        updatewpclusters();
+        int start = wpclusterof[node], end = wpclusterof[goal];
+        if(start < 0 || end < 0 || start == end) return false;
+
+        vector<searchnode> &clusters = rs.clusters;
+        while(clusters.length() < wpclusters.length()) { clusters.add(); rs.corridor.add(0); }
+        if(++rs.clusterroute <= 0)
+        {
+            loopv(clusters) clusters[i].route = 0;
+            rs.clusterroute = 1;
+        }
+        const vec &target = wpclusters[end].center;
+        searchnode &s = clusters[start];
+        s.route = rs.clusterroute;
+        s.curscore = s.estscore = 0;
+        s.prev = -1;
+        routequeue<searchnode> &queue = rs.queue;
+        queue.clear();
+        queue.add(&s);
+        bool found = false;
+        while(!queue.empty())
+        {
+            searchnode &m = *queue.remove();
+            int cur = int(&m - &clusters[0]);
+            if(cur == end) { found = true; break; }
+            float prevscore = m.curscore;
+            m.curscore = -1;
+            const vector<clusterlink> &links = wpclusters[cur].links;
+            loopv(links)
+            {
+                searchnode &n = clusters[links[i].cluster];
+                float curscore = prevscore + links[i].cost;
+                if(n.route == rs.clusterroute && (n.curscore < 0 || curscore >= n.curscore)) continue;
+                n.curscore = curscore;
+                n.prev = cur;
+                if(n.route != rs.clusterroute)
                 {
-                    waypoints[wp].route = routeid;
-                    waypoints[wp].curscore = -1;
-                    waypoints[wp].estscore = 0;
+                    n.estscore = wpclusters[links[i].cluster].center.dist(target);
+                    n.route = rs.clusterroute;
+                    queue.add(&n);
                 }
-            });
+                else queue.update(&n);
+            }
         }
+        loopv(queue.heap) queue.heap[i]->heapindex = -1;
+        if(!found) return false;
+
+        rs.clustercorridor++;
+        for(int i = end; i >= 0; i = clusters[i].prev)
+        {
+            rs.corridor[i] = rs.clustercorridor;
+            loopvj(wpclusters[i].links) rs.corridor[wpclusters[i].links[j].cluster] = rs.clustercorridor;
         }
+        return true;
+    }
 
-        waypoints[node].route = routeid;
-        waypoints[node].curscore = waypoints[node].estscore = 0;
-        waypoints[node].prev = 0;
-        queue.setsize(0);
-        queue.add(&waypoints[node]);
-        route.setsize(0);
+    /// A* over the waypoints from node towards goal, with corridor only over waypoints in the corridor clusters.
+    /// returns the reached waypoint closest to goal, or -1.
+    static int searchroute(routesearch &rs, int node, int goal, bool corridor)
+    {
+        vector<searchnode> &nodes = rs.nodes;
+        while(nodes.length() < waypoints.length()) nodes.add();
+        if(++rs.routeid <= 0)
+        {
+            loopv(nodes) nodes[i].route = 0;
+            rs.routeid = 1;
+        }
+
+        loopv(rs.blocked)
+        {
+            searchnode &w = nodes[rs.blocked[i]];
+            w.route = rs.routeid;
+            w.curscore = -1;
+            w.estscore = 0;
+        }
+
+        nodes[node].route = rs.routeid;
+        nodes[node].curscore = nodes[node].estscore = 0;
+        nodes[node].prev = 0;
+        routequeue<searchnode> &queue = rs.queue;
+        queue.clear();
+        queue.add(&nodes[node]);
 
         int lowest = -1;
         while(!queue.empty())
         {
-            waypoint &m = *queue.removeheap();
+            searchnode &m = *queue.remove();
+            const waypoint &mw = waypoints[&m - &nodes[0]];
             float prevscore = m.curscore;
             m.curscore = -1;
             loopi(MAXWAYPOINTLINKS)
             {
-                int link = m.links[i];
+                int link = mw.links[i];
                 if(!link) break;
                 if(iswaypoint(link) && (link == node || link == goal || waypoints[link].links[0]))
                 {
-                    waypoint &n = waypoints[link];
-                    int weight = max(n.weight, 1);
-                    float curscore = prevscore + n.o.dist(m.o)*weight;
-                    if(n.route == routeid && curscore >= n.curscore) continue;
+                    if(corridor && rs.corridor[wpclusterof[link]] != rs.clustercorridor) continue;
+                    const waypoint &nw = waypoints[link];
+                    searchnode &n = nodes[link];
+                    int weight = max(nw.weight, 1);
+                    float curscore = prevscore + nw.o.dist(mw.o)*weight;
+                    if(n.route == rs.routeid && curscore >= n.curscore) continue;
                     n.curscore = curscore;
-                    n.prev = ushort(&m - &waypoints[0]);
-                    if(n.route != routeid)
+                    n.prev = int(&m - &nodes[0]);
+                    if(n.route != rs.routeid)
                     {
-                        n.estscore = n.o.dist(waypoints[goal].o)*weight;
-                        if(n.estscore <= WAYPOINTRADIUS*4 && (lowest < 0 || n.estscore <= waypoints[lowest].estscore))
+                        n.estscore = nw.o.dist(waypoints[goal].o)*weight;
+                        if(n.estscore <= WAYPOINTRADIUS*4 && (lowest < 0 || n.estscore <= nodes[lowest].estscore))
                             lowest = link;
-                        n.route = routeid;
+                        n.route = rs.routeid;
                         if(link == goal) goto foundgoal;
-                        queue.addheap(&n);
+                        queue.add(&n);
                     }
-                    else loopvj(queue) if(queue[j] == &n) { queue.upheap(j); break; }
+                    else queue.update(&n); // only waypoints still queued can get a lower score
                 }
             }
         }
         foundgoal:
+        loopv(queue.heap) queue.heap[i]->heapindex = -1;
+
+        return lowest;
+    }
+
+    bool route(fpsent *d, int node, int goal, vector<int> &route, const avoidset &obstacles, int retries)
+    {
+        if(waypoints.empty() || !iswaypoint(node) || !iswaypoint(goal) || goal == node || !waypoints[node].links[0])
+            return false;
+
+        routesearch &rs = getroutesearch();
+        vector<ushort> &blocked = rs.blocked;
+        blocked.setsize(0);
+        if(d)
+        {
+            if(retries <= 1 && d->ai) loopi(ai::NUMPREVNODES) if(d->ai->prevnodes[i] != node && iswaypoint(d->ai->prevnodes[i]))
+                blocked.add(d->ai->prevnodes[i]);
+            if(retries <= 0)
+            {
+                loopavoid(obstacles, d,
+                {
+                    if(iswaypoint(wp) && wp != node && wp != goal && waypoints[node].find(wp) < 0 && waypoints[goal].find(wp) < 0)
+                        blocked.add(wp);
+                });
+            }
+        }
+
+        routekey key;
+        key.node = node;
+        key.goal = goal;
+        key.blocked = 2166136261U;
+        key.numblocked = blocked.length();
+        blocked.sort();
+        loopv(blocked) key.blocked = (key.blocked ^ blocked[i])*16777619U;
+        route.setsize(0);
+        if(routecachesize)
+        {
+            SDL_AtomicLock(&routecachelock);
+            cachedroute *cached = routecache.access(key);
+            bool hit = cached && !memcmp(routecachebuf.getbuf() + cached->blocked, blocked.getbuf(), blocked.length()*sizeof(ushort));
+            if(hit) loopi(cached->len) route.add(routecachebuf[cached->offset + i]);
+            SDL_AtomicUnlock(&routecachelock);
+            if(hit) return !route.empty();
+        }
 
-        routeid++;
+        int lowest = -1;
+        if(routeclusterdist && waypoints[node].o.squaredist(waypoints[goal].o) > float(routeclusterdist)*float(routeclusterdist) && findcorridor(rs, node, goal))
+            lowest = searchroute(rs, node, goal, true);
+        if(lowest < 0) lowest = searchroute(rs, node, goal, false);
 
         if(lowest >= 0) // otherwise nothing got there
         {
-            for(waypoint *m = &waypoints[lowest]; m > &waypoints[0]; m = &waypoints[m->prev])
-                route.add(m - &waypoints[0]); // just keep it stored backward
+            for(int i = lowest; i > 0; i = rs.nodes[i].prev)
+                route.add(i); // just keep it stored backward
+        }
+
+        if(routecachesize)
+        {
+            SDL_AtomicLock(&routecachelock);
+            if(routecachebuf.length() + route.length() + blocked.length() > routecachesize) clearroutecache();
+            cachedroute &cached = routecache[key];
+            cached.offset = routecachebuf.length();
+            cached.len = route.length();
+            loopv(route) routecachebuf.add(route[i]);
+            cached.blocked = routecachebuf.length();
+            routecachebuf.put(blocked.getbuf(), blocked.length());
+            SDL_AtomicUnlock(&routecachelock);
         }
 
         return !route.empty();
     }
 
+    void prepareroutes()
+    {
+        updatewpclusters();
+    }
+
     VARF(dropwaypoints, 0, 0, 1, { player1->lastnode = -1; });
 
     int addwaypoint(const vec &o, int weight = -1)
@@ -516,7 +739,7 @@ namespace ai
         if(waypoints.length() > MAXWAYPOINTS) return -1;
         int n = waypoints.length();
         waypoints.add(waypoint(o, weight >= 0 ? weight : getweight(o)));
-        invalidatewpcache(n);
+        clearroutecache();
         return n;
     }
 
@@ -525,9 +748,17 @@ namespace ai
         loopi(MAXWAYPOINTLINKS)
         {
             if(a.links[i] == n) return;
-            if(!a.links[i]) { a.links[i] = n; return; }
+            if(!a.links[i])
+            {
+                a.links[i] = n;
+                if(wpclusterof.length()) wpclusterlinks.add(ivec2(&a - &waypoints[0], n));
+                clearroutecache();
+                return;
+            }
         }
         a.links[rnd(MAXWAYPOINTLINKS)] = n;
+        clearroutecache();
+        clearwpclusters(); // a link got replaced, so some clusters might not be connected anymore
     }
 
     string loadedwaypoints = "";
@@ -596,7 +827,6 @@ namespace ai
     void navigate()
     {
     	if(shouldnavigate()) loopv(players) ai::navigate(players[i]);
-        if(invalidatedwpcaches) clearwpcache(false);
     }
 
     void clearwaypoints(bool full)
@@ -651,6 +881,7 @@ namespace ai
             total++;
         }
         waypoints.setsize(total);
+        remapwpgrid(remap);
     }
 
     bool cleanwaypoints()
@@ -671,7 +902,7 @@ namespace ai
             player1->lastnode = -1;
             loopv(players) if(players[i]) players[i]->lastnode = -1;
             remapwaypoints();
-            clearwpcache();
+            clearwpcache(false);
             return true;
         }
         return false;
@@ -702,6 +933,7 @@ namespace ai
         copystring(loadedwaypoints, wptname);
 
         waypoints.setsize(0);
+        clearwpcache();
         waypoints.add(vec(0, 0, 0));
         ushort numwp = f->getlil<ushort>();
         loopi(numwp)
@@ -725,7 +957,7 @@ namespace ai
         delete f;
         conoutf("loaded %d waypoints from %s", numwp, wptname);
 
-        if(!cleanwaypoints()) clearwpcache();
+        cleanwaypoints();
     }
     ICOMMAND(loadwaypoints, "s", (char *mname), loadwaypoints(true, mname));
 
@@ -777,7 +1009,7 @@ namespace ai
         {
             player1->lastnode = -1;
             remapwaypoints();
-            clearwpcache();
+            clearwpcache(false);
         }
     }
     COMMAND(delselwaypoints, "");
@@ -9,6 +9,7 @@ namespace game
     vec rays[MAXRAYS];
 
     vector<bouncer *> bouncers;
+    static vector<bouncer *> bouncerpool; // bouncers that went away, reused by newbouncer() instead of freeing them
 
     struct hitmsg
     {
@@ -118,28 +119,61 @@ namespace game
         playsound(S_NOAMMO);
     });
 
-    void offsetray(const vec &from, const vec &to, int spread, float range, vec &dest)
+    static vec offsetdir(const vec &from, const vec &to, int spread)
     {
         vec offset;
         do offset = vec(rndscale(1), rndscale(1), rndscale(1)).sub(0.5f);
         while(offset.squaredlen() > 0.5f*0.5f);
         offset.mul((to.dist(from)/1024)*spread);
         offset.z /= 2;
-        dest = vec(offset).add(to);
-        vec dir = vec(dest).sub(from).normalize();
-        raycubepos(from, dir, dest, range, RAY_CLIPMAT|RAY_ALPHAPOLY);
+        return offset.add(to).sub(from).normalize();
+    }
+
+    void offsetray(const vec &from, const vec &to, int spread, float range, vec &dest)
+    {
+        raycubepos(from, offsetdir(from, to, spread), dest, range, RAY_CLIPMAT|RAY_ALPHAPOLY);
     }
 
     void createrays(int gun, const vec &from, const vec &to)             // create random spread of rays
     {
-        loopi(guns[gun].rays) offsetray(from, to, guns[gun].spread, guns[gun].range, rays[i]);
+        rayquery queries[MAXRAYS];
+        int num = min(guns[gun].rays, int(MAXRAYS));
+        loopi(num)
+        {
+            rayquery &q = queries[i];
+            q.o = from;
+            q.ray = offsetdir(from, to, guns[gun].spread);
+            q.radius = guns[gun].range;
+            q.mode = RAY_CLIPMAT|RAY_ALPHAPOLY;
+            q.size = 0;
+        }
+        raycube(queries, num);
+        loopi(num) rays[i] = queries[i].hitpos;
     }
 
     vec hudgunorigin(int gun, const vec &from, const vec &to, fpsent *d);
 
+    static bouncer *allocbouncer()
+    {
+        bouncer *b = bouncerpool.length() ? bouncerpool.pop() : new bouncer;
+        *b = bouncer();
+        return bouncers.add(b);
+    }
+
+    /// gives bouncers[i] back to the pool, moving the last bouncer into its slot.
+    static void freebouncer(int i)
+    {
+        bouncerpool.add(bouncers.removeunordered(i));
+    }
+
+    static inline float bombfloor(const vec &o)
+    {
+        return o.z - raycube(o, vec(0, 0, -1), 0.2f, RAY_CLIPMAT);
+    }
+
     void newbouncer(const vec &from, const vec &to, bool local, int id, fpsent *owner, int type, int lifetime, int speed, entitylight *light = NULL, int generation = 0)
     {
-        bouncer &bnc = *bouncers.add(new bouncer);
+        bouncer &bnc = *allocbouncer();
         bnc.o = from;
         switch(type)
         {
@@ -197,6 +231,7 @@ namespace game
         }
         bnc.offset.sub(bnc.o);
         bnc.offsetmillis = OFFSETMILLIS;
+        if(type==BNC_BOMB) bnc.floorz = bombfloor(bnc.o);
 
         bnc.resetinterp();
     }
@@ -236,6 +271,28 @@ namespace game
         }
     }
 
+    /// finds the floor under all bombs in one batch of rays, so weaponcollide() needs none per collision test.
+    static void updatebombfloors()
+    {
+        static vector<rayquery> queries;
+        static vector<bouncer *> bombs;
+        queries.setsize(0);
+        bombs.setsize(0);
+        loopv(bouncers) if(bouncers[i]->bouncetype==BNC_BOMB)
+        {
+            bouncer *b = bouncers[i];
+            rayquery &q = queries.add();
+            q.o = b->o;
+            q.ray = vec(0, 0, -1);
+            q.radius = 0.2f;
+            q.mode = RAY_CLIPMAT;
+            q.size = 0;
+            bombs.add(b);
+        }
+        raycube(queries.getbuf(), queries.length());
+        loopv(bombs) bombs[i]->floorz = bombs[i]->o.z - queries[i].dist;
+    }
+
     void updatebouncers(int time)
     {
         loopv(bouncers)
@@ -303,7 +360,7 @@ namespace game
                         addmsg(N_EXPLODE, "rci3iv", bnc.owner, lastmillis-maptime, GUN_SPLINTER, bnc.id-maptime,
                                 hits.length(), hits.length()*sizeof(hitmsg)/sizeof(int), hits.getbuf());
                 }
-                delete bouncers.remove(i--);
+                freebouncer(i--);
             }
             else
             {
@@ -311,14 +368,19 @@ namespace game
                 bnc.offsetmillis = max(bnc.offsetmillis-time, 0);
             }
         }
+        updatebombfloors();
     }
 
     void removebouncers(fpsent *owner)
     {
-        loopv(bouncers) if(bouncers[i]->owner==owner) { delete bouncers[i]; bouncers.remove(i--); }
+        loopv(bouncers) if(bouncers[i]->owner==owner) freebouncer(i--);
     }
 
-    void clearbouncers() { bouncers.deletecontents(); }
+    void clearbouncers()
+    {
+        bouncerpool.put(bouncers.getbuf(), bouncers.length());
+        bouncers.setsize(0);
+    }
 
     vector<projectile> projs;
 
@@ -578,7 +640,7 @@ namespace game
                         pos.add(vec(b.offset).mul(b.offsetmillis/float(OFFSETMILLIS)));
                         explode(b.local, b.owner, pos, NULL, 0, GUN_GL);
                         adddecal(DECAL_SCORCH, pos, vec(0, 0, 1), guns[gun].exprad/2);
-                        delete bouncers.remove(i);
+                        freebouncer(i);
                         break;
                     }
                 }
@@ -594,7 +656,7 @@ namespace game
                         explode(b.local, b.owner, pos, NULL, 0, GUN_BOMB);
                         // adddecal(DECAL_SCORCH, pos, vec(0, 0, 1), b.owner->bombradius*guns[GUN_BOMB].exprad/2);
                         spawnsplinters(b.o, b.owner);
-                        delete bouncers.remove(i);
+                        freebouncer(i);
                         break;
                     }
                 }
@@ -609,7 +671,7 @@ namespace game
                         pos.add(vec(b.offset).mul(b.offsetmillis/float(OFFSETMILLIS)));
                         explode(b.local, b.owner, pos, NULL, 0, GUN_SPLINTER);
                         spawnnextsplinter(b.o, b.vel, b.owner, b.generation);
-                        delete bouncers.remove(i);
+                        freebouncer(i);
                         break;
                     }
                 }
@@ -630,28 +692,67 @@ namespace game
         return true;
     }
 
-    void updateprojectiles(int time)
+    // where each projectile moves this frame and whom it hits, one array per field so the dynent pass below stays compact.
+    static vector<vec> projnext, projsweepcenter;
+    static vector<float> projsweepradius;
+    static vector<int> projhits;
+
+    /// moves all projectiles on paper and finds the first dynent each local one runs into,
+    /// testing every projectile against one dynent at a time instead of every dynent per projectile.
+    static void sweepprojectiles(int time)
     {
+        projnext.setsize(0);
+        projsweepcenter.setsize(0);
+        projsweepradius.setsize(0);
+        projhits.setsize(0);
+        int numlocal = 0;
         loopv(projs)
+        {
+            projectile &p = projs[i];
+            vec dv;
+            float dist = p.to.dist(p.o, dv);
+            dv.mul(time/max(dist*1000/p.speed, float(time)));
+            vec halfdv = vec(dv).mul(0.5f);
+            projnext.add(vec(p.o).add(dv));
+            projsweepcenter.add(vec(p.o).add(halfdv));
+            projsweepradius.add(p.local ? max(fabs(halfdv.x), fabs(halfdv.y)) + 1 : -1);
+            projhits.add(-1);
+            if(p.local) numlocal++;
+        }
+        if(!numlocal) return;
+        loopj(numdynents())
+        {
+            dynent *o = iterdynents(j);
+            if(o->state!=CS_ALIVE) continue;
+            loopv(projs) if(projhits[i] < 0 && projsweepradius[i] >= 0)
+            {
+                if(projs[i].owner==o || o->o.reject(projsweepcenter[i], o->radius + projsweepradius[i])) continue;
+                if(intersect(o, projs[i].o, projnext[i])) projhits[i] = j;
+            }
+        }
+    }
+
+    void updateprojectiles(int time)
+    {
+        sweepprojectiles(time);
+        int numprojs = projs.length(), kept = 0;
+        loopi(numprojs)
         {
             projectile &p = projs[i];
             p.offsetmillis = max(p.offsetmillis-time, 0);
             int qdam = guns[p.gun].damage*(p.owner->quadmillis ? 4 : 1);
             if(p.owner->type==ENT_AI) qdam /= MONSTERDAMAGEFACTOR;
-            vec dv;
-            float dist = p.to.dist(p.o, dv); 
-            dv.mul(time/max(dist*1000/p.speed, float(time)));
-            vec v = vec(p.o).add(dv);
+            float dist = p.to.dist(p.o);
+            vec v = projnext[i];
             bool exploded = false;
             hits.setsize(0);
-            if(p.local)
+            if(p.local && projhits[i] >= 0)
             {
-                vec halfdv = vec(dv).mul(0.5f), bo = vec(p.o).add(halfdv);
-                float br = max(fabs(halfdv.x), fabs(halfdv.y)) + 1;
-                loopj(numdynents())
+                // an earlier explosion this frame may have killed the swept target, then look further as before
+                for(int j = projhits[i], numdyn = numdynents(); j < numdyn; j++)
                 {
                     dynent *o = iterdynents(j);
-                    if(p.owner==o || o->o.reject(bo, o->radius + br)) continue;
+                    if(p.owner==o || o->o.reject(projsweepcenter[i], o->radius + projsweepradius[i])) continue;
                     if(projdamage(o, p, v, qdam)) { exploded = true; break; }
                 }
             }
@@ -661,7 +762,12 @@ namespace game
                 {
                     if(p.o!=p.to) // if original target was moving, reevaluate endpoint
                     {
-                        if(raycubepos(p.o, p.dir, p.to, 0, RAY_CLIPMAT|RAY_ALPHAPOLY)>=4) continue;
+                        if(raycubepos(p.o, p.dir, p.to, 0, RAY_CLIPMAT|RAY_ALPHAPOLY)>=4)
+                        {
+                            if(kept != i) projs[kept] = p;
+                            kept++;
+                            continue;
+                        }
                     }
                     projsplash(p, v, NULL, qdam);
                     exploded = true;
@@ -688,10 +794,15 @@ namespace game
                 if(p.local)
                     addmsg(N_EXPLODE, "rci3iv", p.owner, lastmillis-maptime, p.gun, p.id-maptime,
                             hits.length(), hits.length()*sizeof(hitmsg)/sizeof(int), hits.getbuf());
-                projs.remove(i--);
             }
-            else p.o = v;
+            else
+            {
+                p.o = v;
+                if(kept != i) projs[kept] = p;
+                kept++;
+            }
         }
+        projs.setsize(kept);
     }
 
     extern SharedVar<int> chainsawhudgun;
@@ -1028,7 +1139,7 @@ namespace game
             {
                 vec mov_from(0, 0, bombcolliderad-bbarr_overlap);                                                // shift the lower part of the Barrier upwards
                 vec mov_to(0, 0, -bombcolliderad+bbarr_height);                                                  // shift the upper part downwards
-                vec floor = bnc.o; floor.z = floor.z - raycube(floor, vec(0, 0, -1), 0.2f, RAY_CLIPMAT);         // Get the rays on the floor.
+                vec floor = bnc.o; floor.z = bnc.floorz;                                                        // Floor found by updatebombfloors().
                 int tremble = (rnd(bbarr_tremblepeak*2)) - bbarr_tremblepeak;                                    // Compute random tremble
 
                 if(bombbarrier)
@@ -1164,7 +1275,7 @@ namespace game
             if(ellipsecollide(d,
 			              dir, p->o, vec(0, 0, 0), p->yaw,
 			              bombcolliderad, bombcolliderad,
-			              p->aboveeye, p->o.z - raycube(p->o, vec(0, 0, -1), 0.2f, RAY_CLIPMAT)))
+			              p->aboveeye, p->floorz))
                 return true;
         }
         return false;
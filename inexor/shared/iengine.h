@@ -51,6 +51,25 @@ extern float raycube   (const vec &o, const vec &ray,     float radius = 0, int
 extern float raycubepos(const vec &o, const vec &ray, vec &hit, float radius = 0, int mode = RAY_CLIPMAT, int size = 0);
 extern float rayfloor  (const vec &o, vec &floor, int mode = 0, float radius = 0);
 extern bool  raycubelos(const vec &o, const vec &dest, vec &hitpos);
+struct losquery
+{
+    vec o, dest, hitpos;
+    bool los;
+};
+extern void raycubelos(losquery *queries, int num);
+struct rayquery
+{
+    vec o, ray;
+    float radius;
+    int mode, size;
+    float dist;
+    vec hitpos, surface;
+};
+extern void raycube(rayquery *queries, int num);
+
+// worker
+extern void parallelfor(int num, void (*fn)(void *, int), void *data);
+template<class F> static inline void parallelfor(int num, F f) { parallelfor(num, [](void *data, int i) { (*(F *)data)(i); }, &f); }
 
 extern SharedVar<int> thirdperson;
 extern bool isthirdperson();
@@ -88,17 +107,24 @@ struct selinfo
 };
 
 struct editinfo;
+struct editstream;
 extern editinfo *localedit;
 
 extern bool editmode;
 
 extern int shouldpacktex(int index);
-extern bool packeditinfo(editinfo *e, int &inlen, uchar *&outbuf, int &outlen);
-extern bool unpackeditinfo(editinfo *&e, const uchar *inbuf, int inlen, int outlen);
+extern editstream *packeditinfo(editinfo *e);
+extern bool unpackeditinfo(editinfo *&e, editstream *s);
 extern void freeeditinfo(editinfo *&e);
 extern void pruneundos(int maxremain = 0);
-extern bool packundo(int op, int &inlen, uchar *&outbuf, int &outlen);
-extern bool unpackundo(const uchar *inbuf, int inlen, int outlen);
+extern editstream *packundo(int op);
+extern bool unpackundo(editstream *s);
+extern editstream *openeditstream(int unpacklen);
+extern bool puteditstream(editstream *s, const uchar *buf, int len);
+extern int geteditstream(editstream *s, uchar *out, int maxlen, bool &ended);
+extern int editstreamsize(editstream *s);
+extern float editstreamprogress(editstream *s);
+extern void closeeditstream(editstream *&s);
 extern bool noedit(bool view = false, bool msg = true);
 extern void toggleedit(bool force = true);
 extern void mpeditface(int dir, int mode, selinfo &sel, bool local);
@@ -359,7 +385,7 @@ extern void adddecal(int type, const vec &center, const vec &surface, float radi
 
 // worldio
 extern bool load_world(const char *mname, const char *cname = NULL);
-extern bool save_world(const char *mname, bool nolms = false);
+extern bool save_world(const char *mname, bool nolms = false, bool background = false);
 extern void getmapfilename(const char *fname, const char *cname, char *mapname);
 extern uint getmapcrc();
 extern void clearmapcrc();
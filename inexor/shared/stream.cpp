@@ -230,6 +230,8 @@ done:
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 #endif
 
 string homedir = "";
@@ -356,6 +358,20 @@ bool fileexists(const char *path, const char *mode)
     return exists;
 }
 
+/// Returns the last modification time of a file, or 0 if it doesn't exist
+long long getfiletime(const char *path)
+{
+#ifdef WIN32
+    WIN32_FILE_ATTRIBUTE_DATA attrs;
+    if(!GetFileAttributesEx(path, GetFileExInfoStandard, &attrs)) return 0;
+    return (long long)attrs.ftLastWriteTime.dwHighDateTime<<32 | attrs.ftLastWriteTime.dwLowDateTime;
+#else
+    struct stat st;
+    if(stat(path, &st) < 0) return 0;
+    return st.st_mtime;
+#endif
+}
+
 /// Creates a directory of given name
 /// @Return Returns true on success
 bool createdir(const char *path)
@@ -407,6 +423,167 @@ bool subhomedir(char *dst, int len, const char *src)
     return true;
 }
 
+/// Index of all files and directories inside the home- and package directories.
+/// Maps the (platform-) path relative to those directories to the directory the file will be loaded from:
+/// -1 for the homedir, otherwise its position in packagedirs.
+/// It is built once on the first lookup, so findfile() does not need to probe the filesystem of every package directory
+/// for every single texture, sound or model of a map. findfile() trusts it for hits and misses alike:
+/// files written through findfile() (so openfile()) and deleted through removefile() keep it up to date,
+/// new package directories get added to it, anything else changed on disk needs a rescanfiles.
+static openhashtable<const char *, int> fileindex(1<<12);
+static vector<char *> fileindexnames; // the keys of fileindex, kept until the index is cleared
+static bool fileindexvalid = false;
+
+static void clearfileindex()
+{
+    fileindex.clear();
+    fileindexnames.deletearrays();
+    fileindexvalid = false;
+}
+
+/// Whether findfile() uses the file index (0 probes every directory on each lookup, like the filesystem itself would).
+VARF(usefileindex, 0, 1, 1, clearfileindex());
+
+/// Directories with more files than this are not indexed, findfile() falls back to probing instead.
+VAR(fileindexlimit, 0, 1<<18, 1<<24);
+
+/// Writes the index key for filename into key: path() applied and, on case insensitive filesystems, lowercased.
+static char *fileindexkey(char *key, const char *filename)
+{
+    copystring(key, filename, MAXSTRLEN);
+    path(key);
+#ifdef WIN32
+    for(char *c = key; *c; c++) *c = tolower(*c);
+#endif
+    return key;
+}
+
+/// Adds a file to the index, unless a directory with higher priority already provides it.
+static void addindexedfile(const char *filename, int dir, bool overwrite = false)
+{
+    string key;
+    fileindexkey(key, filename);
+    int *exists = fileindex.access(key);
+    if(exists)
+    {
+        if(overwrite) *exists = dir;
+        return;
+    }
+    fileindex[fileindexnames.add(newstring(key))] = dir;
+}
+
+/// Recursively adds all files below dirname to the index.
+/// dirname is a buffer (of MAXSTRLEN) ending with a PATHDIV, the first rootlen chars are not part of the indexed names.
+/// @Return false if the limit of fileindexlimit files has been reached.
+static bool indexdir(char *dirname, size_t dirlen, size_t rootlen, int dir, int depth = 0)
+{
+    if(depth > 32) return true; // symlink loops
+#ifdef WIN32
+    copystring(&dirname[dirlen], "*", MAXSTRLEN - dirlen);
+    WIN32_FIND_DATA FindFileData;
+    HANDLE Find = FindFirstFile(dirname, &FindFileData);
+    dirname[dirlen] = '\0';
+    if(Find == INVALID_HANDLE_VALUE) return true;
+    bool ok = true;
+    do
+    {
+        const char *name = FindFileData.cFileName;
+        if(name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) continue;
+        size_t namelen = strlen(name);
+        if(dirlen + namelen + 2 >= MAXSTRLEN) continue;
+        memcpy(&dirname[dirlen], name, namelen + 1);
+        if(FindFileData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            addindexedfile(&dirname[rootlen], dir);
+            dirname[dirlen + namelen] = PATHDIV;
+            dirname[dirlen + namelen + 1] = '\0';
+            ok = indexdir(dirname, dirlen + namelen + 1, rootlen, dir, depth + 1);
+        }
+        else
+        {
+            addindexedfile(&dirname[rootlen], dir);
+            ok = fileindex.numelems <= fileindexlimit;
+        }
+    } while(ok && FindNextFile(Find, &FindFileData));
+    FindClose(Find);
+#else
+    DIR *d = opendir(dirname[0] ? dirname : ".");
+    if(!d) return true;
+    bool ok = true;
+    for(struct dirent *de; ok && (de = readdir(d)) != NULL;)
+    {
+        const char *name = de->d_name;
+        if(name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2]))) continue;
+        size_t namelen = strlen(name);
+        if(dirlen + namelen + 2 >= MAXSTRLEN) continue;
+        memcpy(&dirname[dirlen], name, namelen + 1);
+        bool isdir = de->d_type == DT_DIR;
+        if(de->d_type == DT_UNKNOWN || de->d_type == DT_LNK)
+        {
+            struct stat st;
+            isdir = !stat(dirname, &st) && S_ISDIR(st.st_mode);
+        }
+        if(isdir)
+        {
+            addindexedfile(&dirname[rootlen], dir);
+            dirname[dirlen + namelen] = PATHDIV;
+            dirname[dirlen + namelen + 1] = '\0';
+            ok = indexdir(dirname, dirlen + namelen + 1, rootlen, dir, depth + 1);
+        }
+        else
+        {
+            addindexedfile(&dirname[rootlen], dir);
+            ok = fileindex.numelems <= fileindexlimit;
+        }
+    }
+    closedir(d);
+#endif
+    dirname[dirlen] = '\0';
+    return ok;
+}
+
+/// Adds the files of packagedirs[i] the directories before it don't provide to the index.
+static bool indexpackagedir(int i)
+{
+    packagedir &pf = packagedirs[i];
+    defformatstring(dirname, "%s%s", pf.dir, pf.filter ? pf.filter : "");
+    return indexdir(dirname, strlen(dirname), pf.dirlen, i);
+}
+
+/// (Re-)builds the index of the homedir and all package directories.
+/// Earlier directories take precedence, the same order findfile() probes them in.
+static void buildfileindex()
+{
+    clearfileindex();
+    bool ok = true;
+    if(homedir[0])
+    {
+        string dirname;
+        copystring(dirname, homedir);
+        ok = indexdir(dirname, strlen(dirname), strlen(dirname), -1);
+    }
+    loopv(packagedirs)
+    {
+        if(!ok) break;
+        ok = indexpackagedir(i);
+    }
+    if(!ok)
+    {
+        conoutf(CON_WARN, "more than %d files in the package directories, not using the file index", int(fileindexlimit));
+        clearfileindex();
+        usefileindex = 0;
+        return;
+    }
+    fileindexvalid = true;
+}
+
+/// Drops the file index, so it gets rebuilt on the next lookup.
+void rescanfiles()
+{
+    clearfileindex();
+}
+COMMAND(rescanfiles, "");
+
 /// sets home directory
 const char *sethomedir(const char *dir)
 {
@@ -414,6 +591,7 @@ const char *sethomedir(const char *dir)
     copystring(pdir, dir);
     if(!subhomedir(pdir, sizeof(pdir), dir) || !fixpackagedir(pdir)) return NULL;
     copystring(homedir, pdir);
+    clearfileindex();
     return homedir;
 }
 
@@ -440,6 +618,7 @@ const char *addpackagedir(const char *dir)
     pf.dirlen = filter ? filter-pdir : strlen(pdir);
     pf.filter = filter ? newstring(filter) : NULL;
     pf.filterlen = filter ? strlen(filter) : 0;
+    if(fileindexvalid && !indexpackagedir(packagedirs.length()-1)) clearfileindex(); // rebuilt (and given up) on the next lookup
     return pf.dir;
 }
 
@@ -451,12 +630,26 @@ const char *addpackagedir(const char *dir)
 const char *findfile(const char *filename, const char *mode)
 {
     static string s;
+    if(usefileindex && mode[0]!='w' && mode[0]!='a' && mode[0]!='d')
+    {
+        if(!fileindexvalid) buildfileindex();
+        if(fileindexvalid)
+        {
+            string key;
+            int *dir = fileindex.access(fileindexkey(key, filename));
+            if(!dir) return mode[0]=='e' ? NULL : filename;
+            formatstring(s, "%s%s", *dir < 0 ? homedir : packagedirs[*dir].dir, filename);
+            return s;
+        }
+    }
     if(homedir[0])
     {
         formatstring(s, "%s%s", homedir, filename);
-        if(fileexists(s, mode)) return s;
         if(mode[0]=='w' || mode[0]=='a')
         {
+            size_t rootlen = strlen(homedir);
+            if(fileindexvalid) addindexedfile(filename, -1, true);
+            if(fileexists(s, mode)) return s;
             string dirs;
             copystring(dirs, s);
             char *dir = strchr(dirs[0]==PATHDIV ? dirs+1 : dirs, PATHDIV);
@@ -464,13 +657,19 @@ const char *findfile(const char *filename, const char *mode)
             {
                 *dir = '\0';
                 if(!fileexists(dirs, "d") && !createdir(dirs)) return s;
+                if(fileindexvalid && size_t(dir - dirs) > rootlen) addindexedfile(&dirs[rootlen], -1, true);
                 *dir = PATHDIV;
                 dir = strchr(dir+1, PATHDIV);
             }
             return s;
         }
+        if(fileexists(s, mode)) return s;
+    }
+    if(mode[0]=='w' || mode[0]=='a')
+    {
+        clearfileindex(); // might be written into a package dir
+        return filename;
     }
-    if(mode[0]=='w' || mode[0]=='a') return filename;
     loopv(packagedirs)
     {
         packagedir &pf = packagedirs[i];
@@ -482,6 +681,29 @@ const char *findfile(const char *filename, const char *mode)
     return filename;
 }
 
+/// Deletes a file findfile() finds for reading, and looks up which directory provides it from now on (if any).
+/// @Return true on success
+bool removefile(const char *filename)
+{
+    if(remove(findfile(filename, "rb"))) return false;
+    if(!fileindexvalid) return true;
+    string key, s;
+    fileindex.remove(fileindexkey(key, filename));
+    if(homedir[0])
+    {
+        formatstring(s, "%s%s", homedir, filename);
+        if(fileexists(s, "r")) { addindexedfile(filename, -1); return true; }
+    }
+    loopv(packagedirs)
+    {
+        packagedir &pf = packagedirs[i];
+        if(pf.filter && strncmp(filename, pf.filter, pf.filterlen)) continue;
+        formatstring(s, "%s%s", pf.dir, filename);
+        if(fileexists(s, "r")) { addindexedfile(filename, i); return true; }
+    }
+    return true;
+}
+
 /// Internal use only Use listfiles instead.
 /// @Returns false if dirname does not exists
 bool listdir(const char *dirname, bool rel, const char *ext, vector<char *> &files)
@@ -728,6 +950,132 @@ struct filestream : stream
     }
 };
 
+/// map binary files opened for reading into memory instead of reading them through stdio.
+VAR(mmapfiles, 0, 1, 1);
+/// smaller files (in KB) are read through stdio, mapping them costs more than it saves.
+VAR(mmapthreshold, 0, 64, 1<<20);
+/// how far (in KB) ahead of the read position the kernel is asked to page in a mapped file.
+VAR(mmapreadahead, 64, 4096, 1<<20);
+
+/// Read only stream on a memory mapped file.
+/// Reads are plain memcpys from the mapping, and the pages ahead of the read position are
+/// requested in the background (madvise) so large sequential loads don't stall on every page fault.
+struct mapstream : stream
+{
+    uchar *data;
+    offset len, pos, advised;
+#ifdef WIN32
+    HANDLE file, mapping;
+#else
+    int fd;
+#endif
+
+#ifdef WIN32
+    mapstream() : data(NULL), len(0), pos(0), advised(0), file(INVALID_HANDLE_VALUE), mapping(NULL) {}
+#else
+    mapstream() : data(NULL), len(0), pos(0), advised(0), fd(-1) {}
+#endif
+    ~mapstream() { close(); }
+
+    /// Maps the file, fails if it is smaller than minsize bytes or can't be mapped.
+    bool open(const char *name, offset minsize)
+    {
+        if(data) return false;
+#ifdef WIN32
+        file = CreateFileA(name, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if(file == INVALID_HANDLE_VALUE) return false;
+        LARGE_INTEGER filesize;
+        if(!GetFileSizeEx(file, &filesize) || filesize.QuadPart < max(minsize, offset(1)) || offset(size_t(filesize.QuadPart)) != filesize.QuadPart) { close(); return false; }
+        len = filesize.QuadPart;
+        mapping = CreateFileMapping(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if(!mapping) { close(); return false; }
+        data = (uchar *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if(!data) { close(); return false; }
+#else
+        fd = ::open(name, O_RDONLY);
+        if(fd < 0) return false;
+        struct stat st;
+        if(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size < max(minsize, offset(1)) || offset(size_t(st.st_size)) != st.st_size) { close(); return false; }
+        len = st.st_size;
+        void *mapped = mmap(NULL, size_t(len), PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped == MAP_FAILED) { close(); return false; }
+        data = (uchar *)mapped;
+        madvise(data, size_t(len), MADV_SEQUENTIAL);
+#endif
+        readahead();
+        return true;
+    }
+
+    /// Asks the kernel to page in the next window ahead of the read position.
+    void readahead()
+    {
+        offset window = offset(mmapreadahead)<<10;
+        if(pos + window/2 < advised || advised >= len) return;
+        offset start = max(advised, pos), end = min(pos + window, len);
+#ifndef WIN32
+        offset pagemask = offset(sysconf(_SC_PAGESIZE)) - 1;
+        start &= ~pagemask;
+        madvise(data + start, size_t(end - start), MADV_WILLNEED);
+#endif
+        advised = end;
+    }
+
+    void close()
+    {
+#ifdef WIN32
+        if(data) { UnmapViewOfFile(data); data = NULL; }
+        if(mapping) { CloseHandle(mapping); mapping = NULL; }
+        if(file != INVALID_HANDLE_VALUE) { CloseHandle(file); file = INVALID_HANDLE_VALUE; }
+#else
+        if(data) { munmap(data, size_t(len)); data = NULL; }
+        if(fd >= 0) { ::close(fd); fd = -1; }
+#endif
+        len = pos = advised = 0;
+    }
+
+    bool end() { return pos >= len; }
+    offset tell() { return pos; }
+    offset size() { return len; }
+
+    bool seek(offset off, int whence)
+    {
+        switch(whence)
+        {
+            case SEEK_CUR: off += pos; break;
+            case SEEK_END: off += len; break;
+        }
+        if(off < 0 || off > len) return false;
+        pos = off;
+        if(pos > advised) advised = pos;
+        readahead();
+        return true;
+    }
+
+    size_t read(void *buf, size_t n)
+    {
+        n = size_t(min(offset(n), len - pos));
+        memcpy(buf, &data[pos], n);
+        pos += n;
+        readahead();
+        return n;
+    }
+
+    int getchar() { return pos < len ? data[pos++] : -1; }
+
+    bool getline(char *str, size_t n)
+    {
+        if(pos >= len || n <= 0) return false;
+        size_t avail = size_t(min(offset(n-1), len - pos));
+        const uchar *nl = (const uchar *)memchr(&data[pos], '\n', avail);
+        if(nl) avail = nl+1 - &data[pos];
+        memcpy(str, &data[pos], avail);
+        str[avail] = '\0';
+        pos += avail;
+        readahead();
+        return true;
+    }
+};
+
 #ifndef STANDALONE
 VAR(dbggz, 0, 0, 1);
 #endif
@@ -925,8 +1273,8 @@ struct gzstream : stream
     offset size()
     {
         if(!file) return -1;
-        offset pos = tell();
-        if(!file->seek(-4, SEEK_END)) return -1;
+        offset pos = file->tell();
+        if(pos < 0 || !file->seek(-4, SEEK_END)) return -1;
         uint isize = file->getlil<uint>();
         return file->seek(pos, SEEK_SET) ? isize : offset(-1);
     }
@@ -1201,6 +1549,12 @@ stream *openrawfile(const char *filename, const char *mode)
 {
     const char *found = findfile(filename, mode);
     if(!found) return NULL;
+    if(mmapfiles && mode[0]=='r' && strchr(mode, 'b') && !strchr(mode, '+'))
+    {
+        mapstream *mapped = new mapstream;
+        if(mapped->open(found, stream::offset(mmapthreshold)<<10)) return mapped;
+        delete mapped;
+    }
     filestream *file = new filestream;
     if(!file->open(found, mode)) { delete file; return NULL; }
     return file;
@@ -628,7 +628,22 @@ static inline bool htcmp(GLuint x, GLuint y)
 /// Vector template
 /// @brief a manual implementation of vector templates (self managing dynamic arrays which store one type).
 /// @see std::vector
-template <class T, int MINSIZE = 8> struct vector {
+
+/// Inline element storage of a vector, empty unless INLINESIZE is given (see smallvector).
+template <class T, int N> struct vectorstorage
+{
+    alignas(T) uchar data[N*sizeof(T)];
+
+    T *inlinebuf() const { return (T *)data; }
+};
+template <class T> struct vectorstorage<T, 0>
+{
+    T *inlinebuf() const { return NULL; }
+};
+
+/// @param MINSIZE the amount of elements allocated on the first heap allocation.
+/// @param INLINESIZE the amount of elements stored inside the vector itself before the heap gets used.
+template <class T, int MINSIZE = 8, int INLINESIZE = 0> struct vector : vectorstorage<T, INLINESIZE> {
 
 	/// data pointer
     T *buf;
@@ -639,15 +654,15 @@ template <class T, int MINSIZE = 8> struct vector {
 	int ulen;
 
     /// Default constructor
-	/// @brief sets all members to 0
-	vector() : buf(NULL), alen(0), ulen(0)
+	/// @brief sets all members to 0 (or to the inline buffer)
+	vector() : buf(this->inlinebuf()), alen(INLINESIZE), ulen(0)
     {
     }
 
 	/// Copy constructor
 	/// @brief this constructor initialises the vector by copying another vector.
 	/// @param v the vector from which data will be copied (call by reference).
-    vector(const vector &v) : buf(NULL), alen(0), ulen(0)
+    vector(const vector &v) : buf(this->inlinebuf()), alen(INLINESIZE), ulen(0)
     {
         *this = v;
     }
@@ -658,14 +673,14 @@ template <class T, int MINSIZE = 8> struct vector {
     ~vector() 
 	{
 		shrink(0);
-		if(buf) free(buf);
+		if(buf && !isinline()) free(buf);
 	}
 
 	/// Operator =
 	/// @brief Resets own memory and copies all data from the other vector.
 	/// @param v The vector from which data will be copied.
 	/// @return Returns a pointer to itself.
-    vector<T> &operator=(const vector<T> &v)
+    vector &operator=(const vector &v)
     {
         shrink(0);
         if(v.length() > alen) growbuf(v.length());
@@ -712,14 +727,21 @@ template <class T, int MINSIZE = 8> struct vector {
     }
 
 	/// copy vector from vector reference
-    void move(vector<T> &v)
+    void move(vector &v)
     {
-        if(!ulen)
+        if(!ulen && !isinline() && !v.isinline())
         {
             swap(buf, v.buf);
             swap(ulen, v.ulen);
             swap(alen, v.alen);
         }
+        else if(!ulen && !v.isinline())
+        {
+            buf = v.buf;
+            ulen = v.ulen;
+            alen = v.alen;
+            v.disown();
+        }
         else
         {
             growbuf(ulen+v.ulen);
@@ -763,9 +785,13 @@ template <class T, int MINSIZE = 8> struct vector {
 	/// @warning This member does NOT clean up its memory!
     void disown()
 	{ 
-		buf = NULL; 
-		alen = ulen = 0;
+		buf = this->inlinebuf();
+		alen = INLINESIZE;
+		ulen = 0;
 	}
+
+	/// is the data still stored inside the vector (no heap memory allocated yet)?
+    bool isinline() const { return INLINESIZE && buf == this->inlinebuf(); }
 	
 	/// shrink vector memory size AND DELETE UNUSED MEMORY
     void shrink(int i) { ASSERT(i<=ulen); if(isclass<T>::no) ulen = i; else while(ulen>i) drop(); }
@@ -805,8 +831,17 @@ template <class T, int MINSIZE = 8> struct vector {
     {
         int olen = alen;
         if(!alen) alen = max(MINSIZE, sz);
-        else while(alen < sz) alen += alen/2;
+        else while(alen < sz) alen += max(alen/2, 1);
         if(alen <= olen) return;
+        if(isinline())
+        {
+            // spill the inline buffer to the heap, elements are relocated bytewise just like realloc does
+            T *heapbuf = (T *)malloc(alen*sizeof(T));
+            if(!heapbuf) abort();
+            if(ulen) memcpy((void *)heapbuf, (void *)buf, ulen*sizeof(T));
+            buf = heapbuf;
+            return;
+        }
         buf = (T *)realloc(buf, alen*sizeof(T));
         if(!buf) abort();
     }
@@ -1005,6 +1040,12 @@ template <class T, int MINSIZE = 8> struct vector {
     }
 };
 
+/// Vector that keeps up to N elements inline, so short lived temporaries do not hit the allocator.
+/// Grows onto the heap like a normal vector once N is exceeded.
+/// @warning Since the inline elements live inside the object, a smallvector itself must not be relocated
+/// bytewise, i.e. never store it inside a (non-small) vector.
+template <class T, int N> using smallvector = vector<T, N, N>;
+
 template<class H, class E, class K, class T> struct hashbase
 {
     typedef E elemtype;
@@ -1152,14 +1193,234 @@ template<class H, class E, class K, class T> struct hashbase
         deletechunks();
     }
 
+    chain *enumfirst(int i) const { return chains[i]; }
     static inline chain *enumnext(void *i) { return ((chain *)i)->next; }
     static inline K &enumkey(void *i) { return H::getkey(((chain *)i)->elem); }
     static inline T &enumdata(void *i) { return H::getdata(((chain *)i)->elem); }
 };
 
-template<class T> struct hashset : hashbase<hashset<T>, T, T, T>
+/// Open addressing variant of hashbase with the same interface.
+/// Lookups probe a flat array of (hash, element) slots using robin hood ordering, so a hit
+/// usually costs one cache miss for the slot and one for the element, instead of walking a chain.
+/// Elements are still allocated in chunks, so pointers to them stay valid when the table grows.
+/// The table grows automatically, the size given on construction is only the initial slot count.
+/// Removing the current element while enumerating the table is safe, see enumfirst().
+/// @warning Removing other elements or inserting while enumerating may skip or repeat elements.
+template<class H, class E, class K, class T> struct openhashbase
 {
-    typedef hashbase<hashset<T>, T, T, T> basetype;
+    typedef E elemtype;
+    typedef K keytype;
+    typedef T datatype;
+
+    enum { CHUNKSIZE = 64 };
+
+    struct node
+    {
+        E elem;
+        node *next;
+    };
+    struct nodechunk
+    {
+        node nodes[CHUNKSIZE];
+        nodechunk *next;
+    };
+    /// An empty slot has no node, the hash is kept scrambled so the home slot is in its upper bits.
+    struct slot
+    {
+        uint hash;
+        node *n;
+    };
+
+    int size, shift;
+    int numelems;
+    slot *slots;
+    mutable int enumstart;
+
+    nodechunk *chunks;
+    node *unused;
+
+    enum { DEFAULTSIZE = 1<<10, MINSIZE = 1<<4 };
+
+    openhashbase(int size = DEFAULTSIZE)
+      : size(max(int(MINSIZE), size))
+    {
+        numelems = 0;
+        chunks = NULL;
+        unused = NULL;
+        enumstart = 0;
+        shift = 32 - bitscan(this->size);
+        slots = new slot[this->size];
+        memset(slots, 0, this->size*sizeof(slot));
+    }
+
+    ~openhashbase()
+    {
+        DELETEA(slots);
+        deletechunks();
+    }
+
+    /// fibonacci hashing, spreads the weak hthash() of integer keys over all slots.
+    static inline uint scramble(uint h) { return h*2654435769U; }
+    uint home(uint h) const { return h>>shift; }
+    uint probedist(uint i, uint h) const { return (i - home(h))&(size-1); }
+
+    void putslot(slot s)
+    {
+        for(uint i = home(s.hash), dist = 0;; i = (i+1)&(size-1), dist++)
+        {
+            slot &cur = slots[i];
+            if(!cur.n) { cur = s; return; }
+            uint curdist = probedist(i, cur.hash);
+            if(curdist < dist) { swap(cur, s); dist = curdist; }
+        }
+    }
+
+    void grow()
+    {
+        slot *oldslots = slots;
+        int oldsize = size;
+        size *= 2;
+        shift--;
+        slots = new slot[size];
+        memset(slots, 0, size*sizeof(slot));
+        loopi(oldsize) if(oldslots[i].n) putslot(oldslots[i]);
+        delete[] oldslots;
+    }
+
+    node *insert(uint h)
+    {
+        if((numelems+1)*8 > size*7) grow();
+        if(!unused)
+        {
+            nodechunk *chunk = new nodechunk;
+            chunk->next = chunks;
+            chunks = chunk;
+            loopi(CHUNKSIZE-1) chunk->nodes[i].next = &chunk->nodes[i+1];
+            chunk->nodes[CHUNKSIZE-1].next = unused;
+            unused = chunk->nodes;
+        }
+        node *n = unused;
+        unused = unused->next;
+        slot s = { h, n };
+        putslot(s);
+        numelems++;
+        return n;
+    }
+
+    template<class U>
+    T &insert(uint h, const U &key)
+    {
+        node *n = insert(h);
+        H::setkey(n->elem, key);
+        return H::getdata(n->elem);
+    }
+
+    /// returns the slot index of the key or -1 if it is not in the table.
+    template<class U>
+    int findslot(const U &key, uint h) const
+    {
+        for(uint i = home(h), dist = 0;; i = (i+1)&(size-1), dist++)
+        {
+            const slot &s = slots[i];
+            if(!s.n || probedist(i, s.hash) < dist) return -1;
+            if(s.hash == h && htcmp(key, H::getkey(s.n->elem))) return i;
+        }
+    }
+
+    template<class U>
+    T *access(const U &key)
+    {
+        int i = findslot(key, scramble(hthash(key)));
+        return i >= 0 ? &H::getdata(slots[i].n->elem) : NULL;
+    }
+
+    template<class U, class V>
+    T &access(const U &key, const V &elem)
+    {
+        uint h = scramble(hthash(key));
+        int i = findslot(key, h);
+        return i >= 0 ? H::getdata(slots[i].n->elem) : (insert(h, key) = elem);
+    }
+
+    template<class U>
+    T &operator[](const U &key)
+    {
+        uint h = scramble(hthash(key));
+        int i = findslot(key, h);
+        return i >= 0 ? H::getdata(slots[i].n->elem) : insert(h, key);
+    }
+
+    template<class U>
+    T &find(const U &key, T &notfound)
+    {
+        int i = findslot(key, scramble(hthash(key)));
+        return i >= 0 ? H::getdata(slots[i].n->elem) : notfound;
+    }
+
+    template<class U>
+    const T &find(const U &key, const T &notfound)
+    {
+        int i = findslot(key, scramble(hthash(key)));
+        return i >= 0 ? H::getdata(slots[i].n->elem) : notfound;
+    }
+
+    template<class U>
+    bool remove(const U &key)
+    {
+        int i = findslot(key, scramble(hthash(key)));
+        if(i < 0) return false;
+        node *n = slots[i].n;
+        n->elem.~E();
+        new (&n->elem) E;
+        n->next = unused;
+        unused = n;
+        numelems--;
+        // backward shift deletion: pull the following displaced slots one step closer to home.
+        for(uint j = (i+1)&(size-1);; i = j, j = (j+1)&(size-1))
+        {
+            slot &next = slots[j];
+            if(!next.n || !probedist(j, next.hash)) break;
+            slots[i] = next;
+        }
+        slots[i].hash = 0;
+        slots[i].n = NULL;
+        return true;
+    }
+
+    void deletechunks()
+    {
+        for(nodechunk *nextchunk; chunks; chunks = nextchunk)
+        {
+            nextchunk = chunks->next;
+            delete chunks;
+        }
+    }
+
+    void clear()
+    {
+        if(!numelems) return;
+        memset(slots, 0, size*sizeof(slot));
+        numelems = 0;
+        unused = NULL;
+        deletechunks();
+    }
+
+    /// enumeration walks the slots downwards, starting below an empty one. remove() only shifts elements
+    /// from above the removed slot up to the next empty one, which were all visited already.
+    node *enumfirst(int i) const
+    {
+        if(!i && slots[enumstart].n) for(enumstart = 0; slots[enumstart].n; enumstart++);
+        return slots[(enumstart - 1 - i)&(size-1)].n;
+    }
+    static inline node *enumnext(void *i) { return NULL; }
+    static inline K &enumkey(void *i) { return H::getkey(((node *)i)->elem); }
+    static inline T &enumdata(void *i) { return H::getdata(((node *)i)->elem); }
+};
+
+/// B selects the table implementation: chained (hashbase) or open addressing (openhashbase).
+template<class T, template<class, class, class, class> class B = hashbase> struct hashset : B<hashset<T, B>, T, T, T>
+{
+    typedef B<hashset<T, B>, T, T, T> basetype;
 
     hashset(int size = basetype::DEFAULTSIZE) : basetype(size) {}
 
@@ -1174,9 +1435,9 @@ template<class T> struct hashset : hashbase<hashset<T>, T, T, T>
     }
 };
 
-template<class T> struct hashnameset : hashbase<hashnameset<T>, T, const char *, T>
+template<class T, template<class, class, class, class> class B = hashbase> struct hashnameset : B<hashnameset<T, B>, T, const char *, T>
 {
-    typedef hashbase<hashnameset<T>, T, const char *, T> basetype;
+    typedef B<hashnameset<T, B>, T, const char *, T> basetype;
 
     hashnameset(int size = basetype::DEFAULTSIZE) : basetype(size) {}
 
@@ -1198,9 +1459,9 @@ template<class K, class T> struct hashtableentry
     T data;
 };
 
-template<class K, class T> struct hashtable : hashbase<hashtable<K, T>, hashtableentry<K, T>, K, T>
+template<class K, class T, template<class, class, class, class> class B = hashbase> struct hashtable : B<hashtable<K, T, B>, hashtableentry<K, T>, K, T>
 {
-    typedef hashbase<hashtable<K, T>, hashtableentry<K, T>, K, T> basetype;
+    typedef B<hashtable<K, T, B>, hashtableentry<K, T>, K, T> basetype;
     typedef typename basetype::elemtype elemtype;
 
     hashtable(int size = basetype::DEFAULTSIZE) : basetype(size) {}
@@ -1210,8 +1471,12 @@ template<class K, class T> struct hashtable : hashbase<hashtable<K, T>, hashtabl
     template<class U> static inline void setkey(elemtype &elem, const U &key) { elem.key = key; }
 };
 
-#define enumeratekt(ht,k,e,t,f,b) loopi((ht).size) for(void *ec = (ht).chains[i]; ec;) { k &e = (ht).enumkey(ec); t &f = (ht).enumdata(ec); ec = (ht).enumnext(ec); b; }
-#define enumerate(ht,t,e,b)       loopi((ht).size) for(void *ec = (ht).chains[i]; ec;) { t &e = (ht).enumdata(ec); ec = (ht).enumnext(ec); b; }
+template<class T> using openhashset = hashset<T, openhashbase>;
+template<class T> using openhashnameset = hashnameset<T, openhashbase>;
+template<class K, class T> using openhashtable = hashtable<K, T, openhashbase>;
+
+#define enumeratekt(ht,k,e,t,f,b) loopi((ht).size) for(void *ec = (ht).enumfirst(i); ec;) { k &e = (ht).enumkey(ec); t &f = (ht).enumdata(ec); ec = (ht).enumnext(ec); b; }
+#define enumerate(ht,t,e,b)       loopi((ht).size) for(void *ec = (ht).enumfirst(i); ec;) { t &e = (ht).enumdata(ec); ec = (ht).enumnext(ec); b; }
 
 struct unionfind
 {
@@ -1423,6 +1688,54 @@ struct streambuf
     size_t length() { return s->size(); }
 };
 
+/// A stream reading from and writing to a buffer in memory.
+/// Used to (de-)serialize data in pieces which are compressed or sent separately (e.g. the chunks of a map).
+struct memstream : stream
+{
+    vector<uchar> data;
+    offset pos;
+
+    memstream() : pos(0) {}
+
+    void close() {}
+    bool end() { return pos >= data.length(); }
+    offset tell() { return pos; }
+    offset size() { return data.length(); }
+
+    bool seek(offset off, int whence = SEEK_SET)
+    {
+        switch(whence)
+        {
+            case SEEK_END: off += data.length(); break;
+            case SEEK_CUR: off += pos; break;
+            case SEEK_SET: break;
+            default: return false;
+        }
+        if(off < 0 || off > data.length()) return false;
+        pos = off;
+        return true;
+    }
+
+    size_t read(void *buf, size_t len)
+    {
+        len = size_t(min(offset(len), max(data.length() - pos, offset(0))));
+        memcpy(buf, data.getbuf() + pos, len);
+        pos += len;
+        return len;
+    }
+
+    size_t write(const void *buf, size_t len)
+    {
+        if(pos + offset(len) > data.length()) data.pad(int(pos + len - data.length()));
+        memcpy(data.getbuf() + pos, buf, len);
+        pos += len;
+        return len;
+    }
+
+    int getchar() { return pos < data.length() ? data[pos++] : -1; }
+    bool putchar(int c) { if(pos < data.length()) data[pos] = c; else data.add(c); pos++; return true; }
+};
+
 
 /// bitmask for text formatting (?)
 enum
@@ -1475,11 +1788,13 @@ extern char *path(char *s);
 extern char *path(const char *s, bool copy);
 extern const char *parentdir(const char *directory);
 extern bool fileexists(const char *path, const char *mode);
+extern long long getfiletime(const char *path);
 extern bool createdir(const char *path);
 extern size_t fixpackagedir(char *dir);
 extern const char *sethomedir(const char *dir);
 extern const char *addpackagedir(const char *dir);
 extern const char *findfile(const char *filename, const char *mode);
+extern bool removefile(const char *filename);
 extern bool findzipfile(const char *filename);
 extern stream *openrawfile(const char *filename, const char *mode);
 extern stream *openzipfile(const char *filename, const char *mode);
@@ -1,5 +1,11 @@
 #include "inexor/shared/filesystem.h"
 
+#ifdef WIN32
+#include <io.h>
+#else
+#include <sys/mman.h>
+#endif
+
 enum
 {
     ZIP_LOCAL_FILE_SIGNATURE = 0x04034B50,
@@ -35,12 +41,15 @@ struct zipdirectoryheader
     ushort commentlength;
 };
 
+struct zipcacheentry;
+
 struct zipfile
 {
     char *name;
     uint header, offset, size, compressedsize;
+    zipcacheentry *cached;
 
-    zipfile() : name(NULL), header(0), offset(~0U), size(0), compressedsize(0)
+    zipfile() : name(NULL), header(0), offset(~0U), size(0), compressedsize(0), cached(NULL)
     {
     }
     ~zipfile() 
@@ -55,21 +64,64 @@ struct ziparchive
 {
     char *name;
     FILE *data;
-    hashnameset<zipfile> files;
+    openhashnameset<zipfile> files;
     int openfiles;
     zipstream *owner;
+    uchar *mapped; ///< the whole archive mapped into memory, NULL if it could not be mapped
+    size_t mappedsize;
+#ifdef WIN32
+    HANDLE mapping;
+#endif
 
-    ziparchive() : name(NULL), data(NULL), files(512), openfiles(0), owner(NULL)
+    ziparchive() : name(NULL), data(NULL), files(512), openfiles(0), owner(NULL), mapped(NULL), mappedsize(0)
+#ifdef WIN32
+        , mapping(NULL)
+#endif
     {
     }
     ~ziparchive()
     {
         DELETEA(name);
+        unmap();
         if(data) 
 		{
 			fclose(data); data = NULL; 
 		}
     }
+
+    /// Maps the archive into memory, so entries can be read without seeking the shared FILE handle.
+    bool map()
+    {
+        if(mapped || !data || fseek(data, 0, SEEK_END) < 0) return false;
+        long len = ftell(data);
+        if(len <= 0) return false;
+#ifdef WIN32
+        mapping = CreateFileMapping((HANDLE)_get_osfhandle(_fileno(data)), NULL, PAGE_READONLY, 0, 0, NULL);
+        if(!mapping) return false;
+        mapped = (uchar *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        if(!mapped) { CloseHandle(mapping); mapping = NULL; return false; }
+#else
+        void *p = mmap(NULL, len, PROT_READ, MAP_SHARED, fileno(data), 0);
+        if(p == MAP_FAILED) return false;
+        mapped = (uchar *)p;
+#endif
+        mappedsize = len;
+        return true;
+    }
+
+    void unmap()
+    {
+        if(!mapped) return;
+#ifdef WIN32
+        UnmapViewOfFile(mapped);
+        CloseHandle(mapping);
+        mapping = NULL;
+#else
+        munmap(mapped, mappedsize);
+#endif
+        mapped = NULL;
+        mappedsize = 0;
+    }
 };
 
 static bool findzipdirectory(FILE *f, zipdirectoryheader &hdr)
@@ -173,12 +225,8 @@ static bool readzipdirectory(const char *archname, FILE *f, int entries, int off
     return files.length() > 0;
 }
 
-static bool readlocalfileheader(FILE *f, ziplocalfileheader &h, uint offset)
+static bool parselocalfileheader(const uchar *src, ziplocalfileheader &h)
 {
-    uchar buf[ZIP_LOCAL_FILE_SIZE];
-    if(fseek(f, offset, SEEK_SET) < 0 || fread(buf, 1, ZIP_LOCAL_FILE_SIZE, f) != ZIP_LOCAL_FILE_SIZE)
-        return false;
-    uchar *src = buf;
     h.signature = lilswap(*(uint *)src); src += 4;
     h.version = lilswap(*(ushort *)src); src += 2;
     h.flags = lilswap(*(ushort *)src); src += 2;
@@ -195,12 +243,79 @@ static bool readlocalfileheader(FILE *f, ziplocalfileheader &h, uint offset)
     return true;
 }
 
+static bool readlocalfileheader(FILE *f, ziplocalfileheader &h, uint offset)
+{
+    uchar buf[ZIP_LOCAL_FILE_SIZE];
+    if(fseek(f, offset, SEEK_SET) < 0 || fread(buf, 1, ZIP_LOCAL_FILE_SIZE, f) != ZIP_LOCAL_FILE_SIZE)
+        return false;
+    return parselocalfileheader(buf, h);
+}
+
 static vector<ziparchive *> archives;
 
+#ifndef STANDALONE
+/// Guards the archive list, the entry cache and the FILE handles of the archives, files may be opened from several threads.
+/// @warning recursive: the holder may close streams while locked.
+static SDL_mutex *ziplock = NULL;
+static inline void lockzips() { if(ziplock) SDL_LockMutex(ziplock); }
+static inline void unlockzips() { if(ziplock) SDL_UnlockMutex(ziplock); }
+#else
+static inline void lockzips() {}
+static inline void unlockzips() {}
+#endif
+
+/// All loaded archives by their name.
+static openhashtable<const char *, ziparchive *> archivenames;
+
+/// A mounted file and the archive providing it.
+struct zipentry
+{
+    ziparchive *arch;
+    zipfile *file;
+};
+/// All mounted files of all archives, archives added later take precedence (hide the files of earlier ones).
+static openhashtable<const char *, zipentry> zipentries(1<<12);
+
+static void addzipentries(ziparchive *arch)
+{
+    enumerate(arch->files, zipfile, f,
+    {
+        zipentry &e = zipentries[f.name];
+        e.arch = arch;
+        e.file = &f;
+    });
+}
+
+static void rebuildzipentries()
+{
+    zipentries.clear();
+    loopv(archives) addzipentries(archives[i]);
+}
+
 ziparchive *findzip(const char *name)
 {
-    loopv(archives) if(!strcmp(name, archives[i]->name)) return archives[i];
-    return NULL;
+    ziparchive **arch = archivenames.access(name);
+    return arch ? *arch : NULL;
+}
+
+/// Finds the start of the data of f (behind its local header), the ziplock has to be held.
+static bool findzipdata(ziparchive *a, zipfile *f)
+{
+    if(f->offset != ~0U) return true;
+    ziplocalfileheader h;
+    if(a->mapped)
+    {
+        if(size_t(f->header) + ZIP_LOCAL_FILE_SIZE > a->mappedsize || !parselocalfileheader(&a->mapped[f->header], h)) return false;
+    }
+    else
+    {
+        a->owner = NULL;
+        if(!readlocalfileheader(a->data, h, f->header)) return false;
+    }
+    uint offset = f->header + ZIP_LOCAL_FILE_SIZE + h.namelength + h.extralength;
+    if(a->mapped && size_t(offset) + (f->compressedsize ? f->compressedsize : f->size) > a->mappedsize) return false;
+    f->offset = offset;
+    return true;
 }
 
 static bool checkprefix(vector<zipfile> &files, const char *prefix, int prefixlen)
@@ -299,13 +414,23 @@ bool addzip(const char *name, const char *mount = NULL, const char *strip = NULL
     ziparchive *arch = new ziparchive;
     arch->name = newstring(pname);
     arch->data = f;
+    arch->map();
     mountzip(*arch, files, mount, strip);
+#ifndef STANDALONE
+    if(!ziplock) ziplock = SDL_CreateMutex();
+#endif
+    lockzips();
     archives.add(arch);
+    archivenames[arch->name] = arch;
+    addzipentries(arch);
+    unlockzips();
 
     conoutf("added zip %s", pname);
     return true;
 } 
      
+static void uncachezip(ziparchive *arch);
+
 bool removezip(const char *name)
 {
     string pname;
@@ -319,13 +444,19 @@ bool removezip(const char *name)
         conoutf(CON_ERROR, "zip %s is not loaded", pname);
         return false;
     }
+    lockzips();
     if(exists->openfiles)
     {
+        unlockzips();
         conoutf(CON_ERROR, "zip %s has open files", pname);
         return false;
     }
     conoutf("removed zip %s", exists->name);
     archives.removeobj(exists); 
+    archivenames.remove(exists->name);
+    rebuildzipentries();
+    uncachezip(exists);
+    unlockzips();
     delete exists;
     return true;
 }
@@ -362,27 +493,31 @@ struct zipstream : stream
     {
         if(!zfile.avail_in) zfile.next_in = (Bytef *)buf;
         size = min(size, uint(&buf[BUFSIZE] - &zfile.next_in[zfile.avail_in]));
+        if(arch->mapped)
+        {
+            uint n = min(size, info->offset + info->compressedsize - reading);
+            memcpy(zfile.next_in + zfile.avail_in, &arch->mapped[reading], n);
+            zfile.avail_in += n;
+            reading += n;
+            return;
+        }
+        lockzips();
         if(arch->owner != this)
         {
             arch->owner = NULL;
             if(fseek(arch->data, reading, SEEK_SET) >= 0) arch->owner = this;
-            else return;
+            else { unlockzips(); return; }
         }
         uint remaining = info->offset + info->compressedsize - reading,
-             n = arch->owner == this ? fread(zfile.next_in + zfile.avail_in, 1, min(size, remaining), arch->data) : 0U;
+             n = fread(zfile.next_in + zfile.avail_in, 1, min(size, remaining), arch->data);
+        unlockzips();
         zfile.avail_in += n;
         reading += n;
     }
 
     bool open(ziparchive *a, zipfile *f)
     {
-        if(f->offset == ~0U)
-        {
-            ziplocalfileheader h;
-            a->owner = NULL;
-            if(!readlocalfileheader(a->data, h, f->header)) return false;
-            f->offset = f->header + ZIP_LOCAL_FILE_SIZE + h.namelength + h.extralength;
-        }
+        if(!findzipdata(a, f)) return false;
 
         if(f->compressedsize && inflateInit2(&zfile, -MAX_WBITS) != Z_OK) return false;
 
@@ -409,7 +544,14 @@ struct zipstream : stream
     {
         stopreading();
         DELETEA(buf);
-        if(arch) { arch->owner = NULL; arch->openfiles--; arch = NULL; }
+        if(arch)
+        {
+            lockzips();
+            if(arch->owner == this) arch->owner = NULL;
+            arch->openfiles--;
+            unlockzips();
+            arch = NULL;
+        }
     }
 
     offset size() { return info->size; }
@@ -429,9 +571,11 @@ struct zipstream : stream
                 default: return false;
             } 
             pos = clamp(pos, offset(info->offset), offset(info->offset + info->size));
+            lockzips();
             arch->owner = NULL;
-            if(fseek(arch->data, int(pos), SEEK_SET) < 0) return false;
+            if(fseek(arch->data, int(pos), SEEK_SET) < 0) { unlockzips(); return false; }
             arch->owner = this;
+            unlockzips();
             reading = pos;
             ended = false;
             return true;
@@ -451,7 +595,9 @@ struct zipstream : stream
             zfile.next_in += zfile.avail_in;
             zfile.avail_in = 0;
             zfile.total_in = info->compressedsize; 
-            arch->owner = NULL;
+            lockzips();
+            if(arch->owner == this) arch->owner = NULL;
+            unlockzips();
             ended = false;
             return true;
         }
@@ -467,7 +613,9 @@ struct zipstream : stream
             }
             else
             {
-                arch->owner = NULL;
+                lockzips();
+                if(arch->owner == this) arch->owner = NULL;
+                unlockzips();
                 zfile.avail_in = 0;
                 zfile.next_in = NULL;
                 reading = info->offset;
@@ -492,14 +640,16 @@ struct zipstream : stream
         if(reading == ~0U || !buf || !len) return 0;
         if(!info->compressedsize)
         {
+            lockzips();
             if(arch->owner != this)
             {
                 arch->owner = NULL;
-                if(fseek(arch->data, reading, SEEK_SET) < 0) { stopreading(); return 0; }
+                if(fseek(arch->data, reading, SEEK_SET) < 0) { unlockzips(); stopreading(); return 0; }
                 arch->owner = this;
             }
               
             size_t n = fread(buf, 1, min(len, size_t(info->size + info->offset - reading)), arch->data);
+            unlockzips();
             reading += n;
             if(n < len) ended = true;
             return n;
@@ -528,29 +678,248 @@ struct zipstream : stream
     }
 };
 
+static void trimzipcache();
+
+/// Memory used for decompressed zip entries in MB.
+VARF(zipcachesize, 0, 32, 1024, { lockzips(); trimzipcache(); unlockzips(); });
+
+/// Entries bigger than this (in KB) are not cached but inflated while being read.
+VAR(zipcachemax, 0, 4096, 1<<20);
+
+/// A decompressed zip entry, kept so models and textures which are loaded again and again are inflated only once.
+struct zipcacheentry
+{
+    zipfile *file;
+    uchar *data;
+    int refs; ///< open streams reading data, it stays cached until they are closed
+    bool loading; ///< still being inflated (without data and not in the cache list yet), others read the entry uncached meanwhile
+    zipcacheentry *prev, *next; ///< the entries from the most to the least recently used
+};
+
+static zipcacheentry *cachenewest = NULL, *cacheoldest = NULL;
+static size_t cachedbytes = 0;
+
+static void unlinkcacheentry(zipcacheentry *c)
+{
+    if(c->prev) c->prev->next = c->next;
+    else cachenewest = c->next;
+    if(c->next) c->next->prev = c->prev;
+    else cacheoldest = c->prev;
+    c->prev = c->next = NULL;
+}
+
+static void linkcacheentry(zipcacheentry *c)
+{
+    c->prev = NULL;
+    c->next = cachenewest;
+    if(cachenewest) cachenewest->prev = c;
+    else cacheoldest = c;
+    cachenewest = c;
+}
+
+static void freecacheentry(zipcacheentry *c)
+{
+    unlinkcacheentry(c);
+    cachedbytes -= c->file->size;
+    c->file->cached = NULL;
+    delete[] c->data;
+    delete c;
+}
+
+/// Drops the least recently used entries nobody reads anymore until the cache fits into zipcachesize.
+static void trimzipcache()
+{
+    size_t limit = size_t(zipcachesize)<<20;
+    for(zipcacheentry *c = cacheoldest; c && cachedbytes > limit;)
+    {
+        zipcacheentry *prev = c->prev;
+        if(!c->refs) freecacheentry(c);
+        c = prev;
+    }
+}
+
+static void uncachezip(ziparchive *arch)
+{
+    enumerate(arch->files, zipfile, f, { if(f.cached) freecacheentry(f.cached); });
+}
+
+/// Decompresses the whole entry at once, called without the ziplock so other threads can open files meanwhile.
+/// The caller keeps the archive open (arch->openfiles) and has found the data of f already.
+static uchar *inflatezipfile(ziparchive *a, zipfile *f)
+{
+    uchar *data = new uchar[f->size];
+    bool ok = false;
+    if(a->mapped)
+    {
+        z_stream zfile;
+        memset(&zfile, 0, sizeof(zfile));
+        if(inflateInit2(&zfile, -MAX_WBITS) == Z_OK)
+        {
+            zfile.next_in = (Bytef *)&a->mapped[f->offset];
+            zfile.avail_in = f->compressedsize;
+            zfile.next_out = (Bytef *)data;
+            zfile.avail_out = f->size;
+            int err = inflate(&zfile, Z_FINISH);
+            ok = (err == Z_STREAM_END || err == Z_OK || err == Z_BUF_ERROR) && zfile.total_out == f->size;
+            inflateEnd(&zfile);
+        }
+    }
+    else
+    {
+        zipstream s;
+        lockzips();
+        ok = s.open(a, f);
+        unlockzips();
+        ok = ok && s.read(data, f->size) == f->size;
+    }
+    if(!ok)
+    {
+#ifndef STANDALONE
+        if(dbgzip) conoutf(CON_DEBUG, "%s: could not inflate %s", a->name, f->name);
+#endif
+        delete[] data;
+        return NULL;
+    }
+    return data;
+}
+
+/// Reads a zip entry which is completely in memory: a stored entry of a mapped archive or a cached decompressed one.
+/// Does not touch the archive while reading, so any number of threads can read from the same archive at once.
+struct zipmemstream : stream
+{
+    ziparchive *arch;
+    zipcacheentry *cached;
+    const uchar *data;
+    offset len, pos;
+
+    /// The ziplock has to be held, the caller already accounted the stream in arch->openfiles and cached->refs.
+    zipmemstream(ziparchive *arch, zipcacheentry *cached, const uchar *data, offset len) : arch(arch), cached(cached), data(data), len(len), pos(0)
+    {
+    }
+
+    ~zipmemstream()
+    {
+        close();
+    }
+
+    void close()
+    {
+        if(!arch) return;
+        lockzips();
+        if(cached && !--cached->refs) trimzipcache();
+        arch->openfiles--;
+        unlockzips();
+        arch = NULL;
+        cached = NULL;
+        data = NULL;
+    }
+
+    bool end() { return pos >= len; }
+    offset tell() { return data ? pos : offset(-1); }
+    offset size() { return len; }
+
+    bool seek(offset off, int whence)
+    {
+        if(!data) return false;
+        switch(whence)
+        {
+            case SEEK_END: off += len; break;
+            case SEEK_CUR: off += pos; break;
+            case SEEK_SET: break;
+            default: return false;
+        }
+        if(off < 0) return false;
+        pos = min(off, len);
+        return true;
+    }
+
+    size_t read(void *buf, size_t n)
+    {
+        if(!data || pos >= len || !buf) return 0;
+        n = (size_t)min(offset(n), len - pos);
+        memcpy(buf, &data[pos], n);
+        pos += n;
+        return n;
+    }
+
+    int getchar() { return data && pos < len ? data[pos++] : -1; }
+};
+
+/// Opens f for reading: from the cache or the mapping if possible.
+/// The ziplock has to be held (just once, since it is released while an entry gets inflated into the cache).
+static stream *openzipentry(ziparchive *a, zipfile *f)
+{
+    if(!findzipdata(a, f)) return NULL;
+    if(f->cached && !f->cached->loading)
+    {
+        unlinkcacheentry(f->cached);
+        linkcacheentry(f->cached);
+        f->cached->refs++;
+        a->openfiles++;
+        return new zipmemstream(a, f->cached, f->cached->data, f->size);
+    }
+    if(a->mapped && !f->compressedsize)
+    {
+        a->openfiles++;
+        return new zipmemstream(a, NULL, &a->mapped[f->offset], f->size);
+    }
+    if(!f->cached && f->compressedsize && f->size <= size_t(zipcachemax)<<10 && f->size <= size_t(zipcachesize)<<20)
+    {
+        zipcacheentry *c = new zipcacheentry;
+        c->file = f;
+        c->data = NULL;
+        c->refs = 1;
+        c->loading = true;
+        c->prev = c->next = NULL;
+        f->cached = c;
+        a->openfiles++; // the archive can't be removed meanwhile
+        unlockzips();
+        uchar *data = inflatezipfile(a, f);
+        lockzips();
+        c->loading = false;
+        if(data)
+        {
+            c->data = data;
+            linkcacheentry(c);
+            cachedbytes += f->size;
+            trimzipcache();
+            return new zipmemstream(a, c, data, f->size);
+        }
+        f->cached = NULL;
+        delete c;
+        a->openfiles--;
+    }
+    zipstream *s = new zipstream;
+    if(s->open(a, f)) return s;
+    delete s;
+    return NULL;
+}
+
 stream *openzipfile(const char *name, const char *mode)
 {
     for(; *mode; mode++) if(*mode=='w' || *mode=='a') return NULL;
-    loopvrev(archives)
+    lockzips();
+    stream *s = NULL;
+    zipentry *e = zipentries.access(name);
+    ziparchive *broken = e ? e->arch : NULL; // e doesn't survive archives added while the entry was inflated
+    if(e && !(s = openzipentry(e->arch, e->file))) loopvrev(archives) // retry the files hidden by the broken one
     {
+        if(i >= archives.length()) continue; // removed while an entry was inflated
         ziparchive *arch = archives[i];
+        if(arch == broken) continue;
         zipfile *f = arch->files.access(name);
-        if(!f) continue;
-        zipstream *s = new zipstream;
-        if(s->open(arch, f)) return s;
-        delete s;
+        if(f && (s = openzipentry(arch, f))) break;
     }
-    return NULL;
+    unlockzips();
+    return s;
 }
 
 bool findzipfile(const char *name)
 {
-    loopvrev(archives)
-    {
-        ziparchive *arch = archives[i];
-        if(arch->files.access(name)) return true;
-    }
-    return false;
+    lockzips();
+    bool found = zipentries.access(name) != NULL;
+    unlockzips();
+    return found;
 }
 
 int listzipfiles(const char *dir, const char *ext, vector<char *> &files)
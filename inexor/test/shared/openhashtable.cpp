@@ -0,0 +1,84 @@
+#include <unordered_map>
+#include <unordered_set>
+
+// only the containers are tested, so leave out everything SDL and GL related
+#define STANDALONE
+#include "inexor/shared/cube.h"
+
+#include "gtest/gtest.h"
+
+#include "inexor/test/helpers.h"
+
+using namespace std;
+
+namespace {
+  typedef openhashtable<int, int> table;
+
+  test(openhashtable, MatchesUnorderedMap) {
+    table t(16);
+    unordered_map<int, int> ref;
+    for (int i = 0; i < 20000; i++) {
+      int key = rand<int>(0, 4000), op = rand<int>(0, 2);
+      if (op == 0) {
+        t[key] = i;
+        ref[key] = i;
+      } else if (op == 1) {
+        expectEq(t.remove(key), ref.erase(key) > 0);
+      } else {
+        int *v = t.access(key);
+        auto it = ref.find(key);
+        expectEq(v != NULL, it != ref.end()) << "key " << key;
+        if (v && it != ref.end()) expectEq(*v, it->second);
+      }
+    }
+    expectEq(t.numelems, int(ref.size()));
+    for (auto &kv : ref) {
+      int *v = t.access(kv.first);
+      assert(v != NULL);
+      expectEq(*v, kv.second);
+    }
+  }
+
+  test(openhashtable, ElementsStayPutWhenGrowing) {
+    table t(16);
+    int *first = &t[0];
+    *first = 42;
+    for (int i = 1; i < 5000; i++) t[i] = i;
+    expectEq(t.access(0), first);
+    expectEq(*first, 42);
+  }
+
+  // Removing the current element inside enumerate must still visit every other element exactly once
+  test(openhashtable, RemoveWhileEnumerating) {
+    for (int round = 0; round < 50; round++) {
+      table t(16);
+      unordered_set<int> keys;
+      int num = rand<int>(1, 3000);
+      for (int i = 0; i < num; i++) {
+        int key = rand<int>(0, 1<<20);
+        t[key] = key;
+        keys.insert(key);
+      }
+      unordered_set<int> seen;
+      enumeratekt(t, int, key, int, val, {
+        expectEq(key, val);
+        expect(seen.insert(key).second) << "visited " << key << " twice";
+        if (key & 1) t.remove(key);
+      });
+      expectEq(seen, keys);
+      for (int key : keys) expectEq(t.access(key) != NULL, !(key & 1));
+    }
+  }
+
+  test(openhashnameset, RemoveByName) {
+    struct named { const char *name; int n; };
+    openhashnameset<named> s;
+    const char *names[] = { "alpha", "beta", "gamma", "delta" };
+    for (int i = 0; i < 4; i++) { named n = { names[i], i }; s.add(n); }
+    assert(s.remove("beta"));
+    assertNot(s.remove("beta"));
+    expectEq(s.access("beta"), (named *)NULL);
+    assert(s.access("gamma") != NULL);
+    expectEq(s.access("gamma")->n, 2);
+  }
+}